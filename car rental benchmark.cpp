@@ -0,0 +1,387 @@
+/*****************************************************************************************
+ * Car Rental System - Benchmark Suite
+ * ---------------------------------------------------------------------------------------
+ * Description  : Generates a deterministic synthetic data set of any size, then measures
+ *                the CarRentalSystem engine against it: loading, checkpointing, primary-key
+ *                lookups, rent/return throughput and report generation. Every result is
+ *                reported as ops/sec, latency percentiles and the process's peak RSS so
+ *                optimisations can be compared against a baseline run.
+ *
+ *                Build (from the repository root):
+ *                    g++ -std=c++17 -O2 -pthread "car rental benchmark.cpp" -o car_rental_bench
+ *
+ *                Run, e.g. at the full production scale:
+ *                    ./car_rental_bench --cars 1000000 --customers 10000000 \
+ *                                       --rentals 100000000 --payments 100000000
+ *
+ *****************************************************************************************/
+
+ #define CAR_RENTAL_NO_MAIN
+ #include "car rental system.cpp"
+
+ #include <chrono>
+ #include <filesystem>
+ #if !defined(_WIN32)
+ #include <sys/resource.h>
+ #endif
+
+ /*****************************************************************************************
+  * Utility Functions
+  *****************************************************************************************/
+ // Peak resident set size of this process in MiB (0 where unsupported).
+ double peakRssMiB() {
+ #if defined(_WIN32)
+     return 0.0;
+ #else
+     struct rusage usage;
+     getrusage(RUSAGE_SELF, &usage);
+ #if defined(__APPLE__)
+     return usage.ru_maxrss / (1024.0 * 1024.0);
+ #else
+     return usage.ru_maxrss / 1024.0;
+ #endif
+ #endif
+ }
+
+ /*****************************************************************************************
+  * Class: SyntheticRandom
+  * Description: SplitMix64 generator. Fixed seeds make every generated data set and every
+  *              operation sequence reproducible across runs and machines.
+  *****************************************************************************************/
+ class SyntheticRandom {
+ private:
+     uint64_t state;
+ public:
+     explicit SyntheticRandom(uint64_t seed) : state(seed) {}
+
+     uint64_t next() {
+         uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+         z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+         z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+         return z ^ (z >> 31);
+     }
+
+     // Uniform integer in [0, bound).
+     uint64_t below(uint64_t bound) { return bound == 0 ? 0 : next() % bound; }
+ };
+
+ /*****************************************************************************************
+  * Class: SyntheticDataGenerator
+  * Description: Writes cars.txt, customers.txt, rentals.txt and payments.txt in the format
+  *              the system loads. Rows are formatted into a large buffer and written in
+  *              blocks so generation of 100M-row tables stays I/O bound.
+  *****************************************************************************************/
+ class SyntheticDataGenerator {
+ private:
+     string directory;
+     SyntheticRandom random;
+
+     static const char* brandName(uint64_t i) {
+         static const char* brands[] = {"Toyota", "Honda", "Ford", "Chevrolet", "Nissan", "BMW", "Audi",
+                                        "Mercedes", "Kia", "Hyundai", "Mazda", "Subaru", "Volkswagen",
+                                        "Tesla", "Volvo", "Jeep", "Lexus", "Peugeot", "Renault", "Skoda"};
+         return brands[i % (sizeof(brands) / sizeof(brands[0]))];
+     }
+
+     static const char* modelName(uint64_t i) {
+         static const char* models[] = {"Sedan", "Hatchback", "Coupe", "SUV", "Wagon", "Pickup", "Van",
+                                        "Convertible", "Crossover", "Compact"};
+         return models[i % (sizeof(models) / sizeof(models[0]))];
+     }
+
+     // Formats a timestamp within 2024 from a second offset.
+     static void formatTimestamp(uint64_t seconds, char* out, size_t size) {
+         time_t base = 1704067200;  // 2024-01-01 00:00:00 UTC
+         time_t t = base + static_cast<time_t>(seconds % (365ull * 86400));
+         tm parts;
+ #if defined(_WIN32)
+         gmtime_s(&parts, &t);
+ #else
+         gmtime_r(&t, &parts);
+ #endif
+         strftime(out, size, "%Y-%m-%d %H:%M:%S", &parts);
+     }
+
+     // Streams rows produced by formatRow(i, buffer) into path.
+     template <typename FormatRow>
+     void writeTable(const string& path, uint64_t rows, FormatRow formatRow) {
+         FILE* file = fopen(path.c_str(), "wb");
+         if(!file) {
+             cerr << "Cannot write " << path << endl;
+             return;
+         }
+         string block;
+         block.reserve(1 << 22);
+         for (uint64_t i = 0; i < rows; i++) {
+             formatRow(i, block);
+             if(block.size() >= (1 << 22) - 256) {
+                 fwrite(block.data(), 1, block.size(), file);
+                 block.clear();
+             }
+         }
+         fwrite(block.data(), 1, block.size(), file);
+         fclose(file);
+     }
+
+ public:
+     SyntheticDataGenerator(const string& dir, uint64_t seed) : directory(dir), random(seed) {}
+
+     static string plateFor(uint64_t i) {
+         char plate[32];
+         snprintf(plate, sizeof(plate), "BN%08llu", static_cast<unsigned long long>(i));
+         return plate;
+     }
+
+     // Cars are spread evenly over BranchCount branches.
+     static const int BranchCount = 8;
+
+     static string branchFor(uint64_t i) { return "Branch" + to_string(i % BranchCount); }
+
+     void generate(uint64_t carCount, uint64_t customerCount, uint64_t rentalCount, uint64_t paymentCount) {
+         char line[256];
+         writeTable(directory + "cars.txt", carCount, [&](uint64_t i, string& out) {
+             uint64_t r = random.next();
+             double price = 20.0 + (r % 28000) / 100.0;
+             int length = snprintf(line, sizeof(line), "%s,%s,%s,%d,%.2f,1,%s\n", plateFor(i).c_str(),
+                                   brandName(r >> 16), modelName(r >> 24), 1995 + static_cast<int>((r >> 32) % 30), price,
+                                   branchFor(i).c_str());
+             out.append(line, length);
+         });
+         writeTable(directory + "customers.txt", customerCount, [&](uint64_t i, string& out) {
+             int length = snprintf(line, sizeof(line), "%llu,Customer %llu,DL%010llu,555-%07llu\n",
+                                   static_cast<unsigned long long>(i + 1), static_cast<unsigned long long>(i + 1),
+                                   static_cast<unsigned long long>(random.below(10000000000ull)),
+                                   static_cast<unsigned long long>(i % 10000000));
+             out.append(line, length);
+         });
+         // Historic rentals are all closed so every car starts out available.
+         writeTable(directory + "rentals.txt", rentalCount, [&](uint64_t i, string& out) {
+             char start[32], end[32];
+             uint64_t startSeconds = random.below(300ull * 86400);
+             uint64_t days = 1 + random.below(14);
+             formatTimestamp(startSeconds, start, sizeof(start));
+             formatTimestamp(startSeconds + days * 86400, end, sizeof(end));
+             int length = snprintf(line, sizeof(line), "%llu,%llu,%s,%s,%s,%.2f\n",
+                                   static_cast<unsigned long long>(i + 1),
+                                   static_cast<unsigned long long>(1 + random.below(max<uint64_t>(1, customerCount))),
+                                   plateFor(random.below(max<uint64_t>(1, carCount))).c_str(), start, end,
+                                   days * (20.0 + random.below(28000) / 100.0));
+             out.append(line, length);
+         });
+         writeTable(directory + "payments.txt", paymentCount, [&](uint64_t i, string& out) {
+             char date[32];
+             formatTimestamp(random.below(365ull * 86400), date, sizeof(date));
+             int length = snprintf(line, sizeof(line), "%llu,%llu,%.2f,%s,%s\n",
+                                   static_cast<unsigned long long>(i + 1),
+                                   static_cast<unsigned long long>(1 + random.below(max<uint64_t>(1, rentalCount))),
+                                   20.0 + random.below(400000) / 100.0, (i & 1) ? "Cash" : "CreditCard", date);
+             out.append(line, length);
+         });
+     }
+ };
+
+ /*****************************************************************************************
+  * Class: LatencyRecorder
+  * Description: Collects per-operation latencies and summarises them as throughput and
+  *              percentiles.
+  *****************************************************************************************/
+ class LatencyRecorder {
+ private:
+     vector<uint64_t> samples;
+     uint64_t totalNanos;
+ public:
+     LatencyRecorder() : totalNanos(0) {}
+
+     void reserve(size_t n) { samples.reserve(n); }
+
+     void record(uint64_t nanos) {
+         samples.push_back(nanos);
+         totalNanos += nanos;
+     }
+
+     void print(const string& name) {
+         sort(samples.begin(), samples.end());
+         auto percentile = [this](double p) -> double {
+             if(samples.empty()) {
+                 return 0.0;
+             }
+             size_t rank = min(samples.size() - 1, static_cast<size_t>(p * samples.size()));
+             return samples[rank] / 1000.0;
+         };
+         double seconds = totalNanos / 1e9;
+         double opsPerSec = seconds > 0 ? samples.size() / seconds : 0.0;
+         printf("%-22s %12zu %14.0f %10.2f %10.2f %10.2f %12.2f %10.1f\n", name.c_str(), samples.size(), opsPerSec,
+                percentile(0.50), percentile(0.90), percentile(0.99), samples.empty() ? 0.0 : samples.back() / 1000.0,
+                peakRssMiB());
+         fflush(stdout);
+     }
+ };
+
+ /*****************************************************************************************
+  * Class: RentalBenchmark
+  * Description: Drives one CarRentalSystem through each measured operation.
+  *****************************************************************************************/
+ class RentalBenchmark {
+ private:
+     string directory;
+     uint64_t carCount, customerCount, rentalCount, paymentCount, opCount;
+
+     static uint64_t nowNanos() {
+         return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+     }
+
+     // Times fn() once and reports it as a single operation.
+     template <typename Fn>
+     static void timeOnce(const string& name, Fn fn) {
+         LatencyRecorder recorder;
+         uint64_t start = nowNanos();
+         fn();
+         recorder.record(nowNanos() - start);
+         recorder.print(name);
+     }
+
+     // Times opCount calls of fn(i) individually.
+     template <typename Fn>
+     void timeEach(const string& name, uint64_t count, Fn fn) {
+         LatencyRecorder recorder;
+         recorder.reserve(count);
+         for (uint64_t i = 0; i < count; i++) {
+             uint64_t start = nowNanos();
+             fn(i);
+             recorder.record(nowNanos() - start);
+         }
+         recorder.print(name);
+     }
+
+ public:
+     RentalBenchmark(const string& dir, uint64_t cars, uint64_t customers, uint64_t rentals, uint64_t payments, uint64_t ops)
+         : directory(dir), carCount(cars), customerCount(customers), rentalCount(rentals), paymentCount(payments), opCount(ops) {}
+
+     void run() {
+         printf("%-22s %12s %14s %10s %10s %10s %12s %10s\n", "benchmark", "ops", "ops/sec", "p50(us)", "p90(us)",
+                "p99(us)", "max(us)", "rss(MiB)");
+
+         timeOnce("generate", [&] {
+             SyntheticDataGenerator(directory, 42).generate(carCount, customerCount, rentalCount, paymentCount);
+         });
+
+         CarRentalSystem system(directory);
+         timeOnce("loadData", [&] { system.loadData(); });
+
+         // Hits are counted and printed so the compiler cannot drop the lookups.
+         SyntheticRandom random(7);
+         uint64_t hits = 0;
+         timeEach("findCarIndex", opCount, [&](uint64_t) {
+             hits += system.findCarIndex(SyntheticDataGenerator::plateFor(random.below(carCount))) != -1;
+         });
+         timeEach("findCustomerIndex", opCount, [&](uint64_t) {
+             hits += system.findCustomerIndex(1 + static_cast<int>(random.below(customerCount))) != -1;
+         });
+         timeEach("findRentalIndex", opCount, [&](uint64_t) {
+             hits += system.findRentalIndex(1 + static_cast<int>(random.below(rentalCount))) != -1;
+         });
+         printf("%-22s %12llu\n", "lookupHits", static_cast<unsigned long long>(hits));
+         // Customer search with a misspelled name; the customer itself should rank first.
+         uint64_t found = 0;
+         timeEach("searchCustomers", min<uint64_t>(opCount, 10000), [&](uint64_t) {
+             uint64_t id = 1 + random.below(customerCount);
+             auto matches = system.searchCustomers("Custmer " + to_string(id), 10);
+             found += !matches.empty() && matches[0].first.getId() == static_cast<int>(id);
+         });
+         printf("%-22s %12llu\n", "searchFirstHits", static_cast<unsigned long long>(found));
+         // Fleet searches across every branch (fanned out to all shards) and within one.
+         found = 0;
+         timeEach("searchCars", min<uint64_t>(opCount, 10000), [&](uint64_t i) {
+             CarQuery query;
+             query.brand = "Toyota";
+             query.offset = (i % 5) * query.limit;
+             bool more;
+             found += system.searchCars(query, more).size();
+         });
+         timeEach("searchBranch", min<uint64_t>(opCount, 10000), [&](uint64_t i) {
+             CarQuery query;
+             query.branch = SyntheticDataGenerator::branchFor(i);
+             query.brand = "Toyota";
+             query.offset = (i % 5) * query.limit;
+             bool more;
+             found += system.searchCars(query, more).size();
+         });
+         printf("%-22s %12llu\n", "searchCarHits", static_cast<unsigned long long>(found));
+
+         // Rent cars in order so every rental succeeds, then return them in the same order.
+         // Every fourth rental is one-way, so its return moves the car to the next branch.
+         uint64_t transactions = min(opCount, carCount);
+         vector<int> rentalIds(transactions);
+         int today = todayDayNumber();
+         timeEach("rentCar", transactions, [&](uint64_t i) {
+             double cost;
+             system.rentCar(1 + static_cast<int>(i % max<uint64_t>(1, customerCount)),
+                            SyntheticDataGenerator::plateFor(i), today, today + 3, rentalIds[i], cost,
+                            i % 4 == 0 ? SyntheticDataGenerator::branchFor(i + 1) : string());
+         });
+         timeEach("returnCar", transactions, [&](uint64_t i) {
+             double finalCost;
+             system.returnCar(rentalIds[i], finalCost);
+         });
+         system.journal.commit();
+
+         // Reports are written to files in the data directory; systemStatus goes to a
+         // discarding stream so only its generation cost is measured.
+         timeOnce("generateReport", [&] {
+             ReportSink sink(directory + "report.csv");
+             system.generateReport(ReportRentals, ReportFilter(), sink);
+         });
+         timeOnce("revenueByCustomer", [&] {
+             ReportSink sink(directory + "revenue.csv");
+             system.generateReport(ReportCustomers, ReportFilter(), sink);
+         });
+         streambuf* console = cout.rdbuf(nullptr);
+         timeOnce("systemStatus", [&] { system.systemStatus(); });
+         cout.rdbuf(console);
+         cout.clear();
+
+         timeOnce("saveData", [&] { system.saveData(); });
+     }
+ };
+
+ /*****************************************************************************************
+  * Main Function
+  * Description: Parses the scale options and runs the suite.
+  *****************************************************************************************/
+ int main(int argc, char* argv[]) {
+     uint64_t cars = 100000, customers = 1000000, rentals = 1000000, payments = 1000000, ops = 1000000;
+     string directory = "bench_data/";
+     bool keep = false;
+     for (int i = 1; i < argc; i++) {
+         string option = argv[i];
+         auto value = [&]() -> uint64_t { return i + 1 < argc ? strtoull(argv[++i], nullptr, 10) : 0; };
+         if(option == "--cars") cars = value();
+         else if(option == "--customers") customers = value();
+         else if(option == "--rentals") rentals = value();
+         else if(option == "--payments") payments = value();
+         else if(option == "--ops") ops = value();
+         else if(option == "--dir" && i + 1 < argc) directory = string(argv[++i]) + "/";
+         else if(option == "--keep") keep = true;
+         else {
+             cout << "Usage: " << argv[0] << " [--cars N] [--customers N] [--rentals N] [--payments N]"
+                  << " [--ops N] [--dir path] [--keep]" << endl;
+             return 1;
+         }
+     }
+     if(cars == 0 || customers == 0) {
+         cout << "At least one car and one customer are required." << endl;
+         return 1;
+     }
+
+     filesystem::remove_all(directory);
+     filesystem::create_directories(directory);
+     printf("cars=%llu customers=%llu rentals=%llu payments=%llu ops=%llu dir=%s\n",
+            static_cast<unsigned long long>(cars), static_cast<unsigned long long>(customers),
+            static_cast<unsigned long long>(rentals), static_cast<unsigned long long>(payments),
+            static_cast<unsigned long long>(ops), directory.c_str());
+     RentalBenchmark(directory, cars, customers, rentals, payments, ops).run();
+     if(!keep) {
+         filesystem::remove_all(directory);
+     }
+     return 0;
+ }
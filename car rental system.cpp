@@ -26,623 +26,7365 @@
  #include <iomanip>
  #include <algorithm>
  #include <cstdlib>
+ #include <cstdio>
+ #include <cstdint>
+ #include <cstring>
+ #include <cctype>
+ #include <cmath>
+ #include <functional>
+ #include <unordered_map>
+ #include <map>
+ #include <string_view>
+ #include <charconv>
+ #include <thread>
+ #include <mutex>
+ #include <shared_mutex>
+ #include <atomic>
+ #include <condition_variable>
+ #include <future>
+ #include <queue>
+ #include <deque>
+ #include <memory>
+ #include <limits>
+ #include <chrono>
+ #include <csignal>
+ #if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+ #include <emmintrin.h>
+ #define CAR_RENTAL_SSE2 1
+ #endif
+ #if defined(_WIN32)
+ #include <io.h>
+ #include <intrin.h>
+ #else
+ #include <unistd.h>
+ #include <fcntl.h>
+ #include <sys/mman.h>
+ #include <sys/stat.h>
+ #include <sys/socket.h>
+ #include <netinet/in.h>
+ #include <netinet/tcp.h>
+ #include <arpa/inet.h>
+ #include <poll.h>
+ #endif
  
  using namespace std;
  
  /*****************************************************************************************
   * Utility Functions
   *****************************************************************************************/
- // Returns the current date and time as a formatted string.
- string getCurrentDateTime() {
-     time_t now = time(0);
-     tm *ltm = localtime(&now);
-     char buffer[80];
-     strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", ltm);
-     return string(buffer);
+ // Thread-safe localtime(): the server calls the date helpers from several threads.
+ tm localTime(time_t when) {
+     tm result = {};
+ #if defined(_WIN32)
+     localtime_s(&result, &when);
+ #else
+     localtime_r(&when, &result);
+ #endif
+     return result;
  }
  
  /*****************************************************************************************
-  * Class: Car
-  * Description: This class encapsulates the attributes and methods for a car.
+  * Calendar Dates
+  * Description: Booking dates are whole days, stored as the number of days since
+  *              1970-01-01 so ranges can be compared and subtracted directly.
   *****************************************************************************************/
- class Car {
- private:
-     string licensePlate;
-     string brand;
-     string model;
-     int year;
-     double rentalPricePerDay;
-     bool isAvailable;
- public:
-     // Default constructor.
-     Car() : licensePlate(""), brand(""), model(""), year(0), rentalPricePerDay(0.0), isAvailable(true) {}
+ // Days since 1970-01-01 for a proleptic Gregorian date.
+ int daysFromCivil(int y, int m, int d) {
+     y -= m <= 2;
+     int era = (y >= 0 ? y : y - 399) / 400;
+     int yoe = y - era * 400;
+     int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+     int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+     return era * 146097 + doe - 719468;
+ }
  
-     // Parameterized constructor.
-     Car(string lp, string br, string mo, int yr, double price)
-         : licensePlate(lp), brand(br), model(mo), year(yr), rentalPricePerDay(price), isAvailable(true) {}
+ // Inverse of daysFromCivil().
+ void civilFromDays(int days, int& y, int& m, int& d) {
+     days += 719468;
+     int era = (days >= 0 ? days : days - 146096) / 146097;
+     int doe = days - era * 146097;
+     int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+     int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+     int mp = (5 * doy + 2) / 153;
+     d = doy - (153 * mp + 2) / 5 + 1;
+     m = mp + (mp < 10 ? 3 : -9);
+     y = yoe + era * 400 + (m <= 2);
+ }
  
-     // Getters.
-     string getLicensePlate() const { return licensePlate; }
-     string getBrand() const { return brand; }
-     string getModel() const { return model; }
-     int getYear() const { return year; }
-     double getRentalPricePerDay() const { return rentalPricePerDay; }
-     bool available() const { return isAvailable; }
+ // Today's local date as a day number.
+ int todayDayNumber() {
+     tm ltm = localTime(time(0));
+     return daysFromCivil(ltm.tm_year + 1900, ltm.tm_mon + 1, ltm.tm_mday);
+ }
  
-     // Setter for availability.
-     void setAvailability(bool status) { isAvailable = status; }
+ // Parses "YYYY-MM-DD" (or "today"); returns false on malformed input.
+ bool parseDate(string_view text, int& days) {
+     if(text == "today") {
+         days = todayDayNumber();
+         return true;
+     }
+     int y = 0, m = 0, d = 0;
+     if(text.size() != 10 || text[4] != '-' || text[7] != '-' ||
+        from_chars(text.data(), text.data() + 4, y).ec != errc() ||
+        from_chars(text.data() + 5, text.data() + 7, m).ec != errc() ||
+        from_chars(text.data() + 8, text.data() + 10, d).ec != errc() ||
+        m < 1 || m > 12 || d < 1 || d > 31) {
+         return false;
+     }
+     days = daysFromCivil(y, m, d);
+     return true;
+ }
  
-     // Display details of the car.
-     void display() const {
-         cout << "License Plate: " << licensePlate << endl;
-         cout << "Brand: " << brand << endl;
-         cout << "Model: " << model << endl;
-         cout << "Year: " << year << endl;
-         cout << "Price per Day: $" << rentalPricePerDay << endl;
-         cout << "Availability: " << (isAvailable ? "Available" : "Not Available") << endl;
+ // Writes "YYYY-MM-DD" (10 characters, no terminator) and returns the end.
+ char* formatDate(int days, char* out) {
+     int y, m, d;
+     civilFromDays(days, y, m, d);
+     auto put = [&out](int value, int digits) {
+         for (int i = digits - 1; i >= 0; i--, value /= 10) {
+             out[i] = static_cast<char>('0' + value % 10);
+         }
+         out += digits;
+     };
+     put(y, 4); *out++ = '-'; put(m, 2); *out++ = '-'; put(d, 2);
+     return out;
+ }
+ 
+ // Formats a day number as "YYYY-MM-DD".
+ string formatDate(int days) {
+     char buffer[16];
+     return string(buffer, formatDate(days, buffer));
+ }
+ 
+ /*****************************************************************************************
+  * Timestamps
+  * Description: Rental and payment times are stored as a Timestamp: seconds since
+  *              1970-01-01 00:00:00 on the local wall clock. Durations are plain
+  *              subtraction, and text is produced only for display and the data files,
+  *              where the "YYYY-MM-DD HH:MM:SS" format is unchanged.
+  *****************************************************************************************/
+ typedef int64_t Timestamp;
+ 
+ // Marks a time that has not happened yet, such as the end of an open rental ("N/A").
+ const Timestamp NoTimestamp = INT64_MIN;
+ 
+ // The current local time. localtime() is consulted only when the hour changes; in
+ // between the cached offset from UTC is applied.
+ Timestamp currentTimestamp() {
+     static atomic<int64_t> cachedHour(INT64_MIN);
+     static atomic<int64_t> cachedOffset(0);
+     int64_t now = static_cast<int64_t>(time(0));
+     if(cachedHour.load(memory_order_acquire) != now / 3600) {
+         tm ltm = localTime(static_cast<time_t>(now));
+         int64_t local = int64_t(daysFromCivil(ltm.tm_year + 1900, ltm.tm_mon + 1, ltm.tm_mday)) * 86400 +
+                         ltm.tm_hour * 3600 + ltm.tm_min * 60 + ltm.tm_sec;
+         cachedOffset.store(local - now, memory_order_relaxed);
+         cachedHour.store(now / 3600, memory_order_release);
      }
+     return now + cachedOffset.load(memory_order_relaxed);
+ }
+ 
+ // Day number (see daysFromCivil()) a timestamp falls on.
+ int dayOfTimestamp(Timestamp when) {
+     return static_cast<int>(when >= 0 ? when / 86400 : (when - 86399) / 86400);
+ }
+ 
+ // Writes "YYYY-MM-DD HH:MM:SS" (19 characters, no terminator) and returns the end.
+ char* formatTimestamp(Timestamp when, char* out) {
+     int days = dayOfTimestamp(when);
+     int seconds = static_cast<int>(when - int64_t(days) * 86400);
+     out = formatDate(days, out);
+     auto put = [&out](int value) {
+         out[0] = static_cast<char>('0' + value / 10);
+         out[1] = static_cast<char>('0' + value % 10);
+         out += 2;
+     };
+     *out++ = ' '; put(seconds / 3600); *out++ = ':'; put(seconds / 60 % 60); *out++ = ':'; put(seconds % 60);
+     return out;
+ }
  
-     // Serialize to string (CSV format).
-     string toString() const {
-         stringstream ss;
-         ss << licensePlate << "," << brand << "," << model << "," << year << "," << rentalPricePerDay << "," << isAvailable;
-         return ss.str();
+ // Formats a timestamp for display and the data files; NoTimestamp becomes "N/A".
+ string formatTimestamp(Timestamp when) {
+     if(when == NoTimestamp) {
+         return "N/A";
      }
+     char buffer[24];
+     return string(buffer, formatTimestamp(when, buffer));
+ }
  
-     // Deserialize a car from string data.
-     static Car fromString(const string& data) {
-         stringstream ss(data);
-         string lp, br, mo, token;
-         int yr;
-         double price;
-         bool available;
- 
-         getline(ss, lp, ',');
-         getline(ss, br, ',');
-         getline(ss, mo, ',');
-         getline(ss, token, ',');
-         yr = stoi(token);
-         getline(ss, token, ',');
-         price = stod(token);
-         getline(ss, token, ',');
-         available = (token == "1");
- 
-         Car car(lp, br, mo, yr, price);
-         car.setAvailability(available);
-         return car;
+ // Parses "YYYY-MM-DD HH:MM:SS", a bare "YYYY-MM-DD" (midnight) or "N/A" (NoTimestamp);
+ // returns false on malformed input.
+ bool parseTimestamp(string_view text, Timestamp& when) {
+     if(text == "N/A") {
+         when = NoTimestamp;
+         return true;
      }
- };
+     int days = 0, h = 0, mi = 0, sec = 0;
+     if(text.size() < 10 || !parseDate(text.substr(0, 10), days)) {
+         return false;
+     }
+     if(text.size() > 10) {
+         if(text.size() != 19 || text[10] != ' ' || text[13] != ':' || text[16] != ':' ||
+            from_chars(text.data() + 11, text.data() + 13, h).ec != errc() ||
+            from_chars(text.data() + 14, text.data() + 16, mi).ec != errc() ||
+            from_chars(text.data() + 17, text.data() + 19, sec).ec != errc() ||
+            h > 23 || mi > 59 || sec > 60) {
+             return false;
+         }
+     }
+     when = int64_t(days) * 86400 + h * 3600 + mi * 60 + sec;
+     return true;
+ }
  
- /*****************************************************************************************
-  * Class: Customer
-  * Description: This class stores customer details.
-  *****************************************************************************************/
- class Customer {
- private:
-     int id;
-     string name;
-     string driverLicense;
-     string contactInfo;
- public:
-     // Default constructor.
-     Customer() : id(0), name(""), driverLicense(""), contactInfo("") {}
+ // Forces buffered data for an open file all the way to stable storage.
+ void syncFileToDisk(FILE* file) {
+     fflush(file);
+ #if defined(_WIN32)
+     _commit(_fileno(file));
+ #else
+     fsync(fileno(file));
+ #endif
+ }
  
-     // Parameterized constructor.
-     Customer(int id, string nm, string dl, string ci)
-         : id(id), name(nm), driverLicense(dl), contactInfo(ci) {}
+ // Makes a rename or removal in the directory holding path durable.
+ void syncDirectoryOf(const string& path) {
+ #if !defined(_WIN32)
+     size_t slash = path.rfind('/');
+     string directory = slash == string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+     int fd = ::open(directory.c_str(), O_RDONLY);
+     if(fd >= 0) {
+         fsync(fd);
+         ::close(fd);
+     }
+ #endif
+ }
  
-     // Getters.
-     int getId() const { return id; }
-     string getName() const { return name; }
-     string getDriverLicense() const { return driverLicense; }
-     string getContactInfo() const { return contactInfo; }
+ // Replaces path crash-safely: write() fills a temporary file next to it, which is forced
+ // to stable storage and then renamed over path, so path always holds either the old or
+ // the new contents in full. If write() or the disk fails, path is left untouched.
+ bool writeFileAtomically(const string& path, const function<bool(FILE*)>& write) {
+     string tempPath = path + ".tmp";
+     FILE* file = fopen(tempPath.c_str(), "wb");
+     if(!file) {
+         return false;
+     }
+     bool ok = write(file);
+     syncFileToDisk(file);
+     ok = !ferror(file) && ok;
+     ok = fclose(file) == 0 && ok;
+ #if defined(_WIN32)
+     // rename() does not replace an existing file here.
+     if(ok) {
+         remove(path.c_str());
+     }
+ #endif
+     if(!ok || rename(tempPath.c_str(), path.c_str()) != 0) {
+         remove(tempPath.c_str());
+         return false;
+     }
+     syncDirectoryOf(path);
+     return true;
+ }
  
-     // Display customer details.
-     void display() const {
-         cout << "Customer ID: " << id << endl;
-         cout << "Name: " << name << endl;
-         cout << "Driver License: " << driverLicense << endl;
-         cout << "Contact Info: " << contactInfo << endl;
+ // Atomic operations on words shared by records that are locked independently.
+ #if defined(_MSC_VER)
+ inline void atomicOrBits(uint64_t* word, uint64_t bits) { _InterlockedOr64(reinterpret_cast<volatile long long*>(word), bits); }
+ inline void atomicAndBits(uint64_t* word, uint64_t bits) { _InterlockedAnd64(reinterpret_cast<volatile long long*>(word), bits); }
+ inline uint64_t atomicLoadBits(const uint64_t* word) { return *reinterpret_cast<const volatile uint64_t*>(word); }
+ inline void atomicAddCount(uint64_t* word, uint64_t value) { _InterlockedExchangeAdd64(reinterpret_cast<volatile long long*>(word), value); }
+ inline void atomicAddDouble(double* target, double value) {
+     volatile long long* bits = reinterpret_cast<volatile long long*>(target);
+     for(;;) {
+         long long expected = *bits, desired;
+         double sum;
+         memcpy(&sum, &expected, sizeof(sum));
+         sum += value;
+         memcpy(&desired, &sum, sizeof(desired));
+         if(_InterlockedCompareExchange64(bits, desired, expected) == expected) {
+             return;
+         }
+     }
+ }
+ #else
+ inline void atomicOrBits(uint64_t* word, uint64_t bits) { __atomic_fetch_or(word, bits, __ATOMIC_RELAXED); }
+ inline void atomicAndBits(uint64_t* word, uint64_t bits) { __atomic_fetch_and(word, bits, __ATOMIC_RELAXED); }
+ inline uint64_t atomicLoadBits(const uint64_t* word) { return __atomic_load_n(word, __ATOMIC_RELAXED); }
+ inline void atomicAddCount(uint64_t* word, uint64_t value) { __atomic_fetch_add(word, value, __ATOMIC_RELAXED); }
+ inline void atomicAddDouble(double* target, double value) {
+     double expected, desired;
+     __atomic_load(target, &expected, __ATOMIC_RELAXED);
+     do {
+         desired = expected + value;
+     } while(!__atomic_compare_exchange(target, &expected, &desired, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+ }
+ #endif
+ 
+ // 32-bit FNV-1a hash, used to detect torn or corrupted journal records and archive segments.
+ uint32_t fnv1a(string_view data) {
+     uint32_t hash = 2166136261u;
+     for (unsigned char c : data) {
+         hash ^= c;
+         hash *= 16777619u;
      }
+     return hash;
+ }
  
-     // Serialize to string.
-     string toString() const {
-         stringstream ss;
-         ss << id << "," << name << "," << driverLicense << "," << contactInfo;
-         return ss.str();
+ /*****************************************************************************************
+  * CSV Field Parsing
+  * Description: In-place parsing helpers for the comma-separated data files. Fields are
+  *              returned as views into the line and numbers are read with from_chars, so
+  *              no temporary strings are created while parsing. Text holding a comma or
+  *              a quote is written "quoted", with inner quotes doubled; the files are
+  *              read line by line, so line breaks inside text become spaces.
+  *****************************************************************************************/
+ // Splits the next comma-delimited field off the front of line (like getline(ss, field, ',')).
+ // A quoted field runs to its closing quote and is returned with the quotes; see
+ // unquoteCsvField().
+ string_view nextCsvField(string_view& line) {
+     size_t from = 0;
+     if(!line.empty() && line.front() == '"') {
+         for (from = 1; (from = line.find('"', from)) != string_view::npos && from + 1 < line.size() && line[from + 1] == '"'; from += 2) {}
      }
+     size_t comma = from == string_view::npos ? from : line.find(',', from);
+     string_view field = line.substr(0, comma);
+     line.remove_prefix(comma == string_view::npos ? line.size() : comma + 1);
+     return field;
+ }
  
-     // Deserialize from string.
-     static Customer fromString(const string& data) {
-         stringstream ss(data);
-         string token;
-         int id;
-         string nm, dl, ci;
-         getline(ss, token, ',');
-         id = stoi(token);
-         getline(ss, nm, ',');
-         getline(ss, dl, ',');
-         getline(ss, ci, ',');
-         return Customer(id, nm, dl, ci);
+ // The text of a field from nextCsvField(). Only a field with doubled quotes needs
+ // scratch; otherwise the result views field.
+ string_view unquoteCsvField(string_view field, string& scratch) {
+     if(field.size() < 2 || field.front() != '"' || field.back() != '"') {
+         return field;
      }
- };
+     field = field.substr(1, field.size() - 2);
+     if(field.find('"') == string_view::npos) {
+         return field;
+     }
+     scratch.clear();
+     for (size_t i = 0; i < field.size(); i++) {
+         scratch += field[i];
+         if(field[i] == '"' && i + 1 < field.size() && field[i + 1] == '"') {
+             i++;
+         }
+     }
+     return scratch;
+ }
+ 
+ // Worst-case bytes writeCsvText() needs for text.
+ size_t csvTextBound(string_view text) { return text.size() * 2 + 2; }
+ 
+ // Writes text as one CSV field, quoted if it must be, and returns the end.
+ char* writeCsvText(char* out, string_view text) {
+     if(text.find_first_of(",\"\r\n") == string_view::npos) {
+         memcpy(out, text.data(), text.size());
+         return out + text.size();
+     }
+     bool quoted = text.find_first_of(",\"") != string_view::npos;
+     if(quoted) *out++ = '"';
+     for (char c : text) {
+         if(c == '"') *out++ = '"';
+         *out++ = c == '\r' || c == '\n' ? ' ' : c;
+     }
+     if(quoted) *out++ = '"';
+     return out;
+ }
+ 
+ // Skips the leading whitespace and '+' sign that stoi/stod accept but from_chars does not.
+ const char* skipNumberPrefix(string_view field) {
+     const char* p = field.data();
+     const char* end = p + field.size();
+     while(p < end && (*p == ' ' || *p == '\t')) p++;
+     if(p < end && *p == '+') p++;
+     return p;
+ }
+ 
+ bool parseCsvInt(string_view field, int& out) {
+     return from_chars(skipNumberPrefix(field), field.data() + field.size(), out).ec == errc();
+ }
+ 
+ bool parseCsvDouble(string_view field, double& out) {
+     return from_chars(skipNumberPrefix(field), field.data() + field.size(), out).ec == errc();
+ }
+ 
+ // Formats a double with the fewest digits that still read back to the same value.
+ string formatCsvDouble(double value) {
+     char buffer[32];
+     return string(buffer, to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+ }
  
  /*****************************************************************************************
-  * Class: Rental
-  * Description: This class stores rental transaction details.
+  * Class: MappedFile
+  * Description: Read-only memory mapping of a whole file. Falls back to reading the file
+  *              into a buffer on platforms without mmap.
   *****************************************************************************************/
- class Rental {
+ class MappedFile {
  private:
-     int rentalId;
-     int customerId;
-     string carLicense;
-     string rentalStart;
-     string rentalEnd;
-     double totalCost;
- public:
-     // Default constructor.
-     Rental() : rentalId(0), customerId(0), carLicense(""), rentalStart(""), rentalEnd(""), totalCost(0.0) {}
+     const char* bytes;
+     size_t length;
+ #if defined(_WIN32)
+     string buffer;
+ #else
+     void* mapping;
+ #endif
  
-     // Parameterized constructor.
-     Rental(int rid, int cid, string cl, string start, string end, double cost)
-         : rentalId(rid), customerId(cid), carLicense(cl), rentalStart(start), rentalEnd(end), totalCost(cost) {}
- 
-     // Getters.
-     int getRentalId() const { return rentalId; }
-     int getCustomerId() const { return customerId; }
-     string getCarLicense() const { return carLicense; }
-     string getRentalStart() const { return rentalStart; }
-     string getRentalEnd() const { return rentalEnd; }
-     double getTotalCost() const { return totalCost; }
+ public:
+ #if defined(_WIN32)
+     MappedFile() : bytes(nullptr), length(0) {}
+ #else
+     MappedFile() : bytes(nullptr), length(0), mapping(nullptr) {}
+ #endif
+     ~MappedFile() { close(); }
+     MappedFile(const MappedFile&) = delete;
+     MappedFile& operator=(const MappedFile&) = delete;
  
-     // Display rental details.
-     void display() const {
-         cout << "Rental ID: " << rentalId << endl;
-         cout << "Customer ID: " << customerId << endl;
-         cout << "Car License: " << carLicense << endl;
-         cout << "Rental Start: " << rentalStart << endl;
-         cout << "Rental End: " << rentalEnd << endl;
-         cout << "Total Cost: $" << totalCost << endl;
+     // Maps path; returns false if it does not exist. An empty file maps to an empty view.
+     bool open(const string& path) {
+         close();
+ #if defined(_WIN32)
+         ifstream in(path, ios::binary);
+         if(!in) {
+             return false;
+         }
+         buffer.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+         bytes = buffer.data();
+         length = buffer.size();
+         return true;
+ #else
+         int fd = ::open(path.c_str(), O_RDONLY);
+         if(fd < 0) {
+             return false;
+         }
+         struct stat st;
+         if(fstat(fd, &st) != 0) {
+             ::close(fd);
+             return false;
+         }
+         length = static_cast<size_t>(st.st_size);
+         if(length > 0) {
+             mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+             if(mapping == MAP_FAILED) {
+                 mapping = nullptr;
+                 length = 0;
+                 ::close(fd);
+                 return false;
+             }
+             madvise(mapping, length, MADV_SEQUENTIAL);
+             bytes = static_cast<const char*>(mapping);
+         }
+         ::close(fd);
+         return true;
+ #endif
      }
  
-     // Serialize to string.
-     string toString() const {
-         stringstream ss;
-         ss << rentalId << "," << customerId << "," << carLicense << "," << rentalStart << "," << rentalEnd << "," << totalCost;
-         return ss.str();
+     void close() {
+ #if defined(_WIN32)
+         buffer.clear();
+ #else
+         if(mapping) {
+             munmap(mapping, length);
+             mapping = nullptr;
+         }
+ #endif
+         bytes = nullptr;
+         length = 0;
      }
  
-     // Deserialize from string.
-     static Rental fromString(const string& data) {
-         stringstream ss(data);
-         string token;
-         int rid, cid;
-         string cl, start, end;
-         double cost;
-         getline(ss, token, ',');
-         rid = stoi(token);
-         getline(ss, token, ',');
-         cid = stoi(token);
-         getline(ss, cl, ',');
-         getline(ss, start, ',');
-         getline(ss, end, ',');
-         getline(ss, token, ',');
-         cost = stod(token);
-         return Rental(rid, cid, cl, start, end, cost);
+     const char* data() const { return bytes; }
+     size_t size() const { return length; }
+     string_view view() const { return string_view(bytes, length); }
+ 
+     // Splits the file into at most maxChunks pieces of roughly equal size, each ending on
+     // a line boundary, so the pieces can be parsed independently.
+     vector<string_view> lineAlignedChunks(size_t maxChunks, size_t minChunkBytes) const {
+         vector<string_view> chunks;
+         size_t count = max<size_t>(1, min(maxChunks, length / max<size_t>(1, minChunkBytes)));
+         size_t target = length / count + 1;
+         size_t begin = 0;
+         while(begin < length) {
+             size_t end = min(length, begin + target);
+             while(end < length && bytes[end - 1] != '\n') end++;
+             chunks.push_back(string_view(bytes + begin, end - begin));
+             begin = end;
+         }
+         return chunks;
      }
  };
  
  /*****************************************************************************************
-  * Class: Payment
-  * Description: This class processes payment details for rentals.
+  * Class: ThreadPool
+  * Description: Fixed set of worker threads draining a shared task queue.
   *****************************************************************************************/
- class Payment {
+ class ThreadPool {
  private:
-     int paymentId;
-     int rentalId;
-     double amount;
-     string paymentMethod;
-     string paymentDate;
- public:
-     // Default constructor.
-     Payment() : paymentId(0), rentalId(0), amount(0.0), paymentMethod(""), paymentDate("") {}
- 
-     // Parameterized constructor.
-     Payment(int pid, int rid, double amt, string method, string date)
-         : paymentId(pid), rentalId(rid), amount(amt), paymentMethod(method), paymentDate(date) {}
- 
-     // Getters.
-     int getPaymentId() const { return paymentId; }
-     int getRentalId() const { return rentalId; }
-     double getAmount() const { return amount; }
-     string getPaymentMethod() const { return paymentMethod; }
-     string getPaymentDate() const { return paymentDate; }
+     vector<thread> workers;
+     queue<function<void()>> tasks;
+     mutex queueMutex;
+     condition_variable wakeUp;
+     bool stopping;
  
-     // Display payment details.
-     void display() const {
-         cout << "Payment ID: " << paymentId << endl;
-         cout << "Rental ID: " << rentalId << endl;
-         cout << "Amount: $" << amount << endl;
-         cout << "Payment Method: " << paymentMethod << endl;
-         cout << "Payment Date: " << paymentDate << endl;
+ public:
+     explicit ThreadPool(size_t threadCount = thread::hardware_concurrency()) : stopping(false) {
+         threadCount = max<size_t>(1, threadCount);
+         for (size_t i = 0; i < threadCount; i++) {
+             workers.emplace_back([this] {
+                 for(;;) {
+                     function<void()> task;
+                     {
+                         unique_lock<mutex> lock(queueMutex);
+                         wakeUp.wait(lock, [this] { return stopping || !tasks.empty(); });
+                         if(stopping && tasks.empty()) {
+                             return;
+                         }
+                         task = move(tasks.front());
+                         tasks.pop();
+                     }
+                     task();
+                 }
+             });
+         }
      }
  
-     // Serialize to string.
-     string toString() const {
-         stringstream ss;
-         ss << paymentId << "," << rentalId << "," << amount << "," << paymentMethod << "," << paymentDate;
-         return ss.str();
+     ~ThreadPool() {
+         {
+             lock_guard<mutex> lock(queueMutex);
+             stopping = true;
+         }
+         wakeUp.notify_all();
+         for (thread& worker : workers) {
+             worker.join();
+         }
      }
  
-     // Deserialize from string.
-     static Payment fromString(const string& data) {
-         stringstream ss(data);
-         string token;
-         int pid, rid;
-         double amt;
-         string method, date;
-         getline(ss, token, ',');
-         pid = stoi(token);
-         getline(ss, token, ',');
-         rid = stoi(token);
-         getline(ss, token, ',');
-         amt = stod(token);
-         getline(ss, method, ',');
-         getline(ss, date, ',');
-         return Payment(pid, rid, amt, method, date);
+     size_t size() const { return workers.size(); }
+ 
+     // Queues fn and returns a future for its result.
+     template <typename Fn>
+     auto submit(Fn fn) -> future<decltype(fn())> {
+         auto task = make_shared<packaged_task<decltype(fn())()>>(move(fn));
+         future<decltype(fn())> result = task->get_future();
+         {
+             lock_guard<mutex> lock(queueMutex);
+             tasks.emplace([task] { (*task)(); });
+         }
+         wakeUp.notify_one();
+         return result;
      }
  };
  
  /*****************************************************************************************
-  * Class: CarRentalSystem
-  * Description: Orchestrates the entire rental system including data loading/saving,
-  *              car & customer management, rental processing, payment, and reporting.
+  * Class: WorkStealingPool
+  * Description: Small pool for background work. Each worker owns a deque: a task submitted
+  *              from a worker goes on the back of that worker's deque, and a worker takes
+  *              its own newest task first. Idle workers steal the oldest task from the
+  *              others' deques. Tasks submitted from outside the pool are dealt round-robin.
+  *              The deques are short and rarely contended, so each one has a plain mutex.
+  *              Tasks still queued when the pool is destroyed are run first.
   *****************************************************************************************/
- class CarRentalSystem {
+ class WorkStealingPool {
  private:
-     vector<Car> cars;
-     vector<Customer> customers;
-     vector<Rental> rentals;
-     vector<Payment> payments;
+     struct WorkerQueue {
+         mutex lock;
+         deque<function<void()>> tasks;
+     };
      
-     // File names for storing persistent data.
-     const string carsDataFile = "cars.txt";
-     const string customersDataFile = "customers.txt";
-     const string rentalsDataFile = "rentals.txt";
-     const string paymentsDataFile = "payments.txt";
+     vector<unique_ptr<WorkerQueue>> queues;
+     vector<thread> workers;
+     mutex idleLock;
+     condition_variable wakeUp;
+     size_t pending;             // Submitted but not yet taken (guarded by idleLock).
+     bool stopping;
+     atomic<size_t> nextQueue;
      
-     int nextCustomerId;
-     int nextRentalId;
-     int nextPaymentId;
+     // The pool and queue index of the calling thread, if it is a worker.
+     static pair<const WorkStealingPool*, size_t>& currentWorker() {
+         static thread_local pair<const WorkStealingPool*, size_t> current(nullptr, 0);
+         return current;
+     }
      
-     // Finds the index of a car by its license plate.
-     int findCarIndex(const string &license) {
-         for (size_t i = 0; i < cars.size(); i++) {
-             if (cars[i].getLicensePlate() == license) {
-                 return i;
+     bool take(size_t self, function<void()>& task) {
+         for (size_t i = 0; i < queues.size(); i++) {
+             WorkerQueue& queue = *queues[(self + i) % queues.size()];
+             lock_guard<mutex> lock(queue.lock);
+             if(queue.tasks.empty()) {
+                 continue;
              }
+             if(i == 0) {
+                 task = move(queue.tasks.back());
+                 queue.tasks.pop_back();
+             } else {
+                 task = move(queue.tasks.front());
+                 queue.tasks.pop_front();
+             }
+             break;
+         }
+         if(!task) {
+             return false;
          }
-         return -1;
+         lock_guard<mutex> lock(idleLock);
+         pending--;
+         return true;
      }
      
-     // Finds the index of a customer by ID.
-     int findCustomerIndex(int id) {
-         for (size_t i = 0; i < customers.size(); i++) {
-             if (customers[i].getId() == id) {
-                 return i;
-             }
+ public:
+     explicit WorkStealingPool(size_t threadCount) : pending(0), stopping(false), nextQueue(0) {
+         threadCount = max<size_t>(1, threadCount);
+         for (size_t i = 0; i < threadCount; i++) {
+             queues.emplace_back(new WorkerQueue());
+         }
+         for (size_t i = 0; i < threadCount; i++) {
+             workers.emplace_back([this, i] {
+                 currentWorker() = make_pair(this, i);
+                 for(;;) {
+                     function<void()> task;
+                     if(take(i, task)) {
+                         task();
+                         continue;
+                     }
+                     unique_lock<mutex> lock(idleLock);
+                     wakeUp.wait(lock, [this] { return stopping || pending > 0; });
+                     if(stopping && pending == 0) {
+                         return;
+                     }
+                 }
+             });
          }
-         return -1;
      }
      
-     // Finds the index of a rental by rental ID.
-     int findRentalIndex(int rentalId) {
-         for (size_t i = 0; i < rentals.size(); i++) {
-             if (rentals[i].getRentalId() == rentalId) {
-                 return i;
-             }
+     ~WorkStealingPool() {
+         {
+             lock_guard<mutex> lock(idleLock);
+             stopping = true;
+         }
+         wakeUp.notify_all();
+         for (thread& worker : workers) {
+             worker.join();
          }
-         return -1;
      }
      
+     size_t size() const { return workers.size(); }
+     
+     void submit(function<void()> task) {
+         const auto& current = currentWorker();
+         size_t target = current.first == this ? current.second : nextQueue++ % queues.size();
+         {
+             lock_guard<mutex> lock(queues[target]->lock);
+             queues[target]->tasks.push_back(move(task));
+         }
+         {
+             lock_guard<mutex> lock(idleLock);
+             pending++;
+         }
+         wakeUp.notify_one();
+     }
+ };
+ 
+ /*****************************************************************************************
+  * Class: MaintenanceScheduler
+  * Description: Runs background jobs (checkpoints, index rebuilds, archiving, overdue
+  *              checks) on a WorkStealingPool, so they never hold up the menu or the
+  *              server. A job runs once or every interval, starting after a delay. A timer
+  *              thread waits for the next due job, puts it on the ready list and hands the
+  *              pool one task per ready job; each task runs the most urgent ready job
+  *              (highest priority, then earliest due). A job never overlaps itself: a
+  *              periodic job is due again an interval after its run ends. cancel() drops a
+  *              job that is waiting; a running job is asked to stop through the flag it is
+  *              passed and is not run again. The threads start with the first job.
+  *              Finished runs are kept (the most recent HistoryLimit) for jobs().
+  *****************************************************************************************/
+ enum JobPriority { PriorityLow = 0, PriorityNormal = 1, PriorityHigh = 2 };
+ enum JobState { JobWaiting, JobReady, JobRunning, JobFinished, JobCancelled };
+ 
+ // A job as listed by MaintenanceScheduler::jobs(): a scheduled job, or one finished run.
+ struct JobInfo {
+     int id;
+     string name;
+     JobPriority priority;
+     JobState state;
+     int intervalSeconds;       // 0: one-shot.
+     double dueInSeconds;       // Waiting jobs: until the next run.
+     double elapsedSeconds;     // Running: so far; finished: how long the run took.
+     Timestamp finishedAt;      // Finished and cancelled runs.
+     size_t runs;
+     string result;
+ };
+ 
+ class MaintenanceScheduler {
  public:
-     // Constructor with initial ID settings.
-     CarRentalSystem() : nextCustomerId(1), nextRentalId(1), nextPaymentId(1) {
-         // Additional initialization if necessary.
+     // A job's work: returns a one-line outcome; should return early once cancelled is set.
+     typedef function<string(const atomic<bool>& cancelled)> Work;
+     static const size_t HistoryLimit = 32;
+     
+ private:
+     struct Job {
+         int id;
+         string name;
+         JobPriority priority;
+         chrono::seconds interval;
+         Work work;
+         chrono::steady_clock::time_point due;
+         chrono::steady_clock::time_point started;
+         JobState state;
+         atomic<bool> cancelled;
+         size_t runs;
+     };
+     
+     // Most urgent first: higher priority, then earlier due, then older job.
+     struct LessUrgent {
+         bool operator()(const shared_ptr<Job>& a, const shared_ptr<Job>& b) const {
+             if(a->priority != b->priority) return a->priority < b->priority;
+             if(a->due != b->due) return a->due > b->due;
+             return a->id > b->id;
+         }
+     };
+     
+     size_t threadCount;
+     mutex lock;
+     condition_variable timerWake;
+     map<int, shared_ptr<Job>> scheduled;   // Waiting, ready and running jobs.
+     priority_queue<shared_ptr<Job>, vector<shared_ptr<Job>>, LessUrgent> ready;
+     deque<JobInfo> history;                // Finished runs, newest last.
+     int nextJobId;
+     bool stopping;
+     thread timer;
+     unique_ptr<WorkStealingPool> pool;
+     
+     static JobInfo describe(const Job& job, JobState state, chrono::steady_clock::time_point now) {
+         JobInfo info;
+         info.id = job.id;
+         info.name = job.name;
+         info.priority = job.priority;
+         info.state = state;
+         info.intervalSeconds = static_cast<int>(job.interval.count());
+         info.dueInSeconds = state == JobWaiting ? max(0.0, chrono::duration<double>(job.due - now).count()) : 0.0;
+         info.elapsedSeconds = state == JobRunning ? chrono::duration<double>(now - job.started).count() : 0.0;
+         info.finishedAt = NoTimestamp;
+         info.runs = job.runs;
+         return info;
      }
      
-     /*************************************************************************************
-      * loadData()
-      * Description: Loads persisted data for cars, customers, rentals, and payments.
-      *************************************************************************************/
-     void loadData() {
-         string line;
-         // Load Cars.
-         ifstream carFile(carsDataFile);
-         while(getline(carFile, line)) {
-             if(!line.empty()) {
-                 Car car = Car::fromString(line);
-                 cars.push_back(car);
-             }
+     // Callers hold lock.
+     void remember(JobInfo info) {
+         history.push_back(move(info));
+         if(history.size() > HistoryLimit) {
+             history.pop_front();
          }
-         carFile.close();
-         
-         // Load Customers.
-         ifstream custFile(customersDataFile);
-         while(getline(custFile, line)) {
-             if(!line.empty()) {
-                 Customer cust = Customer::fromString(line);
-                 customers.push_back(cust);
-                 nextCustomerId = max(nextCustomerId, cust.getId() + 1);
+     }
+     
+     // Timer thread: moves jobs that have fallen due to the ready list.
+     void runTimer() {
+         unique_lock<mutex> guard(lock);
+         while(!stopping) {
+             auto now = chrono::steady_clock::now();
+             auto next = chrono::steady_clock::time_point::max();
+             for (auto& entry : scheduled) {
+                 Job& job = *entry.second;
+                 if(job.state != JobWaiting) {
+                     continue;
+                 }
+                 if(job.due <= now) {
+                     job.state = JobReady;
+                     ready.push(entry.second);
+                     pool->submit([this] { runNextReady(); });
+                 } else {
+                     next = min(next, job.due);
+                 }
              }
-         }
-         custFile.close();
-         
-         // Load Rentals.
-         ifstream rentFile(rentalsDataFile);
-         while(getline(rentFile, line)) {
-             if(!line.empty()) {
-                 Rental rent = Rental::fromString(line);
-                 rentals.push_back(rent);
-                 nextRentalId = max(nextRentalId, rent.getRentalId() + 1);
+             if(next == chrono::steady_clock::time_point::max()) {
+                 timerWake.wait(guard);
+             } else {
+                 timerWake.wait_until(guard, next);
              }
          }
-         rentFile.close();
-         
-         // Load Payments.
-         ifstream payFile(paymentsDataFile);
-         while(getline(payFile, line)) {
-             if(!line.empty()) {
-                 Payment pay = Payment::fromString(line);
-                 payments.push_back(pay);
-                 nextPaymentId = max(nextPaymentId, pay.getPaymentId() + 1);
+     }
+     
+     // Pool task: runs the most urgent ready job.
+     void runNextReady() {
+         shared_ptr<Job> job;
+         {
+             lock_guard<mutex> guard(lock);
+             while(!ready.empty() && !job) {
+                 job = ready.top();
+                 ready.pop();
+                 if(job->state != JobReady) {
+                     job.reset();   // Cancelled while it waited.
+                 }
              }
+             if(!job || stopping) {
+                 return;
+             }
+             job->state = JobRunning;
+             job->started = chrono::steady_clock::now();
+         }
+         string result = job->work(job->cancelled);
+         lock_guard<mutex> guard(lock);
+         auto now = chrono::steady_clock::now();
+         job->runs++;
+         JobInfo run = describe(*job, job->cancelled ? JobCancelled : JobFinished, now);
+         run.elapsedSeconds = chrono::duration<double>(now - job->started).count();
+         run.finishedAt = currentTimestamp();
+         run.result = move(result);
+         remember(move(run));
+         if(job->interval.count() > 0 && !job->cancelled && !stopping) {
+             job->state = JobWaiting;
+             job->due = now + job->interval;
+             timerWake.notify_one();
+         } else {
+             scheduled.erase(job->id);
          }
-         payFile.close();
      }
      
-     /*************************************************************************************
-      * saveData()
-      * Description: Saves the current state of cars, customers, rentals, and payments to files.
-      *************************************************************************************/
-     void saveData() {
-         // Save Cars.
-         ofstream carFile(carsDataFile);
-         for (size_t i = 0; i < cars.size(); i++) {
-             carFile << cars[i].toString() << endl;
-         }
-         carFile.close();
-         
-         // Save Customers.
-         ofstream custFile(customersDataFile);
-         for (size_t i = 0; i < customers.size(); i++) {
-             custFile << customers[i].toString() << endl;
+ public:
+     explicit MaintenanceScheduler(size_t workerCount = 2) : threadCount(workerCount), nextJobId(1), stopping(false) {}
+     
+     ~MaintenanceScheduler() { stop(); }
+     
+     // Schedules work to run after delaySeconds, then every intervalSeconds (0: once).
+     // Returns the job's ID.
+     int schedule(const string& name, JobPriority priority, int delaySeconds, int intervalSeconds, Work work) {
+         lock_guard<mutex> guard(lock);
+         if(!pool) {
+             stopping = false;
+             pool.reset(new WorkStealingPool(threadCount));
+             timer = thread([this] { runTimer(); });
          }
-         custFile.close();
-         
-         // Save Rentals.
-         ofstream rentFile(rentalsDataFile);
-         for (size_t i = 0; i < rentals.size(); i++) {
-             rentFile << rentals[i].toString() << endl;
+         shared_ptr<Job> job(new Job());
+         job->id = nextJobId++;
+         job->name = name;
+         job->priority = priority;
+         job->interval = chrono::seconds(max(0, intervalSeconds));
+         job->work = move(work);
+         job->due = chrono::steady_clock::now() + chrono::seconds(max(0, delaySeconds));
+         job->state = JobWaiting;
+         job->cancelled = false;
+         job->runs = 0;
+         scheduled[job->id] = job;
+         timerWake.notify_one();
+         return job->id;
+     }
+     
+     // Drops a waiting or ready job; a running one is asked to stop and is not run again.
+     // False if no such job is scheduled.
+     bool cancel(int id) {
+         lock_guard<mutex> guard(lock);
+         auto it = scheduled.find(id);
+         if(it == scheduled.end()) {
+             return false;
          }
-         rentFile.close();
-         
-         // Save Payments.
-         ofstream payFile(paymentsDataFile);
-         for (size_t i = 0; i < payments.size(); i++) {
-             payFile << payments[i].toString() << endl;
+         Job& job = *it->second;
+         job.cancelled = true;
+         if(job.state != JobRunning) {
+             JobInfo info = describe(job, JobCancelled, chrono::steady_clock::now());
+             info.finishedAt = currentTimestamp();
+             remember(move(info));
+             job.state = JobCancelled;
+             scheduled.erase(it);
          }
-         payFile.close();
+         return true;
      }
      
-     /*************************************************************************************
-      * Car Management Functions
-      *************************************************************************************/
-     // Adds a new car to the system.
-     void addCar() {
-         string license, brand, model;
-         int year;
-         double price;
-         
-         cout << "Enter License Plate: ";
-         cin >> license;
-         cout << "Enter Brand: ";
-         cin >> brand;
-         cout << "Enter Model: ";
-         cin >> model;
-         cout << "Enter Year: ";
-         cin >> year;
-         cout << "Enter Rental Price Per Day: ";
-         cin >> price;
-         
-         Car newCar(license, brand, model, year, price);
-         cars.push_back(newCar);
-         cout << "Car added successfully!" << endl;
+     // Scheduled jobs in ID order, then the remembered runs, oldest first.
+     vector<JobInfo> jobs() {
+         lock_guard<mutex> guard(lock);
+         vector<JobInfo> list;
+         auto now = chrono::steady_clock::now();
+         for (const auto& entry : scheduled) {
+             list.push_back(describe(*entry.second, entry.second->state, now));
+         }
+         list.insert(list.end(), history.begin(), history.end());
+         return list;
+     }
+     
+     // Cancels every job, waits for running ones to return and stops the threads.
+     void stop() {
+         {
+             lock_guard<mutex> guard(lock);
+             if(!pool) {
+                 return;
+             }
+             stopping = true;
+             for (auto& entry : scheduled) {
+                 entry.second->cancelled = true;
+             }
+         }
+         timerWake.notify_one();
+         timer.join();
+         pool.reset();
+         lock_guard<mutex> guard(lock);
+         scheduled.clear();
+         ready = decltype(ready)();
+     }
+ };
+ 
+ /*****************************************************************************************
+  * Class: Instrumentation
+  * Description: Call counters and latency histograms for the system's main operations
+  *              (see Probe). Each thread records into its own block, found through a
+  *              thread_local pointer, with plain relaxed loads and stores: no locks, no
+  *              read-modify-write instructions and no cache lines shared with other
+  *              threads. summarize() adds up the blocks of every thread that has recorded;
+  *              a thread's block is handed to the next new thread when it exits, so its
+  *              counts stay in the totals. Histograms are log-linear in nanoseconds: exact
+  *              below 16, then eight buckets per power of two (each at most 12.5% wide).
+  *              Lookups cost about as much as reading the clock, so ProbeTimer counts them
+  *              on every call but times only one call in LookupSampleEvery.
+  *****************************************************************************************/
+ enum Probe {
+     ProbeLoadData, ProbeSaveData, ProbeAutosave, ProbeFindCar, ProbeFindCustomer, ProbeFindRental,
+     ProbeRentCar, ProbeReturnCar, ProbeProcessPayment, ProbeReport, ProbeReconcile,
+     ProbeSearchCustomers, ProbeCount
+ };
+ 
+ const char* const ProbeNames[ProbeCount] = {
+     "loadData", "saveData", "autosave", "findCarIndex", "findCustomerIndex", "findRentalIndex",
+     "rentCar", "returnCar", "processPayment", "generateReport", "reconcilePayments",
+     "searchCustomers"
+ };
+ 
+ class Instrumentation {
+ public:
+     static const size_t BucketCount = 16 + 60 * 8;
+     static const uint64_t LookupSampleEvery = 64;
+     
+     struct ProbeSummary {
+         uint64_t calls = 0;
+         uint64_t timed = 0;
+         uint64_t totalNanos = 0;
+         uint64_t maxNanos = 0;
+         vector<uint64_t> buckets = vector<uint64_t>(BucketCount, 0);
+         
+         double meanNanos() const { return timed == 0 ? 0.0 : double(totalNanos) / timed; }
+         
+         // Upper bound of the bucket holding the p-th fraction of the timed calls.
+         uint64_t percentileNanos(double p) const {
+             uint64_t rank = static_cast<uint64_t>(ceil(p * timed)), seen = 0;
+             for (size_t i = 0; i < BucketCount; i++) {
+                 seen += buckets[i];
+                 if(seen >= rank && seen != 0) {
+                     return min(maxNanos, bucketLimit(i));
+                 }
+             }
+             return maxNanos;
+         }
+     };
+     
+ private:
+     struct ThreadBlock {
+         atomic<uint64_t> calls[ProbeCount];
+         atomic<uint64_t> timed[ProbeCount];
+         atomic<uint64_t> totalNanos[ProbeCount];
+         atomic<uint64_t> maxNanos[ProbeCount];
+         atomic<uint64_t> buckets[ProbeCount][BucketCount];
+     };
+     
+     // Returns the thread's block to the free list when the thread exits.
+     struct LocalBlock {
+         Instrumentation* owner = nullptr;
+         ThreadBlock* block = nullptr;
+         ~LocalBlock() {
+             if(block) owner->release(block);
+         }
+     };
+     
+     mutex blocksLock;
+     vector<unique_ptr<ThreadBlock>> blocks;
+     vector<ThreadBlock*> freeBlocks;
+     
+     // Only the owning thread writes a block, so an increment needs no atomic RMW.
+     static void add(atomic<uint64_t>& counter, uint64_t amount) {
+         counter.store(counter.load(memory_order_relaxed) + amount, memory_order_relaxed);
+     }
+     
+     static size_t bucketOf(uint64_t nanos) {
+         if(nanos < 16) {
+             return static_cast<size_t>(nanos);
+         }
+ #if defined(_MSC_VER)
+         unsigned long high;
+         _BitScanReverse64(&high, nanos);
+ #else
+         int high = 63 - __builtin_clzll(nanos);
+ #endif
+         return 16 + (high - 4) * 8 + ((nanos >> (high - 3)) & 7);
+     }
+     
+     static uint64_t bucketLimit(size_t bucket) {
+         if(bucket < 16) {
+             return bucket;
+         }
+         size_t high = 4 + (bucket - 16) / 8, sub = (bucket - 16) % 8;
+         return ((uint64_t(9 + sub) << (high - 3)) - 1);
+     }
+     
+     ThreadBlock* acquire() {
+         lock_guard<mutex> lock(blocksLock);
+         if(!freeBlocks.empty()) {
+             ThreadBlock* block = freeBlocks.back();
+             freeBlocks.pop_back();
+             return block;
+         }
+         blocks.emplace_back(new ThreadBlock());
+         return blocks.back().get();
+     }
+     
+     void release(ThreadBlock* block) {
+         lock_guard<mutex> lock(blocksLock);
+         freeBlocks.push_back(block);
+     }
+     
+     // The calling thread's block (there is one Instrumentation, probes). The pointer is
+     // a plain thread_local, so the fast path has no initialisation guard.
+     ThreadBlock& local() {
+         static thread_local ThreadBlock* current = nullptr;
+         if(!current) {
+             thread_local LocalBlock mine;
+             mine.owner = this;
+             mine.block = current = acquire();
+         }
+         return *current;
+     }
+     
+     // Counts one call of probe; returns the calls this thread had made before it.
+     static uint64_t count(ThreadBlock& block, Probe probe) {
+         uint64_t before = block.calls[probe].load(memory_order_relaxed);
+         block.calls[probe].store(before + 1, memory_order_relaxed);
+         return before;
+     }
+     
+     static void record(ThreadBlock& block, Probe probe, uint64_t nanos) {
+         add(block.timed[probe], 1);
+         add(block.totalNanos[probe], nanos);
+         if(nanos > block.maxNanos[probe].load(memory_order_relaxed)) {
+             block.maxNanos[probe].store(nanos, memory_order_relaxed);
+         }
+         add(block.buckets[probe][min(bucketOf(nanos), BucketCount - 1)], 1);
+     }
+     
+ public:
+     // Totals over all threads, one entry per Probe.
+     vector<ProbeSummary> summarize() {
+         vector<ProbeSummary> summaries(ProbeCount);
+         lock_guard<mutex> lock(blocksLock);
+         for (const auto& block : blocks) {
+             for (int probe = 0; probe < ProbeCount; probe++) {
+                 ProbeSummary& summary = summaries[probe];
+                 summary.calls += block->calls[probe].load(memory_order_relaxed);
+                 summary.timed += block->timed[probe].load(memory_order_relaxed);
+                 summary.totalNanos += block->totalNanos[probe].load(memory_order_relaxed);
+                 summary.maxNanos = max(summary.maxNanos, block->maxNanos[probe].load(memory_order_relaxed));
+                 for (size_t i = 0; i < BucketCount; i++) {
+                     summary.buckets[i] += block->buckets[probe][i].load(memory_order_relaxed);
+                 }
+             }
+         }
+         return summaries;
+     }
+     
+     size_t threadCount() {
+         lock_guard<mutex> lock(blocksLock);
+         return blocks.size();
+     }
+     
+     friend class ProbeTimer;
+ };
+ 
+ Instrumentation probes;
+ 
+ // Counts a call of probe and times it until the end of the scope; with sampleEvery > 1
+ // only every sampleEvery-th call on each thread is timed.
+ class ProbeTimer {
+ private:
+     Instrumentation::ThreadBlock& block;
+     Probe probe;
+     bool timing;
+     chrono::steady_clock::time_point start;
+ 
+ public:
+     explicit ProbeTimer(Probe timedProbe, uint64_t sampleEvery = 1) : block(probes.local()), probe(timedProbe) {
+         timing = Instrumentation::count(block, probe) % sampleEvery == 0;
+         if(timing) {
+             start = chrono::steady_clock::now();
+         }
+     }
+     
+     ~ProbeTimer() {
+         if(timing) {
+             uint64_t nanos = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+             Instrumentation::record(block, probe, nanos);
+         }
+     }
+     
+     ProbeTimer(const ProbeTimer&) = delete;
+     ProbeTimer& operator=(const ProbeTimer&) = delete;
+ };
+ 
+ /*****************************************************************************************
+  * Class: SlotTable
+  * Description: A table of records addressed by stable slot numbers. Erasing a record
+  *              leaves a tombstone and puts its slot on a free-list for the next insert,
+  *              so records never move and positions held by indexes stay valid; both are
+  *              O(1). A Handle pairs a slot with the generation stamped on the record that
+  *              occupies it, so a handle to an erased record no longer resolves even after
+  *              the slot is reused. compact() squeezes the tombstones out in one pass.
+  *              Iterating the table visits the live records in slot order.
+  *              Records are stored in chunks of ChunkSlots. snapshot() returns a read-only
+  *              version of the table that shares the chunks, which costs one reference
+  *              per chunk; the first write to a shared chunk afterwards copies it
+  *              (copy-on-write), so the snapshot keeps seeing the table as it was. A chunk
+  *              is freed by whichever side drops the last reference, typically the
+  *              reader, so readers never make writers wait. Copying a table copies every
+  *              chunk. Writes (modify(), insert(), erase(), compact()) and snapshot() must
+  *              be serialised by the caller; a table written concurrently under finer
+  *              locks (such as the cars, under per-car locks) must not be snapshotted.
+  *****************************************************************************************/
+ template <typename Record>
+ class SlotTable {
+ public:
+     struct Handle {
+         uint32_t slot;
+         uint32_t generation;
+     };
+     static const size_t ChunkBits = 12;
+     static const size_t ChunkSlots = size_t(1) << ChunkBits;
+ 
+ private:
+     struct Chunk {
+         vector<Record> records;
+         vector<uint32_t> generations;   // Per slot; 0 marks a tombstone.
+     };
+     vector<shared_ptr<Chunk>> chunks;
+     size_t slots;
+     size_t live;
+     vector<uint32_t> freeSlots;
+     uint32_t nextGeneration;
+ 
+     uint32_t stamp() {
+         if(nextGeneration == 0) {
+             nextGeneration = 1;
+         }
+         return nextGeneration++;
+     }
+     
+     const Chunk& chunkOf(size_t slot) const { return *chunks[slot >> ChunkBits]; }
+     
+     // The chunk holding slot, copied first if a snapshot shares it.
+     Chunk& writableChunk(size_t slot) {
+         shared_ptr<Chunk>& chunk = chunks[slot >> ChunkBits];
+         if(chunk.use_count() != 1) {
+             chunk = make_shared<Chunk>(*chunk);
+         } else {
+             // Pairs with the release of a snapshot's last reference, so its reads are
+             // finished before the chunk is written in place.
+             atomic_thread_fence(memory_order_acquire);
+         }
+         return *chunk;
+     }
+ 
+ public:
+     class const_iterator {
+         const SlotTable* table;
+         size_t slot;
+         void skipTombstones() {
+             while(slot < table->slots && !table->isLive(slot)) slot++;
+         }
+     public:
+         const_iterator(const SlotTable* table, size_t slot) : table(table), slot(slot) { skipTombstones(); }
+         const Record& operator*() const { return (*table)[slot]; }
+         const Record* operator->() const { return &(*table)[slot]; }
+         const_iterator& operator++() { slot++; skipTombstones(); return *this; }
+         bool operator!=(const const_iterator& other) const { return slot != other.slot; }
+     };
+ 
+     SlotTable() : slots(0), live(0), nextGeneration(1) {}
+     
+     SlotTable(const SlotTable& other)
+         : slots(other.slots), live(other.live), freeSlots(other.freeSlots), nextGeneration(other.nextGeneration) {
+         chunks.reserve(other.chunks.size());
+         for (const auto& chunk : other.chunks) {
+             chunks.push_back(make_shared<Chunk>(*chunk));
+         }
+     }
+     
+     SlotTable(SlotTable&&) = default;
+     
+     SlotTable& operator=(const SlotTable& other) {
+         SlotTable copy(other);
+         return *this = move(copy);
+     }
+     
+     SlotTable& operator=(SlotTable&&) = default;
+     
+     // A read-only version of the table as it is now (see the class comment).
+     SlotTable snapshot() const {
+         SlotTable version;
+         version.chunks = chunks;
+         version.slots = slots;
+         version.live = live;
+         version.nextGeneration = nextGeneration;
+         return version;
+     }
+ 
+     const_iterator begin() const { return const_iterator(this, 0); }
+     const_iterator end() const { return const_iterator(this, slots); }
+ 
+     // Live records.
+     size_t size() const { return live; }
+     bool empty() const { return live == 0; }
+     // Slots in use or tombstoned; valid slots are [0, slotCount()).
+     size_t slotCount() const { return slots; }
+     size_t tombstones() const { return slots - live; }
+     bool isLive(size_t slot) const { return chunkOf(slot).generations[slot & (ChunkSlots - 1)] != 0; }
+ 
+     const Record& operator[](size_t slot) const { return chunkOf(slot).records[slot & (ChunkSlots - 1)]; }
+     
+     // The record at slot, for changing it in place.
+     Record& modify(size_t slot) { return writableChunk(slot).records[slot & (ChunkSlots - 1)]; }
+ 
+     void reserve(size_t count) { chunks.reserve((count + ChunkSlots - 1) >> ChunkBits); }
+ 
+     // Stores record in a free slot if there is one, else in a new slot at the end.
+     size_t insert(Record record) {
+         if(!freeSlots.empty()) {
+             size_t slot = freeSlots.back();
+             freeSlots.pop_back();
+             Chunk& chunk = writableChunk(slot);
+             chunk.records[slot & (ChunkSlots - 1)] = move(record);
+             chunk.generations[slot & (ChunkSlots - 1)] = stamp();
+             live++;
+             return slot;
+         }
+         if((slots & (ChunkSlots - 1)) == 0) {
+             chunks.push_back(make_shared<Chunk>());
+             chunks.back()->records.reserve(ChunkSlots);
+             chunks.back()->generations.reserve(ChunkSlots);
+         }
+         Chunk& chunk = writableChunk(slots);
+         chunk.records.push_back(move(record));
+         chunk.generations.push_back(stamp());
+         live++;
+         return slots++;
+     }
+ 
+     // Tombstones slot (which must be live) and releases what the record held.
+     void erase(size_t slot) {
+         Chunk& chunk = writableChunk(slot);
+         chunk.records[slot & (ChunkSlots - 1)] = Record();
+         chunk.generations[slot & (ChunkSlots - 1)] = 0;
+         freeSlots.push_back(static_cast<uint32_t>(slot));
+         live--;
+     }
+ 
+     Handle handleOf(size_t slot) const {
+         return Handle{static_cast<uint32_t>(slot), chunkOf(slot).generations[slot & (ChunkSlots - 1)]};
+     }
+ 
+     // Slot of the record handle refers to, or -1 if it has been erased or moved.
+     int resolve(Handle handle) const {
+         return handle.slot < slots && handle.generation != 0 && handleOf(handle.slot).generation == handle.generation
+                ? static_cast<int>(handle.slot) : -1;
+     }
+ 
+     // Slots of the live records, in order.
+     vector<uint32_t> liveSlots() const {
+         vector<uint32_t> result;
+         result.reserve(size());
+         for (size_t slot = 0; slot < slots; slot++) {
+             if(isLive(slot)) result.push_back(static_cast<uint32_t>(slot));
+         }
+         return result;
+     }
+ 
+     // Moves the live records down over the tombstones, keeping their order, and returns
+     // the new slot of every old one (-1 for tombstones); empty if nothing had to move.
+     // Handles taken before a compaction no longer resolve. Chunks a snapshot shares are
+     // copied from rather than moved from.
+     vector<int> compact() {
+         if(live == slots) {
+             return {};
+         }
+         vector<int> moved(slots, -1);
+         vector<shared_ptr<Chunk>> packed;
+         packed.reserve((live + ChunkSlots - 1) >> ChunkBits);
+         size_t next = 0;
+         for (size_t c = 0; c < chunks.size(); c++) {
+             shared_ptr<Chunk>& chunk = chunks[c];
+             bool shared = chunk.use_count() != 1;
+             if(!shared) {
+                 atomic_thread_fence(memory_order_acquire);   // As in writableChunk().
+             }
+             for (size_t i = 0; i < chunk->records.size(); i++) {
+                 if(chunk->generations[i] == 0) {
+                     continue;
+                 }
+                 if((next & (ChunkSlots - 1)) == 0) {
+                     packed.push_back(make_shared<Chunk>());
+                     packed.back()->records.reserve(min(ChunkSlots, live - next));
+                     packed.back()->generations.reserve(min(ChunkSlots, live - next));
+                 }
+                 Chunk& target = *packed.back();
+                 target.records.push_back(shared ? chunk->records[i] : move(chunk->records[i]));
+                 target.generations.push_back(chunk->generations[i]);
+                 moved[c * ChunkSlots + i] = static_cast<int>(next++);
+             }
+             chunk.reset();
+         }
+         chunks.swap(packed);
+         slots = live;
+         freeSlots.clear();
+         freeSlots.shrink_to_fit();
+         return moved;
+     }
+ 
+     size_t memoryUsage() const {
+         size_t bytes = chunks.capacity() * sizeof(shared_ptr<Chunk>) + freeSlots.capacity() * sizeof(uint32_t);
+         for (const auto& chunk : chunks) {
+             bytes += sizeof(Chunk) + chunk->records.capacity() * sizeof(Record) + chunk->generations.capacity() * sizeof(uint32_t);
+         }
+         return bytes;
+     }
+ };
+ 
+ /*****************************************************************************************
+  * Class: StringDictionary
+  * Description: Interns strings: each distinct value is stored once and identified by a
+  *              small dense integer ID, so records hold 4-byte IDs instead of their own
+  *              copies. Values live in segments that never move (segment k holds 1024 << k
+  *              values), so value() needs no lock and the references it returns stay
+  *              valid for the life of the program; intern() locks only to add a new value.
+  *              ID 0 is always the empty string.
+  *****************************************************************************************/
+ class StringDictionary {
+ private:
+     static const uint32_t FirstSegmentBits = 10;
+     static const uint32_t SegmentCount = 32 - FirstSegmentBits;
+     atomic<string*> segments[SegmentCount];
+     unordered_map<string_view, uint32_t> ids;   // Keys view the stored values.
+     uint32_t count;
+     mutable shared_mutex lock;
+ 
+     // Segment and offset within it of id.
+     static void locate(uint32_t id, uint32_t& segment, uint32_t& offset) {
+         uint32_t biased = id + (1u << FirstSegmentBits);
+ #if defined(_MSC_VER)
+         unsigned long high;
+         _BitScanReverse(&high, biased);
+ #else
+         uint32_t high = 31 - __builtin_clz(biased);
+ #endif
+         segment = static_cast<uint32_t>(high) - FirstSegmentBits;
+         offset = biased - (1u << high);
+     }
+ 
+ public:
+     StringDictionary() : count(0) {
+         for (auto& segment : segments) {
+             segment.store(nullptr, memory_order_relaxed);
+         }
+         intern(string_view());
+     }
+ 
+     ~StringDictionary() {
+         for (auto& segment : segments) {
+             delete[] segment.load(memory_order_relaxed);
+         }
+     }
+ 
+     StringDictionary(const StringDictionary&) = delete;
+     StringDictionary& operator=(const StringDictionary&) = delete;
+ 
+     // Returns the ID of value, adding it if it is new.
+     uint32_t intern(string_view value) {
+         {
+             shared_lock<shared_mutex> reading(lock);
+             auto it = ids.find(value);
+             if(it != ids.end()) {
+                 return it->second;
+             }
+         }
+         unique_lock<shared_mutex> writing(lock);
+         auto it = ids.find(value);
+         if(it != ids.end()) {
+             return it->second;
+         }
+         uint32_t id = count, segment, offset;
+         locate(id, segment, offset);
+         string* values = segments[segment].load(memory_order_relaxed);
+         if(values == nullptr) {
+             values = new string[size_t(1) << (segment + FirstSegmentBits)];
+             segments[segment].store(values, memory_order_release);
+         }
+         values[offset].assign(value.data(), value.size());
+         ids.emplace(string_view(values[offset]), id);
+         count++;
+         return id;
+     }
+ 
+     bool lookup(string_view value, uint32_t& id) const {
+         shared_lock<shared_mutex> reading(lock);
+         auto it = ids.find(value);
+         if(it == ids.end()) {
+             return false;
+         }
+         id = it->second;
+         return true;
+     }
+ 
+     const string& value(uint32_t id) const {
+         uint32_t segment, offset;
+         locate(id, segment, offset);
+         return segments[segment].load(memory_order_acquire)[offset];
+     }
+ 
+     size_t size() const {
+         shared_lock<shared_mutex> reading(lock);
+         return count;
+     }
+ 
+     // Approximate bytes held: the value slots, out-of-line string buffers and the hash index.
+     size_t memoryUsage() const {
+         shared_lock<shared_mutex> reading(lock);
+         size_t bytes = ids.bucket_count() * sizeof(void*) +
+                        ids.size() * (sizeof(pair<const string_view, uint32_t>) + 2 * sizeof(void*));
+         for (uint32_t segment = 0; segment < SegmentCount; segment++) {
+             const string* values = segments[segment].load(memory_order_relaxed);
+             if(values == nullptr) {
+                 break;
+             }
+             size_t slots = size_t(1) << (segment + FirstSegmentBits);
+             bytes += slots * sizeof(string);
+             for (size_t i = 0; i < slots; i++) {
+                 if(values[i].capacity() > string().capacity()) {
+                     bytes += values[i].capacity() + 1;
+                 }
+             }
+         }
+         return bytes;
+     }
+ };
+ 
+ // Process-wide dictionaries behind the interned record fields. A rental refers to its
+ // car by the ID of the car's plate in licensePlates.
+ StringDictionary licensePlates;
+ StringDictionary carBrands;
+ StringDictionary carModels;
+ StringDictionary paymentMethods;
+ StringDictionary branchNames;
+ 
+ // Branches are interned in branchNames. ID 0, the empty name, is DefaultBranch: the
+ // home of every car recorded before there were branches.
+ const char* const DefaultBranch = "main";
+ const uint32_t NoBranch = UINT32_MAX;
+ 
+ uint32_t branchIdOf(string_view name) {
+     return name.empty() || name == DefaultBranch ? 0 : branchNames.intern(name);
+ }
+ 
+ // Like branchIdOf(), but false for a name that is not a branch yet.
+ bool findBranchId(string_view name, uint32_t& id) {
+     if(name.empty() || name == DefaultBranch) {
+         id = 0;
+         return true;
+     }
+     return branchNames.lookup(name, id);
+ }
+ 
+ const string& branchName(uint32_t id) {
+     static const string defaultName(DefaultBranch);
+     return id == 0 ? defaultName : branchNames.value(id);
+ }
+ 
+ /*****************************************************************************************
+  * Record Codecs
+  * Description: Each record class lists its fields once, in fields(), as (label, member,
+  *              codec) descriptors. RecordFormat<Record> walks that list at compile time
+  *              to produce all three forms of a record: the CSV line of the data files
+  *              and journal, the typed snapshot columns (see saveSnapshotTables()) and
+  *              the labelled display. A codec converts one member type:
+  *
+  *                Stored             the column type the snapshot keeps it as
+  *                store()/load()     to and from that column value
+  *                csvBound()         most bytes csv() can write
+  *                csv()              writes the CSV field into a pre-sized buffer
+  *                fromCsv()          reads it back; false if it is malformed
+  *                display()          writes it for people
+  *
+  *              Optional fields come last. In CSV a trailing run of them left at their
+  *              default (their value in a default-constructed record) is omitted, and
+  *              is restored to that default when missing or malformed; snapshots
+  *              written before such a column existed load the same way.
+  *****************************************************************************************/
+ struct IntCodec {
+     typedef int Value;
+     typedef int32_t Stored;
+     static Stored store(Value value) { return value; }
+     static void load(Stored stored, Value& value) { value = stored; }
+     static size_t csvBound(Value) { return 11; }
+     static char* csv(char* out, Value value) { return to_chars(out, out + 11, value).ptr; }
+     static bool fromCsv(string_view field, Value& value) { return parseCsvInt(field, value); }
+     static void display(ostream& out, Value value) { out << value; }
+ };
+ 
+ struct MoneyCodec {
+     typedef double Value;
+     typedef double Stored;
+     static Stored store(Value value) { return value; }
+     static void load(Stored stored, Value& value) { value = stored; }
+     static size_t csvBound(Value) { return 32; }
+     // The fewest digits that still read back to the same value (see formatCsvDouble()).
+     static char* csv(char* out, Value value) { return to_chars(out, out + 32, value).ptr; }
+     static bool fromCsv(string_view field, Value& value) { return parseCsvDouble(field, value); }
+     static void display(ostream& out, Value value) { out << "$" << value; }
+ };
+ 
+ struct FlagCodec {
+     typedef bool Value;
+     typedef uint8_t Stored;
+     static Stored store(Value value) { return value; }
+     static void load(Stored stored, Value& value) { value = stored != 0; }
+     static size_t csvBound(Value) { return 1; }
+     static char* csv(char* out, Value value) { *out = value ? '1' : '0'; return out + 1; }
+     static bool fromCsv(string_view field, Value& value) { value = field == "1"; return true; }
+     static void display(ostream& out, Value value) { out << (value ? "Yes" : "No"); }
+ };
+ 
+ struct TextCodec {
+     typedef string Value;
+     typedef string_view Stored;
+     static Stored store(const Value& value) { return value; }
+     static void load(Stored stored, Value& value) { value.assign(stored.data(), stored.size()); }
+     static size_t csvBound(const Value& value) { return csvTextBound(value); }
+     static char* csv(char* out, const Value& value) { return writeCsvText(out, value); }
+     static bool fromCsv(string_view field, Value& value) {
+         string scratch;
+         load(unquoteCsvField(field, scratch), value);
+         return true;
+     }
+     static void display(ostream& out, const Value& value) { out << value; }
+ };
+ 
+ // Text kept as its ID in Dictionary.
+ template <StringDictionary& Dictionary>
+ struct InternedCodec {
+     typedef uint32_t Value;
+     typedef string_view Stored;
+     static Stored store(Value value) { return Dictionary.value(value); }
+     static void load(Stored stored, Value& value) { value = Dictionary.intern(stored); }
+     static size_t csvBound(Value value) { return csvTextBound(Dictionary.value(value)); }
+     static char* csv(char* out, Value value) { return writeCsvText(out, Dictionary.value(value)); }
+     static bool fromCsv(string_view field, Value& value) {
+         string scratch;
+         load(unquoteCsvField(field, scratch), value);
+         return true;
+     }
+     static void display(ostream& out, Value value) { out << Dictionary.value(value); }
+ };
+ 
+ // A Timestamp as "YYYY-MM-DD HH:MM:SS", or "N/A" for NoTimestamp.
+ struct TimeCodec {
+     typedef Timestamp Value;
+     typedef int64_t Stored;
+     static Stored store(Value value) { return value; }
+     static void load(Stored stored, Value& value) { value = stored; }
+     static size_t csvBound(Value) { return 19; }
+     static char* csv(char* out, Value value) {
+         if(value == NoTimestamp) {
+             memcpy(out, "N/A", 3);
+             return out + 3;
+         }
+         return formatTimestamp(value, out);
+     }
+     static bool fromCsv(string_view field, Value& value) { return parseTimestamp(field, value); }
+     static void display(ostream& out, Value value) { out << formatTimestamp(value); }
+ };
+ 
+ // A day number as "YYYY-MM-DD".
+ struct DayCodec {
+     typedef int Value;
+     typedef int32_t Stored;
+     static Stored store(Value value) { return value; }
+     static void load(Stored stored, Value& value) { value = stored; }
+     static size_t csvBound(Value) { return 10; }
+     static char* csv(char* out, Value value) { return formatDate(value, out); }
+     static bool fromCsv(string_view field, Value& value) { return parseDate(field, value); }
+     static void display(ostream& out, Value value) { out << formatDate(value); }
+ };
+ 
+ // A branch ID (see branchIdOf()) as the branch name.
+ struct BranchCodec {
+     typedef uint32_t Value;
+     typedef string_view Stored;
+     static Stored store(Value value) { return branchName(value); }
+     static void load(Stored stored, Value& value) { value = branchIdOf(stored); }
+     static size_t csvBound(Value value) { return csvTextBound(branchName(value)); }
+     static char* csv(char* out, Value value) { return writeCsvText(out, branchName(value)); }
+     static bool fromCsv(string_view field, Value& value) {
+         string scratch;
+         load(unquoteCsvField(field, scratch), value);
+         return true;
+     }
+     static void display(ostream& out, Value value) { out << branchName(value); }
+ };
+ 
+ // Like BranchCodec, but NoBranch is the empty name.
+ struct ReturnBranchCodec {
+     typedef uint32_t Value;
+     typedef string_view Stored;
+     static Stored store(Value value) { return value == NoBranch ? string_view() : string_view(branchName(value)); }
+     static void load(Stored stored, Value& value) { value = stored.empty() ? NoBranch : branchIdOf(stored); }
+     static size_t csvBound(Value value) { return csvTextBound(store(value)); }
+     static char* csv(char* out, Value value) { return writeCsvText(out, store(value)); }
+     static bool fromCsv(string_view field, Value& value) {
+         string scratch;
+         load(unquoteCsvField(field, scratch), value);
+         return true;
+     }
+     static void display(ostream& out, Value value) { out << store(value); }
+ };
+ 
+ // One field of Record: its display label, the member holding it and how it is encoded.
+ template <typename Record, typename Codec>
+ struct FieldDescriptor {
+     typedef Codec CodecType;
+     const char* label;
+     typename Codec::Value Record::* member;
+     bool optional;
+ };
+ 
+ template <typename Codec, typename Record>
+ constexpr FieldDescriptor<Record, Codec> field(const char* label, typename Codec::Value Record::* member, bool optional = false) {
+     return FieldDescriptor<Record, Codec>{label, member, optional};
+ }
+ 
+ // Calls visit(descriptor, index) for each descriptor in order while it returns true;
+ // returns false if a call did.
+ template <typename Fields, typename Visit, size_t... Index>
+ bool visitFields(const Fields& fields, Visit&& visit, index_sequence<Index...>) {
+     return (visit(get<Index>(fields), Index) && ...);
+ }
+ 
+ template <typename Record, typename Visit>
+ bool forEachField(Visit&& visit) {
+     constexpr auto fields = Record::fields();
+     return visitFields(fields, visit, make_index_sequence<tuple_size<decltype(fields)>::value>());
+ }
+ 
+ template <typename Record>
+ constexpr size_t fieldCount() { return tuple_size<decltype(Record::fields())>::value; }
+ 
+ // The CSV and display forms of a record, generated from Record::fields().
+ template <typename Record>
+ struct RecordFormat {
+     // Whether a descriptor's field holds its default value in record.
+     template <typename Descriptor>
+     static bool isDefault(const Record& record, const Descriptor& f) {
+         static const Record blank;
+         return record.*f.member == blank.*f.member;
+     }
+ 
+     // Appends the CSV line for record, without the line break, to line. Grows line once
+     // by the fields' bounds and writes in place.
+     static void appendCsv(const Record& record, string& line) {
+         size_t written = 0, bound = 0;
+         forEachField<Record>([&](const auto& f, size_t index) {
+             if(!f.optional || !isDefault(record, f)) {
+                 written = index + 1;
+             }
+             bound += decay_t<decltype(f)>::CodecType::csvBound(record.*f.member) + 1;
+             return true;
+         });
+         size_t start = line.size();
+         line.resize(start + bound);
+         char* out = &line[start];
+         forEachField<Record>([&](const auto& f, size_t index) {
+             if(index >= written) {
+                 return false;
+             }
+             if(index != 0) *out++ = ',';
+             out = decay_t<decltype(f)>::CodecType::csv(out, record.*f.member);
+             return true;
+         });
+         line.resize(out - line.data());
+     }
+ 
+     static string toCsv(const Record& record) {
+         string line;
+         appendCsv(record, line);
+         return line;
+     }
+ 
+     // Parses one CSV line in place; returns false if a required field is malformed.
+     // Optional fields that are missing or malformed keep their defaults.
+     static bool parseCsv(string_view line, Record& record) {
+         Record parsed;
+         bool malformed = false;
+         forEachField<Record>([&](const auto& f, size_t) {
+             if(f.optional && line.empty()) {
+                 return false;
+             }
+             typename decay_t<decltype(f)>::CodecType::Value value = parsed.*f.member;
+             if(decay_t<decltype(f)>::CodecType::fromCsv(nextCsvField(line), value)) {
+                 parsed.*f.member = move(value);
+             } else if(!f.optional) {
+                 malformed = true;
+                 return false;
+             }
+             return true;
+         });
+         if(malformed) {
+             return false;
+         }
+         record = move(parsed);
+         return true;
+     }
+ 
+     // Writes one "Label: value" line per field, leaving out optional fields at their
+     // defaults.
+     static void display(const Record& record, ostream& out) {
+         forEachField<Record>([&](const auto& f, size_t) {
+             if(!f.optional || !isDefault(record, f)) {
+                 out << f.label << ": ";
+                 decay_t<decltype(f)>::CodecType::display(out, record.*f.member);
+                 out << endl;
+             }
+             return true;
+         });
+     }
+ };
+ 
+ /*****************************************************************************************
+  * Class: Car
+  * Description: This class encapsulates the attributes and methods for a car.
+  *****************************************************************************************/
+ class Car {
+ private:
+     // Interned in licensePlates, carBrands and carModels.
+     uint32_t plateId;
+     uint32_t brandId;
+     uint32_t modelId;
+     uint32_t branchId;   // See branchIdOf().
+     int year;
+     double rentalPricePerDay;
+     bool isAvailable;
+ public:
+     // Default constructor.
+     Car() : plateId(0), brandId(0), modelId(0), branchId(0), year(0), rentalPricePerDay(0.0), isAvailable(true) {}
+ 
+     // Parameterized constructor.
+     Car(string_view lp, string_view br, string_view mo, int yr, double price, string_view branch = string_view())
+         : plateId(licensePlates.intern(lp)), brandId(carBrands.intern(br)), modelId(carModels.intern(mo)),
+           branchId(branchIdOf(branch)), year(yr), rentalPricePerDay(price), isAvailable(true) {}
+ 
+     // Fields in CSV and snapshot column order (see RecordFormat).
+     static constexpr auto fields() {
+         return make_tuple(field<InternedCodec<licensePlates>>("License Plate", &Car::plateId),
+                           field<InternedCodec<carBrands>>("Brand", &Car::brandId),
+                           field<InternedCodec<carModels>>("Model", &Car::modelId),
+                           field<IntCodec>("Year", &Car::year),
+                           field<MoneyCodec>("Price per Day", &Car::rentalPricePerDay),
+                           field<FlagCodec>("Available", &Car::isAvailable),
+                           field<BranchCodec>("Branch", &Car::branchId, true));
+     }
+ 
+     // Getters.
+     const string& getLicensePlate() const { return licensePlates.value(plateId); }
+     const string& getBrand() const { return carBrands.value(brandId); }
+     const string& getModel() const { return carModels.value(modelId); }
+     uint32_t getPlateId() const { return plateId; }
+     uint32_t getBrandId() const { return brandId; }
+     uint32_t getModelId() const { return modelId; }
+     const string& getBranch() const { return branchName(branchId); }
+     uint32_t getBranchId() const { return branchId; }
+     int getYear() const { return year; }
+     double getRentalPricePerDay() const { return rentalPricePerDay; }
+     bool available() const { return isAvailable; }
+ 
+     // Setter for availability.
+     void setAvailability(bool status) { isAvailable = status; }
+     
+     // Moves the car to another branch.
+     void setBranchId(uint32_t branch) { branchId = branch; }
+ 
+     // Display details of the car.
+     void display() const { RecordFormat<Car>::display(*this, cout); }
+ 
+     // Serialize to string (CSV format). The branch is left out for DefaultBranch.
+     string toString() const { return RecordFormat<Car>::toCsv(*this); }
+ 
+     // Deserialize a car from string data.
+     static Car fromString(const string& data) {
+         Car car;
+         parse(data, car);
+         return car;
+     }
+ 
+     // Parses one CSV line in place; returns false if a numeric field is malformed.
+     static bool parse(string_view line, Car& car) { return RecordFormat<Car>::parseCsv(line, car); }
+ };
+ 
+ /*****************************************************************************************
+  * Class: Customer
+  * Description: This class stores customer details.
+  *****************************************************************************************/
+ class Customer {
+ private:
+     int id;
+     string name;
+     string driverLicense;
+     string contactInfo;
+ public:
+     // Default constructor.
+     Customer() : id(0), name(""), driverLicense(""), contactInfo("") {}
+ 
+     // Parameterized constructor.
+     Customer(int id, string nm, string dl, string ci)
+         : id(id), name(move(nm)), driverLicense(move(dl)), contactInfo(move(ci)) {}
+ 
+     // Fields in CSV and snapshot column order (see RecordFormat).
+     static constexpr auto fields() {
+         return make_tuple(field<IntCodec>("Customer ID", &Customer::id),
+                           field<TextCodec>("Name", &Customer::name),
+                           field<TextCodec>("Driver License", &Customer::driverLicense),
+                           field<TextCodec>("Contact Info", &Customer::contactInfo));
+     }
+ 
+     // Getters.
+     int getId() const { return id; }
+     const string& getName() const { return name; }
+     const string& getDriverLicense() const { return driverLicense; }
+     const string& getContactInfo() const { return contactInfo; }
+ 
+     // Bytes held outside the object by strings too long for the small-string buffer.
+     size_t heapBytes() const {
+         size_t bytes = 0;
+         for (const string* field : {&name, &driverLicense, &contactInfo}) {
+             if(field->capacity() > string().capacity()) {
+                 bytes += field->capacity() + 1;
+             }
+         }
+         return bytes;
+     }
+ 
+     // Display customer details.
+     void display() const { RecordFormat<Customer>::display(*this, cout); }
+ 
+     // Serialize to string.
+     string toString() const { return RecordFormat<Customer>::toCsv(*this); }
+ 
+     // Deserialize from string.
+     static Customer fromString(const string& data) {
+         Customer customer;
+         parse(data, customer);
+         return customer;
+     }
+ 
+     // Parses one CSV line in place; returns false if the ID is malformed.
+     static bool parse(string_view line, Customer& customer) { return RecordFormat<Customer>::parseCsv(line, customer); }
+ };
+ 
+ /*****************************************************************************************
+  * Class: Rental
+  * Description: This class stores rental transaction details.
+  *****************************************************************************************/
+ class Rental {
+ private:
+     int rentalId;
+     int customerId;
+     uint32_t carId;        // The car's plate, interned in licensePlates.
+     Timestamp rentalStart;
+     Timestamp rentalEnd;   // NoTimestamp until the car is returned.
+     double totalCost;
+     // Booked period as day numbers, [bookedFrom, bookedTo). Zero for rentals made before
+     // bookings had dates.
+     int bookedFrom;
+     int bookedTo;
+     // For a one-way rental, the branch the car moves to when it is returned; NoBranch if
+     // it stays where it is. Archive segments drop it: it matters only until the return.
+     uint32_t returnBranchId;
+     // Set once the car has been handed over for a booking. Rentals without booked dates
+     // always count as picked up (see isPickedUp()).
+     bool pickedUp;
+ public:
+     // Default constructor.
+     Rental() : rentalId(0), customerId(0), carId(0), rentalStart(0), rentalEnd(NoTimestamp), totalCost(0.0), bookedFrom(0), bookedTo(0),
+                returnBranchId(NoBranch), pickedUp(false) {}
+ 
+     // Parameterized constructor.
+     Rental(int rid, int cid, string_view cl, Timestamp start, Timestamp end, double cost, int from = 0, int to = 0,
+            uint32_t returnBranch = NoBranch, bool picked = false)
+         : rentalId(rid), customerId(cid), carId(licensePlates.intern(cl)), rentalStart(start), rentalEnd(end), totalCost(cost),
+           bookedFrom(from), bookedTo(to), returnBranchId(returnBranch), pickedUp(picked) {}
+ 
+     // Fields in CSV and snapshot column order (see RecordFormat). The booking dates, the
+     // return branch and the pick-up flag are optional.
+     static constexpr auto fields() {
+         return make_tuple(field<IntCodec>("Rental ID", &Rental::rentalId),
+                           field<IntCodec>("Customer ID", &Rental::customerId),
+                           field<InternedCodec<licensePlates>>("Car License", &Rental::carId),
+                           field<TimeCodec>("Rental Start", &Rental::rentalStart),
+                           field<TimeCodec>("Rental End", &Rental::rentalEnd),
+                           field<MoneyCodec>("Total Cost", &Rental::totalCost),
+                           field<DayCodec>("Booked From", &Rental::bookedFrom, true),
+                           field<DayCodec>("Booked To", &Rental::bookedTo, true),
+                           field<ReturnBranchCodec>("Return Branch", &Rental::returnBranchId, true),
+                           field<FlagCodec>("Picked Up", &Rental::pickedUp, true));
+     }
+ 
+     // Getters.
+     int getRentalId() const { return rentalId; }
+     int getCustomerId() const { return customerId; }
+     const string& getCarLicense() const { return licensePlates.value(carId); }
+     uint32_t getCarId() const { return carId; }
+     Timestamp getRentalStart() const { return rentalStart; }
+     Timestamp getRentalEnd() const { return rentalEnd; }
+     double getTotalCost() const { return totalCost; }
+     int getBookedFrom() const { return bookedFrom; }
+     int getBookedTo() const { return bookedTo; }
+     bool hasBooking() const { return bookedTo > bookedFrom; }
+     bool isOpen() const { return rentalEnd == NoTimestamp; }
+     bool isOneWay() const { return returnBranchId != NoBranch; }
+     bool isPickedUp() const { return !hasBooking() || pickedUp; }
+     uint32_t getReturnBranchId() const { return returnBranchId; }
+     const string& getReturnBranch() const {
+         static const string none;
+         return isOneWay() ? branchName(returnBranchId) : none;
+     }
+ 
+     void markPickedUp() { pickedUp = true; }
+ 
+     // Records the return of the car and the final charge.
+     void close(Timestamp end, double finalCost) {
+         rentalEnd = end;
+         totalCost = finalCost;
+     }
+ 
+     // Whole days charged for a rental from start to end: any part of a day counts as a
+     // day, and a reservation cancelled before it started costs nothing.
+     static int billableDays(Timestamp start, Timestamp end) {
+         if(end < start) {
+             return 0;
+         }
+         return static_cast<int>(max<int64_t>(1, (end - start + 86399) / 86400));
+     }
+ 
+     // Display rental details.
+     void display() const {
+         RecordFormat<Rental>::display(*this, cout);
+         if(!isOpen()) {
+             cout << "Days Charged: " << billableDays(rentalStart, rentalEnd) << endl;
+         }
+     }
+ 
+     // Serialize to string.
+     string toString() const { return RecordFormat<Rental>::toCsv(*this); }
+ 
+     // Deserialize from string.
+     static Rental fromString(const string& data) {
+         Rental rental;
+         parse(data, rental);
+         return rental;
+     }
+ 
+     // Parses one CSV line in place; returns false if a numeric or time field is malformed.
+     static bool parse(string_view line, Rental& rental) { return RecordFormat<Rental>::parseCsv(line, rental); }
+ };
+ 
+ /*****************************************************************************************
+  * Class: Payment
+  * Description: This class processes payment details for rentals.
+  *****************************************************************************************/
+ class Payment {
+ private:
+     int paymentId;
+     int rentalId;
+     double amount;
+     uint32_t methodId;     // Interned in paymentMethods.
+     Timestamp paymentDate;
+ public:
+     // Default constructor.
+     Payment() : paymentId(0), rentalId(0), amount(0.0), methodId(0), paymentDate(0) {}
+ 
+     // Parameterized constructor.
+     Payment(int pid, int rid, double amt, string_view method, Timestamp date)
+         : paymentId(pid), rentalId(rid), amount(amt), methodId(paymentMethods.intern(method)), paymentDate(date) {}
+ 
+     // Fields in CSV and snapshot column order (see RecordFormat).
+     static constexpr auto fields() {
+         return make_tuple(field<IntCodec>("Payment ID", &Payment::paymentId),
+                           field<IntCodec>("Rental ID", &Payment::rentalId),
+                           field<MoneyCodec>("Amount", &Payment::amount),
+                           field<InternedCodec<paymentMethods>>("Payment Method", &Payment::methodId),
+                           field<TimeCodec>("Payment Date", &Payment::paymentDate));
+     }
+ 
+     // Getters.
+     int getPaymentId() const { return paymentId; }
+     int getRentalId() const { return rentalId; }
+     double getAmount() const { return amount; }
+     const string& getPaymentMethod() const { return paymentMethods.value(methodId); }
+     uint32_t getMethodId() const { return methodId; }
+     Timestamp getPaymentDate() const { return paymentDate; }
+ 
+     // Display payment details.
+     void display() const { RecordFormat<Payment>::display(*this, cout); }
+ 
+     // Serialize to string.
+     string toString() const { return RecordFormat<Payment>::toCsv(*this); }
+ 
+     // Deserialize from string.
+     static Payment fromString(const string& data) {
+         Payment payment;
+         parse(data, payment);
+         return payment;
+     }
+ 
+     // Parses one CSV line in place; returns false if a numeric or time field is malformed.
+     static bool parse(string_view line, Payment& payment) { return RecordFormat<Payment>::parseCsv(line, payment); }
+ };
+ 
+ /*****************************************************************************************
+  * Class: ReservationCalendar
+  * Description: The bookings of one car as non-overlapping half-open day ranges
+  *              [from, to), kept sorted by start day. Conflict checks, bookings and
+  *              releases are O(log n) in the number of bookings on the car.
+  *****************************************************************************************/
+ class ReservationCalendar {
+ public:
+     // End day used for open-ended bookings (legacy rentals with no booked dates).
+     static const int OpenEnded = 2147483647;
+ 
+ private:
+     struct Booking {
+         int to;
+         int rentalId;
+     };
+     map<int, Booking> bookings;  // keyed by start day
+ 
+ public:
+     // True if [from, to) overlaps any booking.
+     bool conflicts(int from, int to) const {
+         auto next = bookings.lower_bound(from);
+         if(next != bookings.end() && next->first < to) {
+             return true;
+         }
+         return next != bookings.begin() && prev(next)->second.to > from;
+     }
+ 
+     // Books [from, to) for rentalId unless it conflicts with an existing booking.
+     bool book(int from, int to, int rentalId) {
+         if(from >= to || conflicts(from, to)) {
+             return false;
+         }
+         bookings[from] = Booking{to, rentalId};
+         return true;
+     }
+ 
+     // Drops the booking that starts on day from, if it belongs to rentalId.
+     void release(int from, int rentalId) {
+         auto it = bookings.find(from);
+         if(it != bookings.end() && it->second.rentalId == rentalId) {
+             bookings.erase(it);
+         }
+     }
+ 
+     // True if a booking starts before day.
+     bool bookedBefore(int day) const { return !bookings.empty() && bookings.begin()->first < day; }
+ 
+     bool empty() const { return bookings.empty(); }
+     size_t size() const { return bookings.size(); }
+ };
+ 
+ /*****************************************************************************************
+  * Struct: CarQuery
+  * Description: Filter, ordering and page for a fleet search. Empty strings and the
+  *              default bounds mean "any".
+  *****************************************************************************************/
+ struct CarQuery {
+     string branch;   // Empty for every branch.
+     string brand;
+     string model;
+     int minYear = 0;
+     int maxYear = 2147483647;
+     double minPrice = 0.0;
+     double maxPrice = 1e300;
+     bool availableOnly = true;
+     size_t offset = 0;
+     size_t limit = 20;
+ };
+ 
+ /*****************************************************************************************
+  * Struct: FleetStats
+  * Description: Aggregates over the cars matching a CarQuery (its page is ignored).
+  *****************************************************************************************/
+ struct FleetStats {
+     size_t count = 0;
+     double totalPrice = 0.0;
+     int cheapest = -1;              // Position of the cheapest match, -1 if none.
+     double cheapestPrice = 0.0;
+     map<int, size_t> carsByYear;
+ };
+ 
+ /*****************************************************************************************
+  * Struct: QuoteRequest
+  * Description: One entry of a batch quote: the cars matching a CarQuery (its page is
+  *              ignored), each priced for every booking [first, second) in ranges. The
+  *              QuoteGrid answering it holds the matched cars in fleet order, branch by
+  *              branch, and one row of prices per range.
+  *****************************************************************************************/
+ struct QuoteRequest {
+     CarQuery cars;
+     vector<pair<int, int>> ranges;
+ };
+ 
+ struct QuoteGrid {
+     vector<uint32_t> plateIds;   // Interned in licensePlates.
+     vector<pair<int, int>> ranges;
+     vector<double> amounts;      // amounts[range * plateIds.size() + car]
+     
+     const string& plate(size_t car) const { return licensePlates.value(plateIds[car]); }
+     double amount(size_t car, size_t range) const { return amounts[range * plateIds.size() + car]; }
+ };
+ 
+ /*****************************************************************************************
+  * Struct: ReconciliationReport
+  * Description: Result of CarRentalSystem::reconcilePayments(): rentals whose payments do
+  *              not add up to their cost, the balance owed by each customer, and payments
+  *              that refer to no known rental.
+  *****************************************************************************************/
+ struct RentalBalance {
+     int rentalId;
+     int customerId;
+     double billed;
+     double paid;
+ };
+ 
+ struct ReconciliationReport {
+     vector<RentalBalance> underpaid;
+     vector<RentalBalance> overpaid;
+     vector<pair<int, double>> customerBalances;   // Customer ID and amount owed (negative: in credit).
+     size_t orphanPayments = 0;
+     double orphanAmount = 0.0;
+     double totalBilled = 0.0;
+     double totalPaid = 0.0;
+ };
+ 
+ /*****************************************************************************************
+  * Struct: RevenueReport
+  * Description: Result of CarRentalSystem::revenueReport(): the number of rentals and the
+  *              amount billed per car, per customer, per brand and per month, over the
+  *              rentals, archived and active, that pass a ReportFilter.
+  *****************************************************************************************/
+ enum ReportKind { ReportRentals, ReportCars, ReportCustomers, ReportBrands, ReportMonths, ReportKindCount };
+ 
+ const char* const ReportKindNames[ReportKindCount] = {"rentals", "cars", "customers", "brands", "months"};
+ 
+ struct ReportFilter {
+     int fromDay = numeric_limits<int>::min();   // Rentals starting on [fromDay, toDay).
+     int toDay = numeric_limits<int>::max();
+     string brand;                               // Empty for any.
+     int customerId = 0;                         // 0 for any.
+ };
+ 
+ struct RevenueCell {
+     uint64_t rentals = 0;
+     double revenue = 0.0;
+ };
+ 
+ struct RevenueReport {
+     vector<RevenueCell> byCar;        // By plate ID (see licensePlates).
+     vector<RevenueCell> byCustomer;   // By customer ID.
+     vector<RevenueCell> byBrand;      // By brand ID (see carBrands), for the cars in the fleet.
+     RevenueCell removedCars;          // Cars no longer in the fleet, whose brand is unknown.
+     map<int, RevenueCell> byMonth;    // By year * 12 + month - 1.
+     RevenueCell total;
+ };
+ 
+ /*****************************************************************************************
+  * Class: PricingEngine
+  * Description: Rate rules, compiled into flat tables. A booking of the days [from, to)
+  *              costs the car's daily rate times factor(from, to): the day factors summed
+  *              over the booking (weekend and seasonal multipliers), less the long-rental
+  *              discount for its length. Day factors are fixed point (1/10000 of a day), as
+  *              a weekly pattern plus prefix sums of the seasonal corrections, so factor()
+  *              is O(1) and, with no rules, exactly the number of days. Prices are rounded
+  *              to whole cents. scale() prices a whole column of daily rates with one factor,
+  *              two per step with SSE2, and gives the same results as price().
+  *
+  *              Rules are read from pricing.txt; every line is optional:
+  *                weekend,<multiplier>                  Saturdays and Sundays
+  *                season,<from>,<to>,<multiplier>       days [from, to), YYYY-MM-DD;
+  *                                                      overlapping seasons multiply
+  *                discount,<minimum days>,<percent>     the largest one that applies
+  *****************************************************************************************/
+ class PricingEngine {
+ private:
+     static const int64_t Scale = 10000;
+     static constexpr double RoundingBias = 4503599627370496.0;   // 2^52
+     
+     struct Season {
+         int from, to;
+         double multiplier;
+     };
+     
+     double weekendMultiplier;
+     vector<Season> seasons;
+     vector<pair<int, int64_t>> discounts;   // Minimum days and discount in 1/Scale, ascending.
+     int64_t weekPrefix[8];                  // Day factors of a week from Monday, summed.
+     int firstDay;                           // seasonPrefix covers [firstDay, firstDay + size - 1).
+     vector<int64_t> seasonPrefix;           // Seasonal corrections of the first i days.
+     
+     static int64_t floorDiv(int64_t a, int64_t b) { return a / b - ((a % b != 0) && ((a < 0) != (b < 0))); }
+     
+     static bool isWeekend(int day) {
+         int weekday = static_cast<int>(day + 3 - floorDiv(day + 3, 7) * 7);   // 1970-01-01 was a Thursday.
+         return weekday >= 5;
+     }
+     
+     int64_t weekendFactor(int day) const {
+         return isWeekend(day) ? llround(weekendMultiplier * Scale) : Scale;
+     }
+     
+     // Sum of the weekly-pattern factors over [from, to).
+     int64_t weeklySum(int from, int to) const {
+         auto upTo = [this](int64_t day) {
+             int64_t shifted = day + 3;
+             int64_t weeks = floorDiv(shifted, 7);
+             return weeks * weekPrefix[7] + weekPrefix[shifted - weeks * 7];
+         };
+         return upTo(to) - upTo(from);
+     }
+     
+     // Turns the rules into the weekly pattern and the seasonal prefix sums.
+     void compile() {
+         weekPrefix[0] = 0;
+         for (int weekday = 0; weekday < 7; weekday++) {
+             weekPrefix[weekday + 1] = weekPrefix[weekday] + (weekday >= 5 ? llround(weekendMultiplier * Scale) : Scale);
+         }
+         sort(discounts.begin(), discounts.end());
+         seasonPrefix.assign(1, 0);
+         firstDay = 0;
+         if(seasons.empty()) {
+             return;
+         }
+         firstDay = seasons[0].from;
+         int lastDay = seasons[0].to;
+         for (const Season& season : seasons) {
+             firstDay = min(firstDay, season.from);
+             lastDay = max(lastDay, season.to);
+         }
+         vector<double> multipliers(lastDay - firstDay, 1.0);
+         for (const Season& season : seasons) {
+             for (int day = season.from; day < season.to; day++) {
+                 multipliers[day - firstDay] *= season.multiplier;
+             }
+         }
+         seasonPrefix.resize(multipliers.size() + 1);
+         for (size_t i = 0; i < multipliers.size(); i++) {
+             int day = firstDay + static_cast<int>(i);
+             double weekend = isWeekend(day) ? weekendMultiplier : 1.0;
+             seasonPrefix[i + 1] = seasonPrefix[i] + llround(weekend * multipliers[i] * Scale) - weekendFactor(day);
+         }
+     }
+     
+     int64_t seasonalSum(int from, int to) const {
+         int64_t last = static_cast<int64_t>(seasonPrefix.size()) - 1;
+         auto upTo = [&](int day) { return seasonPrefix[min(max<int64_t>(int64_t(day) - firstDay, 0), last)]; };
+         return upTo(to) - upTo(from);
+     }
+     
+ public:
+     PricingEngine() : weekendMultiplier(1.0) { compile(); }
+     
+     // Reads the rules in file; no file means flat daily rates. Returns the number of
+     // lines that could not be parsed (those are ignored).
+     size_t load(const string& file) {
+         weekendMultiplier = 1.0;
+         seasons.clear();
+         discounts.clear();
+         size_t rejected = 0;
+         ifstream in(file);
+         string line;
+         while(getline(in, line)) {
+             if(!line.empty() && line.back() == '\r') {
+                 line.pop_back();
+             }
+             if(line.empty() || line[0] == '#') {
+                 continue;
+             }
+             string_view rest(line);
+             string_view kind = nextCsvField(rest);
+             double number = 0.0;
+             Season season;
+             int days = 0;
+             if(kind == "weekend" && parseCsvDouble(nextCsvField(rest), number) && number > 0 && rest.empty()) {
+                 weekendMultiplier = number;
+             } else if(kind == "season" && parseDate(nextCsvField(rest), season.from) && parseDate(nextCsvField(rest), season.to) &&
+                       parseCsvDouble(nextCsvField(rest), season.multiplier) && season.multiplier > 0 && season.from < season.to && rest.empty()) {
+                 seasons.push_back(season);
+             } else if(kind == "discount" && parseCsvInt(nextCsvField(rest), days) && days > 0 &&
+                       parseCsvDouble(nextCsvField(rest), number) && number >= 0 && number < 100 && rest.empty()) {
+                 discounts.emplace_back(days, llround(number * (Scale / 100)));
+             } else {
+                 rejected++;
+             }
+         }
+         compile();
+         return rejected;
+     }
+     
+     bool flat() const { return weekendMultiplier == 1.0 && seasons.empty() && discounts.empty(); }
+     
+     // Multiplier of the daily rate for a booking of the days [from, to).
+     double factor(int from, int to) const {
+         if(to <= from) {
+             return 0.0;
+         }
+         int64_t discount = 0;
+         for (const auto& tier : discounts) {
+             if(to - from < tier.first) break;
+             discount = tier.second;
+         }
+         int64_t sum = weeklySum(from, to) + seasonalSum(from, to);
+         return double(sum) * double(Scale - discount) / double(Scale * Scale);
+     }
+     
+     // Rounds a non-negative amount to whole cents (ties to even). Adding and removing 2^52
+     // leaves no fraction bits, which SSE2 can do too; it has no rounding instruction.
+     static double roundToCents(double amount) {
+         volatile double cents = amount * 100.0 + RoundingBias;   // volatile: no x87 excess precision
+         return (cents - RoundingBias) / 100.0;
+     }
+     
+     // Price of a booking of [from, to) at dailyRate.
+     double price(double dailyRate, int from, int to) const { return roundToCents(dailyRate * factor(from, to)); }
+     
+     // out[i] = rates[i] priced at factor, for count rates; the same amounts price() gives.
+     static void scale(const double* rates, size_t count, double factor, double* out) {
+         size_t i = 0;
+ #if defined(CAR_RENTAL_SSE2)
+         const __m128d multiplier = _mm_set1_pd(factor), hundred = _mm_set1_pd(100.0), bias = _mm_set1_pd(RoundingBias);
+         for (; i + 2 <= count; i += 2) {
+             __m128d cents = _mm_add_pd(_mm_mul_pd(_mm_mul_pd(_mm_loadu_pd(rates + i), multiplier), hundred), bias);
+             _mm_storeu_pd(out + i, _mm_div_pd(_mm_sub_pd(cents, bias), hundred));
+         }
+ #endif
+         for (; i < count; i++) {
+             out[i] = roundToCents(rates[i] * factor);
+         }
+     }
+     
+     void describe(ostream& out) const {
+         if(flat()) {
+             out << "Flat daily rates." << endl;
+             return;
+         }
+         if(weekendMultiplier != 1.0) {
+             out << "Weekend days: x" << weekendMultiplier << endl;
+         }
+         for (const Season& season : seasons) {
+             out << "Season " << formatDate(season.from) << " to " << formatDate(season.to) << ": x" << season.multiplier << endl;
+         }
+         for (const auto& tier : discounts) {
+             out << tier.first << "+ days: " << double(tier.second) / (Scale / 100) << "% off" << endl;
+         }
+     }
+ };
+ 
+ /*****************************************************************************************
+  * Class: FleetIndex
+  * Description: Columnar copy of the fleet plus secondary indexes, addressed by slot in
+  *              cars. Years, prices and dictionary-encoded brand and model IDs are kept in
+  *              contiguous columns next to availability and live-slot bitmaps, with posting
+  *              lists per brand and model and an ordered price index on top; an erased
+  *              car's slot is tombstoned rather than renumbering the others. search() combines
+  *              them and returns matches cheapest first, one page at a time; scans that no
+  *              index narrows down run over the columns 64 cars at a time with SSE2
+  *              (filterWord()), as does statistics().
+  *****************************************************************************************/
+ class FleetIndex {
+ private:
+     vector<vector<int>> carsByBrand;   // sorted positions per brand ID
+     vector<vector<int>> carsByModel;   // sorted positions per model ID
+     vector<uint32_t> brandOf;
+     vector<uint32_t> modelOf;
+     vector<int> yearOf;
+     vector<double> priceOf;
+     multimap<double, int> byPrice;
+     vector<uint64_t> availableBits;
+     vector<uint64_t> liveBits;   // Clear for tombstoned slots.
+     
+     // A CarQuery resolved against the dictionaries, as used by the column kernels.
+     struct ScanFilter {
+         bool hasBrand, hasModel;
+         uint32_t brandId, modelId;
+         int minYear, maxYear;
+         double minPrice, maxPrice;
+         bool availableOnly;
+     };
+ 
+     static void insertPosting(vector<int>& postings, int pos) {
+         if(postings.empty() || postings.back() < pos) {
+             postings.push_back(pos);
+         } else {
+             postings.insert(lower_bound(postings.begin(), postings.end(), pos), pos);
+         }
+     }
+ 
+     static void erasePosting(vector<int>& postings, int pos) {
+         auto it = lower_bound(postings.begin(), postings.end(), pos);
+         if(it != postings.end() && *it == pos) {
+             postings.erase(it);
+         }
+     }
+ 
+     template <typename Key>
+     static void eraseOrdered(multimap<Key, int>& index, Key key, int pos) {
+         auto range = index.equal_range(key);
+         for (auto it = range.first; it != range.second; ++it) {
+             if(it->second == pos) {
+                 index.erase(it);
+                 break;
+             }
+         }
+     }
+ 
+     bool matches(int pos, const ScanFilter& filter) const {
+         return (!filter.availableOnly || isAvailable(pos)) &&
+                (!filter.hasBrand || brandOf[pos] == filter.brandId) &&
+                (!filter.hasModel || modelOf[pos] == filter.modelId) &&
+                yearOf[pos] >= filter.minYear && yearOf[pos] <= filter.maxYear &&
+                priceOf[pos] >= filter.minPrice && priceOf[pos] <= filter.maxPrice;
+     }
+     
+     // Resolves query's brand and model names; false if either is unknown (no matches).
+     bool compile(const CarQuery& query, ScanFilter& filter) const {
+         filter.hasBrand = !query.brand.empty();
+         filter.hasModel = !query.model.empty();
+         filter.brandId = filter.modelId = 0;
+         filter.minYear = query.minYear;
+         filter.maxYear = query.maxYear;
+         filter.minPrice = query.minPrice;
+         filter.maxPrice = query.maxPrice;
+         filter.availableOnly = query.availableOnly;
+         // A name no car in the fleet uses has no posting list.
+         return (!filter.hasBrand || (carBrands.lookup(query.brand, filter.brandId) && filter.brandId < carsByBrand.size())) &&
+                (!filter.hasModel || (carModels.lookup(query.model, filter.modelId) && filter.modelId < carsByModel.size()));
+     }
+     
+     // Match bits for the 64 cars in bitmap word w (bit i is position w * 64 + i).
+     uint64_t filterWord(size_t w, const ScanFilter& filter) const {
+         size_t base = w * 64;
+         size_t count = min<size_t>(64, brandOf.size() - base);
+         uint64_t word = liveBits[w];
+         if(filter.availableOnly) {
+             word &= atomicLoadBits(&availableBits[w]);
+         }
+         if(word == 0) {
+             return 0;
+         }
+ #if defined(CAR_RENTAL_SSE2)
+         if(count == 64) {
+             const __m128i minYear = _mm_set1_epi32(filter.minYear), maxYear = _mm_set1_epi32(filter.maxYear);
+             const __m128i brand = _mm_set1_epi32(static_cast<int>(filter.brandId));
+             const __m128i model = _mm_set1_epi32(static_cast<int>(filter.modelId));
+             const __m128d minPrice = _mm_set1_pd(filter.minPrice), maxPrice = _mm_set1_pd(filter.maxPrice);
+             const int* years = &yearOf[base];
+             const uint32_t* brandIds = &brandOf[base];
+             const uint32_t* modelIds = &modelOf[base];
+             const double* prices = &priceOf[base];
+             uint64_t mask = 0;
+             for (size_t i = 0; i < 64; i += 4) {
+                 __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(years + i));
+                 __m128i bad = _mm_or_si128(_mm_cmplt_epi32(y, minYear), _mm_cmpgt_epi32(y, maxYear));
+                 int bits = ~_mm_movemask_ps(_mm_castsi128_ps(bad)) & 0xF;
+                 if(filter.hasBrand) {
+                     __m128i ids = _mm_loadu_si128(reinterpret_cast<const __m128i*>(brandIds + i));
+                     bits &= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(ids, brand)));
+                 }
+                 if(filter.hasModel) {
+                     __m128i ids = _mm_loadu_si128(reinterpret_cast<const __m128i*>(modelIds + i));
+                     bits &= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(ids, model)));
+                 }
+                 __m128d low = _mm_loadu_pd(prices + i), high = _mm_loadu_pd(prices + i + 2);
+                 int lowBits = _mm_movemask_pd(_mm_and_pd(_mm_cmpge_pd(low, minPrice), _mm_cmple_pd(low, maxPrice)));
+                 int highBits = _mm_movemask_pd(_mm_and_pd(_mm_cmpge_pd(high, minPrice), _mm_cmple_pd(high, maxPrice)));
+                 bits &= lowBits | (highBits << 2);
+                 mask |= uint64_t(bits) << i;
+             }
+             return word & mask;
+         }
+ #endif
+         uint64_t mask = 0;
+         for (size_t i = 0; i < count; i++) {
+             size_t pos = base + i;
+             bool ok = (!filter.hasBrand || brandOf[pos] == filter.brandId) &&
+                       (!filter.hasModel || modelOf[pos] == filter.modelId) &&
+                       yearOf[pos] >= filter.minYear && yearOf[pos] <= filter.maxYear &&
+                       priceOf[pos] >= filter.minPrice && priceOf[pos] <= filter.maxPrice;
+             mask |= uint64_t(ok) << i;
+         }
+         return word & mask;
+     }
+     
+     // Index of the lowest set bit.
+     static int lowestBit(uint64_t word) {
+ #if defined(_MSC_VER)
+         unsigned long index;
+         _BitScanForward64(&index, word);
+         return static_cast<int>(index);
+ #else
+         return __builtin_ctzll(word);
+ #endif
+     }
+     
+     static int popCount(uint64_t word) {
+ #if defined(_MSC_VER)
+         return static_cast<int>(__popcnt64(word));
+ #else
+         return __builtin_popcountll(word);
+ #endif
+     }
+ 
+ public:
+     void clear() {
+         carsByBrand.clear();
+         carsByModel.clear();
+         brandOf.clear();
+         modelOf.clear();
+         yearOf.clear();
+         priceOf.clear();
+         byPrice.clear();
+         availableBits.clear();
+         liveBits.clear();
+     }
+ 
+     size_t size() const { return brandOf.size(); }
+ 
+     // Indexes car at slot pos, which is either new or tombstoned.
+     void insert(int pos, const Car& car) {
+         if(static_cast<size_t>(pos) >= brandOf.size()) {
+             // Any slots skipped over stay tombstoned.
+             brandOf.resize(pos + 1);
+             modelOf.resize(pos + 1);
+             yearOf.resize(pos + 1);
+             priceOf.resize(pos + 1);
+             availableBits.resize(pos / 64 + 1, 0);
+             liveBits.resize(pos / 64 + 1, 0);
+         }
+         uint32_t brandId = car.getBrandId();
+         uint32_t modelId = car.getModelId();
+         if(brandId >= carsByBrand.size()) carsByBrand.resize(brandId + 1);
+         if(modelId >= carsByModel.size()) carsByModel.resize(modelId + 1);
+         insertPosting(carsByBrand[brandId], pos);
+         insertPosting(carsByModel[modelId], pos);
+         brandOf[pos] = brandId;
+         modelOf[pos] = modelId;
+         yearOf[pos] = car.getYear();
+         priceOf[pos] = car.getRentalPricePerDay();
+         byPrice.emplace(car.getRentalPricePerDay(), pos);
+         liveBits[pos / 64] |= uint64_t(1) << (pos % 64);
+         setAvailable(pos, car.available());
+     }
+ 
+     // Tombstones the car at pos; no other position changes.
+     void erase(int pos) {
+         erasePosting(carsByBrand[brandOf[pos]], pos);
+         erasePosting(carsByModel[modelOf[pos]], pos);
+         eraseOrdered(byPrice, priceOf[pos], pos);
+         liveBits[pos / 64] &= ~(uint64_t(1) << (pos % 64));
+         setAvailable(pos, false);
+     }
+ 
+     // Neighbouring cars share a bitmap word but may be updated under different car
+     // locks, so the word is updated atomically.
+     void setAvailable(size_t pos, bool available) {
+         uint64_t bit = uint64_t(1) << (pos % 64);
+         if(available) {
+             atomicOrBits(&availableBits[pos / 64], bit);
+         } else {
+             atomicAndBits(&availableBits[pos / 64], ~bit);
+         }
+     }
+ 
+     bool isAvailable(size_t pos) const { return (atomicLoadBits(&availableBits[pos / 64]) >> (pos % 64)) & 1; }
+     
+     double price(int pos) const { return priceOf[pos]; }
+     
+     // Cars indexed and how many of them are available.
+     void count(size_t& live, size_t& available) const {
+         live = available = 0;
+         for (size_t w = 0; w < liveBits.size(); w++) {
+             live += popCount(liveBits[w]);
+             available += popCount(liveBits[w] & atomicLoadBits(&availableBits[w]));
+         }
+     }
+ 
+     // Runs query and returns the positions of one page of matches, cheapest first (ties
+     // in position order). more is set if further matches exist past this page.
+     vector<int> search(const CarQuery& query, bool& more) const {
+         ScanFilter filter;
+         more = false;
+         if(!compile(query, filter)) {
+             return {};
+         }
+         size_t wanted = query.offset + query.limit;
+         vector<int> hits;
+ 
+         // Pick the cheapest driver: a short posting list (then sort by price); a column
+         // scan when only the year narrows the search, since the price order would visit
+         // most of the fleet; otherwise the price index itself, which yields matches
+         // already in order and can stop as soon as the page is full.
+         const vector<int>* postings = nullptr;
+         if(filter.hasBrand) postings = &carsByBrand[filter.brandId];
+         if(filter.hasModel && (!postings || carsByModel[filter.modelId].size() < postings->size())) postings = &carsByModel[filter.modelId];
+         if(postings && postings->size() <= max<size_t>(4096, wanted * 64)) {
+             for (int pos : *postings) {
+                 if(matches(pos, filter)) hits.push_back(pos);
+             }
+         } else if(!postings && (query.minYear > 0 || query.maxYear < 2147483647) && query.maxPrice >= 1e300) {
+             for (size_t w = 0; w < availableBits.size(); w++) {
+                 for (uint64_t word = filterWord(w, filter); word != 0; word &= word - 1) {
+                     hits.push_back(static_cast<int>(w * 64 + lowestBit(word)));
+                 }
+             }
+         } else {
+             for (auto it = byPrice.lower_bound(query.minPrice); it != byPrice.end() && it->first <= query.maxPrice; ++it) {
+                 if(matches(it->second, filter)) {
+                     hits.push_back(it->second);
+                     if(hits.size() > wanted) break;
+                 }
+             }
+         }
+         stable_sort(hits.begin(), hits.end(), [this](int a, int b) {
+             return priceOf[a] < priceOf[b] || (priceOf[a] == priceOf[b] && a < b);
+         });
+         more = hits.size() > wanted;
+         if(query.offset >= hits.size()) {
+             return {};
+         }
+         return vector<int>(hits.begin() + query.offset, hits.begin() + min(hits.size(), wanted));
+     }
+     
+     // Count, price total, cheapest match and cars per year over every car matching query,
+     // in one pass over the columns.
+     FleetStats statistics(const CarQuery& query) const {
+         FleetStats stats;
+         ScanFilter filter;
+         if(!compile(query, filter)) {
+             return stats;
+         }
+         double cheapestPrice = numeric_limits<double>::infinity();
+         // Per-year counts go to a flat table for 1900-2155 and a map for anything else.
+         const int firstYear = 1900;
+         vector<size_t> yearCounts(256, 0);
+         auto countYear = [&](int year) {
+             if(year >= firstYear && year < firstYear + 256) yearCounts[year - firstYear]++;
+             else stats.carsByYear[year]++;
+         };
+         for (size_t w = 0; w < availableBits.size(); w++) {
+             uint64_t word = filterWord(w, filter);
+             if(word == 0) {
+                 continue;
+             }
+             size_t base = w * 64;
+             stats.count += popCount(word);
+ #if defined(CAR_RENTAL_SSE2)
+             if(base + 64 <= priceOf.size()) {
+                 // Masked sum and minimum, two prices per step.
+                 const __m128d infinity = _mm_set1_pd(numeric_limits<double>::infinity());
+                 __m128d sum = _mm_setzero_pd(), low = infinity;
+                 for (size_t i = 0; i < 64; i += 2) {
+                     __m128d keep = _mm_castsi128_pd(_mm_set_epi64x(-int64_t((word >> (i + 1)) & 1), -int64_t((word >> i) & 1)));
+                     __m128d price = _mm_loadu_pd(&priceOf[base + i]);
+                     sum = _mm_add_pd(sum, _mm_and_pd(keep, price));
+                     low = _mm_min_pd(low, _mm_or_pd(_mm_and_pd(keep, price), _mm_andnot_pd(keep, infinity)));
+                 }
+                 double lanes[2], mins[2];
+                 _mm_storeu_pd(lanes, sum);
+                 _mm_storeu_pd(mins, low);
+                 stats.totalPrice += lanes[0] + lanes[1];
+                 double blockMin = min(mins[0], mins[1]);
+                 if(blockMin < cheapestPrice) {
+                     cheapestPrice = blockMin;
+                     for (uint64_t bits = word; bits != 0; bits &= bits - 1) {
+                         int pos = static_cast<int>(base + lowestBit(bits));
+                         if(priceOf[pos] == blockMin) {
+                             stats.cheapest = pos;
+                             break;
+                         }
+                     }
+                 }
+                 for (; word != 0; word &= word - 1) {
+                     countYear(yearOf[base + lowestBit(word)]);
+                 }
+                 continue;
+             }
+ #endif
+             for (; word != 0; word &= word - 1) {
+                 int pos = static_cast<int>(base + lowestBit(word));
+                 stats.totalPrice += priceOf[pos];
+                 if(priceOf[pos] < cheapestPrice) {
+                     cheapestPrice = priceOf[pos];
+                     stats.cheapest = pos;
+                 }
+                 countYear(yearOf[pos]);
+             }
+         }
+         for (int i = 0; i < 256; i++) {
+             if(yearCounts[i] != 0) stats.carsByYear[firstYear + i] += yearCounts[i];
+         }
+         stats.cheapestPrice = stats.cheapest == -1 ? 0.0 : cheapestPrice;
+         return stats;
+     }
+     
+     // Prices every car matching query (its page is ignored) at each of factors (see
+     // PricingEngine): positions receives the matches in slot order and amounts one row
+     // of positions.size() prices per factor.
+     void quote(const CarQuery& query, const vector<double>& factors, vector<int>& positions, vector<double>& amounts) const {
+         positions.clear();
+         amounts.clear();
+         ScanFilter filter;
+         if(!compile(query, filter)) {
+             return;
+         }
+         // Match bits first, so the outputs are sized once.
+         vector<uint64_t> words(availableBits.size());
+         size_t count = 0;
+         for (size_t w = 0; w < words.size(); w++) {
+             words[w] = filterWord(w, filter);
+             count += popCount(words[w]);
+         }
+         positions.resize(count);
+         vector<double> rates(count);
+         size_t next = 0;
+         for (size_t w = 0; w < words.size(); w++) {
+             for (uint64_t word = words[w]; word != 0; word &= word - 1) {
+                 int pos = static_cast<int>(w * 64 + lowestBit(word));
+                 positions[next] = pos;
+                 rates[next++] = priceOf[pos];
+             }
+         }
+         amounts.resize(factors.size() * rates.size());
+         for (size_t r = 0; r < factors.size(); r++) {
+             PricingEngine::scale(rates.data(), rates.size(), factors[r], amounts.data() + r * rates.size());
+         }
+     }
+ };
+ 
+ /*****************************************************************************************
+  * Class: BranchFleet
+  * Description: The fleet's search indexes partitioned by branch, addressed by slot in cars;
+  *              the car records themselves stay in the one cars table. Each branch is a
+  *              shard with its own FleetIndex over positions local to the shard, plus the
+  *              slot behind each position; every slot records its shard and position. A
+  *              query naming a branch touches that shard alone. A fleet-wide one runs on
+  *              every shard in parallel and merges the answers: pages by price, then branch,
+  *              then position in the branch, which is exactly the order each shard pages
+  *              in, so every shard only supplies its first offset + limit matches.
+  *              A car moving branch is erased from one shard and filed in the other; an
+  *              erased position is reused by the next car filed in its shard.
+  *              Each shard has its own lock. Queries share it while they read the shard,
+  *              availability changes (atomic bitmap updates) share it too, and move()
+  *              takes the two shards involved exclusively, in branch order, so a car
+  *              changing branch holds up no other branch. A fleet-wide query therefore
+  *              sees each shard as it was when it read that shard. insert(), erase() and
+  *              clear() may add shards and need the caller to exclude every other user.
+  *****************************************************************************************/
+ class BranchFleet {
+ private:
+     struct Shard {
+         mutable shared_mutex lock;
+         FleetIndex index;
+         vector<int> slots;   // Slot of each position; -1 once erased.
+         vector<int> freePositions;
+         size_t live = 0;
+     };
+     struct Location {
+         uint32_t branch;
+         int pos;             // -1 for a slot holding no car.
+     };
+     vector<unique_ptr<Shard>> shards;   // By branch ID.
+     vector<Location> locations;
+
+     // Runs fn(branch) for every shard holding cars, under the shard's lock, and returns the
+     // results in branch order; on the pool unless a single shard is involved.
+     template <typename Fn>
+     auto fanOut(ThreadPool& pool, Fn fn) const -> vector<pair<uint32_t, decltype(fn(0u))>> {
+         vector<uint32_t> branches;
+         for (uint32_t b = 0; b < shards.size(); b++) {
+             shared_lock<shared_mutex> shardGuard(shards[b]->lock);
+             if(shards[b]->live != 0) branches.push_back(b);
+         }
+         auto locked = [this, &fn](uint32_t b) {
+             shared_lock<shared_mutex> shardGuard(shards[b]->lock);
+             return fn(b);
+         };
+         vector<pair<uint32_t, decltype(fn(0u))>> results;
+         results.reserve(branches.size());
+         if(branches.size() == 1) {
+             results.emplace_back(branches[0], locked(branches[0]));
+             return results;
+         }
+         vector<future<decltype(fn(0u))>> parts;
+         for (uint32_t b : branches) {
+             parts.push_back(pool.submit([&locked, b] { return locked(b); }));
+         }
+         for (size_t i = 0; i < branches.size(); i++) {
+             results.emplace_back(branches[i], parts[i].get());
+         }
+         return results;
+     }
+     
+     // False, with no matches, if query names a branch that has no cars.
+     bool findShard(const CarQuery& query, uint32_t& branch) const {
+         return findBranchId(query.branch, branch) && branch < shards.size();
+     }
+     
+     // Files car at slot in its branch's shard, which must exist and be held.
+     void fileIn(int slot, const Car& car) {
+         uint32_t branch = car.getBranchId();
+         Shard& shard = *shards[branch];
+         int pos;
+         if(!shard.freePositions.empty()) {
+             pos = shard.freePositions.back();
+             shard.freePositions.pop_back();
+             shard.slots[pos] = slot;
+         } else {
+             pos = static_cast<int>(shard.slots.size());
+             shard.slots.push_back(slot);
+         }
+         shard.index.insert(pos, car);
+         shard.live++;
+         locations[slot] = Location{branch, pos};
+     }
+     
+     // Takes the car at slot out of its shard, which must be held.
+     void unfile(int slot) {
+         Location& location = locations[slot];
+         Shard& shard = *shards[location.branch];
+         shard.index.erase(location.pos);
+         shard.slots[location.pos] = -1;
+         shard.freePositions.push_back(location.pos);
+         shard.live--;
+         location.pos = -1;
+     }
+     
+     void addShards(uint32_t branch) {
+         while(shards.size() <= branch) shards.push_back(make_unique<Shard>());
+     }
+
+ public:
+     void clear() {
+         shards.clear();
+         locations.clear();
+     }
+     
+     size_t branchCount() const { return shards.size(); }
+     
+     // True once branch has held a car, so that cars can move into it under move() alone.
+     bool hasShard(uint32_t branch) const { return branch < shards.size(); }
+
+     // Positions in all shards, and those of them that hold no car.
+     size_t positionCount() const {
+         size_t count = 0;
+         for (const auto& shard : shards) count += shard->slots.size();
+         return count;
+     }
+     size_t freePositionCount() const {
+         size_t count = 0;
+         for (const auto& shard : shards) count += shard->freePositions.size();
+         return count;
+     }
+
+     // Indexes car at slot, which is either new or empty, in its branch's shard.
+     void insert(int slot, const Car& car) {
+         addShards(car.getBranchId());
+         if(static_cast<size_t>(slot) >= locations.size()) locations.resize(slot + 1, Location{0, -1});
+         fileIn(slot, car);
+     }
+
+     void erase(int slot) { unfile(slot); }
+     
+     // Re-files the car at slot under car's (new) branch, holding just the shard it leaves
+     // and the one it joins. Unless the new branch already has a shard (hasShard()), the
+     // caller must exclude every other user, as for insert().
+     void move(int slot, const Car& car) {
+         uint32_t from = locations[slot].branch, to = car.getBranchId();
+         addShards(to);
+         unique_lock<shared_mutex> firstGuard(shards[min(from, to)]->lock);
+         unique_lock<shared_mutex> secondGuard(shards[max(from, to)]->lock, defer_lock);
+         if(from != to) secondGuard.lock();
+         unfile(slot);
+         fileIn(slot, car);
+     }
+     
+     // The caller holds the car's lock, so it cannot change shard meanwhile.
+     void setAvailable(int slot, bool available) {
+         const Location& location = locations[slot];
+         Shard& shard = *shards[location.branch];
+         shared_lock<shared_mutex> shardGuard(shard.lock);
+         shard.index.setAvailable(location.pos, available);
+     }
+
+     // One page of the slots matching query, cheapest first (see the class comment for
+     // ties). more is set if further matches exist past this page.
+     vector<int> search(const CarQuery& query, bool& more, ThreadPool& pool) const {
+         more = false;
+         if(!query.branch.empty()) {
+             uint32_t branch;
+             if(!findShard(query, branch)) {
+                 return {};
+             }
+             const Shard& shard = *shards[branch];
+             shared_lock<shared_mutex> shardGuard(shard.lock);
+             vector<int> slots = shard.index.search(query, more);
+             for (int& pos : slots) pos = shard.slots[pos];
+             return slots;
+         }
+         CarQuery firstPages = query;
+         firstPages.offset = 0;
+         firstPages.limit = query.offset + query.limit;
+         // (price, position, slot) of every candidate in a shard.
+         auto pages = fanOut(pool, [&](uint32_t branch) {
+             const Shard& shard = *shards[branch];
+             bool shardMore;
+             vector<tuple<double, int, int>> candidates;
+             for (int pos : shard.index.search(firstPages, shardMore)) {
+                 candidates.emplace_back(shard.index.price(pos), pos, shard.slots[pos]);
+             }
+             return make_pair(shardMore, candidates);
+         });
+         // (price, branch, position, slot) of every candidate.
+         vector<tuple<double, uint32_t, int, int>> hits;
+         for (const auto& page : pages) {
+             more = more || page.second.first;
+             for (const auto& candidate : page.second.second) {
+                 hits.emplace_back(get<0>(candidate), page.first, get<1>(candidate), get<2>(candidate));
+             }
+         }
+         sort(hits.begin(), hits.end());
+         more = more || hits.size() > firstPages.limit;
+         vector<int> slots;
+         for (size_t i = query.offset; i < min(hits.size(), firstPages.limit); i++) {
+             slots.push_back(get<3>(hits[i]));
+         }
+         return slots;
+     }
+     
+     // FleetIndex::statistics() over the matching shards, merged; cheapest is a slot.
+     FleetStats statistics(const CarQuery& query, ThreadPool& pool) const {
+         auto shardStatistics = [&](uint32_t branch) {
+             const Shard& shard = *shards[branch];
+             FleetStats stats = shard.index.statistics(query);
+             if(stats.cheapest != -1) stats.cheapest = shard.slots[stats.cheapest];
+             return stats;
+         };
+         FleetStats stats;
+         if(!query.branch.empty()) {
+             uint32_t branch;
+             if(findShard(query, branch)) {
+                 shared_lock<shared_mutex> shardGuard(shards[branch]->lock);
+                 stats = shardStatistics(branch);
+             }
+             return stats;
+         }
+         for (const auto& part : fanOut(pool, shardStatistics)) {
+             const FleetStats& shardStats = part.second;
+             if(shardStats.cheapest != -1 && (stats.cheapest == -1 || shardStats.cheapestPrice < stats.cheapestPrice)) {
+                 stats.cheapest = shardStats.cheapest;
+                 stats.cheapestPrice = shardStats.cheapestPrice;
+             }
+             stats.count += shardStats.count;
+             stats.totalPrice += shardStats.totalPrice;
+             for (const auto& year : shardStats.carsByYear) {
+                 stats.carsByYear[year.first] += year.second;
+             }
+         }
+         return stats;
+     }
+     
+     // FleetIndex::quote() over the matching shards: slots receives the matches branch by
+     // branch, and amounts one row of slots.size() prices per factor.
+     void quote(const CarQuery& query, const vector<double>& factors, vector<int>& slots, vector<double>& amounts, ThreadPool& pool) const {
+         slots.clear();
+         amounts.clear();
+         auto shardQuote = [&](uint32_t branch) {
+             const Shard& shard = *shards[branch];
+             pair<vector<int>, vector<double>> result;
+             shard.index.quote(query, factors, result.first, result.second);
+             for (int& pos : result.first) pos = shard.slots[pos];
+             return result;
+         };
+         if(!query.branch.empty()) {
+             uint32_t branch;
+             if(findShard(query, branch)) {
+                 shared_lock<shared_mutex> shardGuard(shards[branch]->lock);
+                 tie(slots, amounts) = shardQuote(branch);
+             }
+             return;
+         }
+         auto parts = fanOut(pool, shardQuote);
+         for (const auto& part : parts) {
+             slots.insert(slots.end(), part.second.first.begin(), part.second.first.end());
+         }
+         amounts.resize(factors.size() * slots.size());
+         size_t first = 0;
+         for (const auto& part : parts) {
+             size_t count = part.second.first.size();
+             for (size_t r = 0; r < factors.size(); r++) {
+                 copy_n(part.second.second.begin() + r * count, count, amounts.begin() + r * slots.size() + first);
+             }
+             first += count;
+         }
+     }
+     
+     // Cars and available cars per branch that has any, counted in parallel.
+     vector<pair<uint32_t, pair<size_t, size_t>>> branchCounts(ThreadPool& pool) const {
+         return fanOut(pool, [this](uint32_t branch) {
+             pair<size_t, size_t> counts;
+             shards[branch]->index.count(counts.first, counts.second);
+             return counts;
+         });
+     }
+ };
+ 
+ /*****************************************************************************************
+  * Class: CustomerIndex
+  * Description: Search indexes over the customers, addressed by slot in customers.
+  *              Driver licenses are in an open-addressing hash table of (hash, slot) pairs,
+  *              eight bytes each. Matches are checked against the record, so licenses that
+  *              share a hash never mix. Names and contact info feed a trigram inverted index.
+  *              Text is folded to lower case and split into words. Each word is padded with
+  *              two spaces in front and one behind, so "Jo" yields "  j" and " jo", and a
+  *              prefix of a word shares that word's leading trigrams. Each trigram has a
+  *              posting list of slots in ascending order, stored as varint deltas in blocks of
+  *              PostingBlock with the first slot of every block kept aside for skipping.
+  *              search() ranks customers by the share of the query's trigrams they contain,
+  *              at least MinSimilarity. It first asks for all of them and relaxes one at a
+  *              time only while it has fewer matches than wanted. Needing k of n trigrams,
+  *              the n - k + 1 rarest lists supply the candidates, which are then looked up
+  *              in the other lists by seeking, never by scanning. A query so common that
+  *              it has over MaxCandidates candidates is ranked among the first that many,
+  *              by slot, so its cost stays bounded.
+  *****************************************************************************************/
+ struct CustomerMatch {
+     int slot;
+     double score;   // Share of the query's trigrams found, 0-1.
+ };
+ 
+ class CustomerIndex {
+ public:
+     static constexpr double MinSimilarity = 0.5;
+     static const size_t MaxCandidates = 1 << 16;
+     
+ private:
+     static const uint32_t AlphabetSize = 38;   // Separator, a-z, 0-9, any non-ASCII byte.
+     static const uint32_t PostingBlock = 128;
+     
+     struct PostingList {
+         vector<uint8_t> deltas;
+         vector<uint32_t> blockFirst;    // First slot of each block.
+         vector<uint32_t> blockOffset;   // Where each block's deltas start.
+         uint32_t last = 0;
+         uint32_t count = 0;
+         
+         void append(uint32_t slot) {
+             if(count % PostingBlock == 0) {
+                 blockFirst.push_back(slot);
+                 blockOffset.push_back(static_cast<uint32_t>(deltas.size()));
+             } else {
+                 for (uint32_t delta = slot - last; ; delta >>= 7) {
+                     if(delta < 0x80) {
+                         deltas.push_back(static_cast<uint8_t>(delta));
+                         break;
+                     }
+                     deltas.push_back(static_cast<uint8_t>(delta | 0x80));
+                 }
+             }
+             last = slot;
+             count++;
+         }
+         
+         size_t memoryUsage() const {
+             return deltas.capacity() + (blockFirst.capacity() + blockOffset.capacity()) * sizeof(uint32_t);
+         }
+     };
+     
+     // Walks a posting list in ascending order; seek() skips whole blocks.
+     class PostingCursor {
+     private:
+         const PostingList* list;
+         size_t block;
+         uint32_t offset;
+         uint32_t inBlock;
+         
+         void enterBlock(size_t b) {
+             block = b;
+             offset = list->blockOffset[b];
+             inBlock = 0;
+             current = list->blockFirst[b];
+         }
+         
+     public:
+         uint32_t current;
+         bool done;
+         
+         explicit PostingCursor(const PostingList& postings) : list(&postings), block(0), offset(0), inBlock(0), current(0), done(postings.count == 0) {
+             if(!done) enterBlock(0);
+         }
+         
+         void next() {
+             size_t position = block * PostingBlock + inBlock + 1;
+             if(position >= list->count) {
+                 done = true;
+             } else if(++inBlock == PostingBlock) {
+                 enterBlock(block + 1);
+             } else {
+                 uint32_t delta = 0;
+                 for (int shift = 0; ; shift += 7) {
+                     uint8_t byte = list->deltas[offset++];
+                     delta |= uint32_t(byte & 0x7F) << shift;
+                     if(byte < 0x80) break;
+                 }
+                 current += delta;
+             }
+         }
+         
+         // Moves to the first slot >= target.
+         void seek(uint32_t target) {
+             if(done || current >= target) {
+                 return;
+             }
+             size_t b = upper_bound(list->blockFirst.begin() + block, list->blockFirst.end(), target) - list->blockFirst.begin() - 1;
+             if(b > block) {
+                 enterBlock(b);
+             }
+             while(!done && current < target) {
+                 next();
+             }
+         }
+     };
+     
+     vector<uint64_t> licenseTable;   // (hash << 32) | (slot + 1); 0 is an empty entry.
+     size_t licenseCount = 0;
+     vector<PostingList> postings = vector<PostingList>(AlphabetSize * AlphabetSize * AlphabetSize);
+     size_t postingCount = 0;
+     
+     static uint32_t hashLicense(string_view license) {
+         uint64_t hash = std::hash<string_view>()(license);
+         return static_cast<uint32_t>(hash ^ (hash >> 32));
+     }
+     
+     void placeLicense(uint64_t entry) {
+         size_t mask = licenseTable.size() - 1;
+         for (size_t i = (entry >> 32) & mask; ; i = (i + 1) & mask) {
+             if(licenseTable[i] == 0) {
+                 licenseTable[i] = entry;
+                 return;
+             }
+         }
+     }
+     
+     // The slots found in at least needed of lists (rarest first), ascending, with the
+     // number of lists each was found in.
+     static void withAtLeast(const vector<const PostingList*>& lists, size_t needed, vector<uint32_t>& candidates, vector<uint32_t>& hits) {
+         // A candidate missing from every one of the rarest (lists - needed + 1) lists
+         // cannot reach needed, so those lists alone supply the candidates.
+         size_t sources = lists.size() - needed + 1;
+         // Merge the source lists into ascending distinct candidates, counting the lists
+         // each appears in.
+         vector<PostingCursor> cursors;
+         for (size_t i = 0; i < sources; i++) {
+             cursors.emplace_back(*lists[i]);
+         }
+         candidates.clear();
+         hits.clear();
+         while(true) {
+             uint32_t lowest = UINT32_MAX;
+             for (const PostingCursor& cursor : cursors) {
+                 if(!cursor.done && cursor.current < lowest) lowest = cursor.current;
+             }
+             if(lowest == UINT32_MAX || candidates.size() == MaxCandidates) {
+                 break;
+             }
+             uint32_t count = 0;
+             for (PostingCursor& cursor : cursors) {
+                 if(!cursor.done && cursor.current == lowest) {
+                     count++;
+                     cursor.next();
+                 }
+             }
+             candidates.push_back(lowest);
+             hits.push_back(count);
+         }
+         // Look the candidates up in the other lists, dropping those that can no longer
+         // reach needed.
+         for (size_t i = sources; i < lists.size(); i++) {
+             size_t remaining = lists.size() - i - 1;
+             size_t kept = 0;
+             PostingCursor cursor(*lists[i]);
+             for (size_t c = 0; c < candidates.size(); c++) {
+                 cursor.seek(candidates[c]);
+                 uint32_t count = hits[c] + (!cursor.done && cursor.current == candidates[c]);
+                 if(count + remaining >= needed) {
+                     candidates[kept] = candidates[c];
+                     hits[kept++] = count;
+                 }
+             }
+             candidates.resize(kept);
+             hits.resize(kept);
+         }
+     }
+     
+     static uint32_t symbolOf(unsigned char c) {
+         if(c >= 'a' && c <= 'z') return c - 'a' + 1;
+         if(c >= 'A' && c <= 'Z') return c - 'A' + 1;
+         if(c >= '0' && c <= '9') return c - '0' + 27;
+         return c >= 0x80 ? 37 : 0;
+     }
+     
+     // Appends the trigram codes of text's words. With padLastWord false the final word
+     // gets no trailing pad, so it matches as a prefix.
+     static void trigramsOf(string_view text, bool padLastWord, vector<uint32_t>& out) {
+         uint32_t a = 0, b = 0;
+         for (char ch : text) {
+             uint32_t c = symbolOf(ch);
+             if(c != 0 || b != 0) {
+                 out.push_back((a * AlphabetSize + b) * AlphabetSize + c);
+             }
+             a = c == 0 ? 0 : b;
+             b = c;
+         }
+         if(b != 0 && padLastWord) {
+             out.push_back((a * AlphabetSize + b) * AlphabetSize);
+         }
+     }
+     
+ public:
+     void clear() {
+         licenseTable.assign(1024, 0);
+         licenseCount = 0;
+         postings.assign(AlphabetSize * AlphabetSize * AlphabetSize, PostingList());
+         postingCount = 0;
+     }
+     
+     // Indexes customer at slot. Slots arrive in ascending order (customers are only ever
+     // appended, and a compaction rebuilds the index).
+     void insert(int slot, const Customer& customer) {
+         if((licenseCount + 1) * 10 > licenseTable.size() * 7) {
+             vector<uint64_t> old(max<size_t>(1024, licenseTable.size() * 2), 0);
+             old.swap(licenseTable);
+             for (uint64_t entry : old) {
+                 if(entry != 0) placeLicense(entry);
+             }
+         }
+         placeLicense((uint64_t(hashLicense(customer.getDriverLicense())) << 32) | uint32_t(slot + 1));
+         licenseCount++;
+         
+         static thread_local vector<uint32_t> codes;
+         codes.clear();
+         trigramsOf(customer.getName(), true, codes);
+         trigramsOf(customer.getContactInfo(), true, codes);
+         for (uint32_t code : codes) {
+             PostingList& list = postings[code];
+             if(list.count == 0 || list.last != static_cast<uint32_t>(slot)) {   // Repeats are listed once.
+                 list.append(slot);
+                 postingCount++;
+             }
+         }
+     }
+     
+     // Slots of the customers whose driver license is exactly license.
+     vector<int> findLicense(const string& license, const SlotTable<Customer>& customers) const {
+         vector<int> slots;
+         if(licenseTable.empty()) {
+             return slots;
+         }
+         uint32_t hash = hashLicense(license);
+         size_t mask = licenseTable.size() - 1;
+         for (size_t i = hash & mask; licenseTable[i] != 0; i = (i + 1) & mask) {
+             uint64_t entry = licenseTable[i];
+             int slot = static_cast<int>(uint32_t(entry) - 1);
+             if(uint32_t(entry >> 32) == hash && customers.isLive(slot) && customers[slot].getDriverLicense() == license) {
+                 slots.push_back(slot);
+             }
+         }
+         sort(slots.begin(), slots.end());
+         return slots;
+     }
+     
+     // Up to limit customers whose name or contact info resembles query, best first:
+     // by score, then by how close the name's length is to the query's, then by slot.
+     vector<CustomerMatch> search(const string& query, size_t limit, const SlotTable<Customer>& customers) const {
+         vector<uint32_t> codes;
+         trigramsOf(query, false, codes);
+         sort(codes.begin(), codes.end());
+         codes.erase(unique(codes.begin(), codes.end()), codes.end());
+         vector<CustomerMatch> matches;
+         if(codes.empty() || limit == 0) {
+             return matches;
+         }
+         vector<const PostingList*> lists;
+         for (uint32_t code : codes) {
+             lists.push_back(&postings[code]);
+         }
+         sort(lists.begin(), lists.end(), [](const PostingList* a, const PostingList* b) { return a->count < b->count; });
+         // Every customer with at least needed trigrams is found, so while fewer than
+         // limit are, relaxing needed cannot change the ones that rank first.
+         size_t lowest = max<size_t>(1, static_cast<size_t>(ceil(MinSimilarity * lists.size())));
+         size_t needed = lists.size();
+         vector<uint32_t> candidates, hits;
+         while(true) {
+             withAtLeast(lists, needed, candidates, hits);
+             size_t live = 0;
+             for (uint32_t slot : candidates) {
+                 live += customers.isLive(slot);
+             }
+             if(live >= limit || needed == lowest) {
+                 break;
+             }
+             needed--;
+         }
+         // Only the best limit are ranked: find the lowest count that makes the cut, and
+         // order the candidates from it up by (missing lists, name length gap, slot).
+         vector<size_t> withHits(lists.size() + 1, 0);
+         for (size_t c = 0; c < candidates.size(); c++) {
+             withHits[hits[c]] += customers.isLive(candidates[c]);
+         }
+         size_t cutoff = lists.size(), better = withHits[cutoff];
+         while(cutoff > needed && better < limit) {
+             better += withHits[--cutoff];
+         }
+         vector<uint64_t> ranked;
+         for (size_t c = 0; c < candidates.size(); c++) {
+             if(hits[c] >= cutoff && customers.isLive(candidates[c])) {
+                 size_t length = customers[candidates[c]].getName().size();
+                 uint64_t gap = min<size_t>(length > query.size() ? length - query.size() : query.size() - length, 0xFFFFF);
+                 ranked.push_back((uint64_t(lists.size() - hits[c]) << 52) | (gap << 32) | candidates[c]);
+             }
+         }
+         size_t shown = min(limit, ranked.size());
+         partial_sort(ranked.begin(), ranked.begin() + shown, ranked.end());
+         for (size_t i = 0; i < shown; i++) {
+             matches.push_back({static_cast<int>(uint32_t(ranked[i])), double(lists.size() - (ranked[i] >> 52)) / lists.size()});
+         }
+         return matches;
+     }
+     
+     size_t memoryUsage() const {
+         size_t bytes = licenseTable.capacity() * sizeof(uint64_t) + postings.capacity() * sizeof(PostingList);
+         for (const PostingList& list : postings) {
+             bytes += list.memoryUsage();
+         }
+         return bytes;
+     }
+ };
+ 
+ /*****************************************************************************************
+  * Binary Snapshot Format
+  * Description: Versioned, column-oriented image of the four tables, designed to be read
+  *              straight out of an mmap without any parsing.
+  *
+  *              [FileHeader]
+  *              [TableEntry][ColumnEntry x columnCount]     (one group per table)
+  *              [column data ...]                           (each column 8-byte aligned)
+  *              [string heap]
+  *
+  *              Fixed-width columns are stored as packed arrays (int32, float64, uint8).
+  *              A string column is an array of rowCount + 1 uint64 offsets into the shared
+  *              string heap; row i spans [offsets[i], offsets[i + 1]).
+  *****************************************************************************************/
+ namespace snapshot {
+     const char Magic[8] = {'C', 'R', 'S', 'N', 'A', 'P', '\0', '\0'};
+     const uint32_t Version = 1;
+     const uint32_t ByteOrderMark = 0x01020304;
+ 
+     enum ColumnType : uint32_t { Int32 = 1, Float64 = 2, Bool8 = 3, String = 4, Int64 = 5 };
+     enum TableId : uint32_t { CarsTable = 0, CustomersTable = 1, RentalsTable = 2, PaymentsTable = 3, TableCount = 4 };
+ 
+     struct FileHeader {
+         char magic[8];
+         uint32_t version;
+         uint32_t byteOrder;
+         uint32_t tableCount;
+         uint32_t reserved;
+         uint64_t heapOffset;
+         uint64_t heapBytes;
+     };
+ 
+     struct TableEntry {
+         uint32_t tableId;
+         uint32_t columnCount;
+         uint64_t rowCount;
+     };
+ 
+     struct ColumnEntry {
+         uint32_t type;
+         uint32_t reserved;
+         uint64_t offset;
+         uint64_t bytes;
+     };
+ }
+ 
+ /*****************************************************************************************
+  * Class: SnapshotWriter
+  * Description: Accumulates tables column by column and writes the snapshot file in one
+  *              go (see writeFileAtomically()).
+  *****************************************************************************************/
+ class SnapshotWriter {
+ private:
+     struct PendingTable {
+         snapshot::TableEntry entry;
+         vector<snapshot::ColumnEntry> columns;
+         vector<string> data;
+     };
+     vector<PendingTable> tables;
+     string heap;
+ 
+     void addColumn(snapshot::ColumnType type, string bytes) {
+         snapshot::ColumnEntry column = {type, 0, 0, bytes.size()};
+         tables.back().columns.push_back(column);
+         tables.back().data.push_back(move(bytes));
+         tables.back().entry.columnCount++;
+     }
+ 
+ public:
+     void beginTable(snapshot::TableId id, size_t rowCount) {
+         PendingTable table;
+         table.entry = {id, 0, rowCount};
+         tables.push_back(move(table));
+     }
+ 
+     // Appends a fixed-width column; get(row) yields the value of each row.
+     template <typename T, typename Getter>
+     void addFixedColumn(snapshot::ColumnType type, Getter get) {
+         size_t rows = tables.back().entry.rowCount;
+         string bytes(rows * sizeof(T), '\0');
+         T* out = reinterpret_cast<T*>(&bytes[0]);
+         for (size_t row = 0; row < rows; row++) {
+             out[row] = static_cast<T>(get(row));
+         }
+         addColumn(type, move(bytes));
+     }
+ 
+     // Appends a string column; the characters go to the shared heap.
+     template <typename Getter>
+     void addStringColumn(Getter get) {
+         size_t rows = tables.back().entry.rowCount;
+         string bytes((rows + 1) * sizeof(uint64_t), '\0');
+         uint64_t* offsets = reinterpret_cast<uint64_t*>(&bytes[0]);
+         for (size_t row = 0; row < rows; row++) {
+             offsets[row] = heap.size();
+             heap += get(row);
+         }
+         offsets[rows] = heap.size();
+         addColumn(snapshot::String, move(bytes));
+     }
+ 
+     bool writeTo(const string& path) {
+         auto align8 = [](uint64_t n) { return (n + 7) & ~uint64_t(7); };
+         // Lay out the directory, then the columns, then the heap.
+         uint64_t offset = sizeof(snapshot::FileHeader);
+         for (const PendingTable& table : tables) {
+             offset += sizeof(snapshot::TableEntry) + table.columns.size() * sizeof(snapshot::ColumnEntry);
+         }
+         for (PendingTable& table : tables) {
+             for (snapshot::ColumnEntry& column : table.columns) {
+                 offset = align8(offset);
+                 column.offset = offset;
+                 offset += column.bytes;
+             }
+         }
+         snapshot::FileHeader header;
+         memcpy(header.magic, snapshot::Magic, sizeof(header.magic));
+         header.version = snapshot::Version;
+         header.byteOrder = snapshot::ByteOrderMark;
+         header.tableCount = tables.size();
+         header.reserved = 0;
+         header.heapOffset = align8(offset);
+         header.heapBytes = heap.size();
+ 
+         return writeFileAtomically(path, [&](FILE* file) {
+             static const char zeros[8] = {0};
+             uint64_t written = 0;
+             auto put = [&](const void* bytes, size_t n) {
+                 fwrite(bytes, 1, n, file);
+                 written += n;
+             };
+             auto padTo = [&](uint64_t target) { put(zeros, target - written); };
+             put(&header, sizeof(header));
+             for (const PendingTable& table : tables) {
+                 put(&table.entry, sizeof(table.entry));
+                 put(table.columns.data(), table.columns.size() * sizeof(snapshot::ColumnEntry));
+             }
+             for (const PendingTable& table : tables) {
+                 for (size_t c = 0; c < table.columns.size(); c++) {
+                     padTo(table.columns[c].offset);
+                     put(table.data[c].data(), table.data[c].size());
+                 }
+             }
+             padTo(header.heapOffset);
+             put(heap.data(), heap.size());
+             return true;
+         });
+     }
+ };
+ 
+ /*****************************************************************************************
+  * Class: SnapshotReader
+  * Description: Validates a memory-mapped snapshot and exposes its columns in place.
+  *              Nothing is copied; pages are faulted in only as columns are touched.
+  *****************************************************************************************/
+ class SnapshotReader {
+ private:
+     struct Table {
+         snapshot::TableEntry entry;
+         const snapshot::ColumnEntry* columns;
+     };
+     MappedFile file;
+     Table tables[snapshot::TableCount];
+     const char* heap;
+ 
+     const char* columnData(snapshot::TableId table, uint32_t column) const {
+         return file.data() + tables[table].columns[column].offset;
+     }
+ 
+ public:
+     SnapshotReader() : heap(nullptr) {
+         for (Table& table : tables) {
+             table.entry = {0, 0, 0};
+             table.columns = nullptr;
+         }
+     }
+ 
+     // Maps and validates path. On failure error describes the problem.
+     bool open(const string& path, string& error) {
+         if(!file.open(path)) {
+             error = "cannot open " + path;
+             return false;
+         }
+         const char* base = file.data();
+         uint64_t size = file.size();
+         if(size < sizeof(snapshot::FileHeader)) {
+             error = "truncated header";
+             return false;
+         }
+         const snapshot::FileHeader* header = reinterpret_cast<const snapshot::FileHeader*>(base);
+         if(memcmp(header->magic, snapshot::Magic, sizeof(header->magic)) != 0) {
+             error = "not a snapshot file";
+             return false;
+         }
+         if(header->byteOrder != snapshot::ByteOrderMark || header->version != snapshot::Version) {
+             error = "unsupported snapshot version " + to_string(header->version);
+             return false;
+         }
+         if(header->heapOffset > size || header->heapBytes > size - header->heapOffset) {
+             error = "string heap out of bounds";
+             return false;
+         }
+         heap = base + header->heapOffset;
+         uint64_t cursor = sizeof(snapshot::FileHeader);
+         for (uint32_t t = 0; t < header->tableCount; t++) {
+             if(cursor + sizeof(snapshot::TableEntry) > size) {
+                 error = "truncated table directory";
+                 return false;
+             }
+             const snapshot::TableEntry* entry = reinterpret_cast<const snapshot::TableEntry*>(base + cursor);
+             cursor += sizeof(snapshot::TableEntry);
+             if(cursor + uint64_t(entry->columnCount) * sizeof(snapshot::ColumnEntry) > size) {
+                 error = "truncated column directory";
+                 return false;
+             }
+             const snapshot::ColumnEntry* columns = reinterpret_cast<const snapshot::ColumnEntry*>(base + cursor);
+             cursor += entry->columnCount * sizeof(snapshot::ColumnEntry);
+             for (uint32_t c = 0; c < entry->columnCount; c++) {
+                 if(columns[c].offset > size || columns[c].bytes > size - columns[c].offset) {
+                     error = "column out of bounds";
+                     return false;
+                 }
+             }
+             if(entry->tableId < snapshot::TableCount) {
+                 tables[entry->tableId].entry = *entry;
+                 tables[entry->tableId].columns = columns;
+             }
+         }
+         return true;
+     }
+ 
+     size_t rowCount(snapshot::TableId table) const { return tables[table].entry.rowCount; }
+ 
+     size_t columnCount(snapshot::TableId table) const { return tables[table].entry.columnCount; }
+ 
+     // Whether column c of table exists and holds a value of type for every row.
+     bool columnFits(snapshot::TableId table, size_t c, snapshot::ColumnType type) const {
+         const Table& t = tables[table];
+         if(c >= t.entry.columnCount) {
+             return false;
+         }
+         uint64_t width = type == snapshot::Int32 ? 4 : type == snapshot::Float64 || type == snapshot::Int64 ? 8 : 1;
+         uint64_t expected = type == snapshot::String ? (t.entry.rowCount + 1) * 8 : t.entry.rowCount * width;
+         return t.columns[c].type == type && t.columns[c].bytes >= expected;
+     }
+ 
+     // A fixed-width column as a packed array of T (int32_t, int64_t, double or uint8_t).
+     template <typename T>
+     const T* fixedColumn(snapshot::TableId table, uint32_t column) const {
+         return reinterpret_cast<const T*>(columnData(table, column));
+     }
+     string_view stringAt(snapshot::TableId table, uint32_t column, size_t row) const {
+         const uint64_t* offsets = reinterpret_cast<const uint64_t*>(columnData(table, column));
+         return string_view(heap + offsets[row], offsets[row + 1] - offsets[row]);
+     }
+ };
+ 
+ /*****************************************************************************************
+  * Record Columns
+  * Description: The snapshot form of a record, generated like the CSV form from
+  *              Record::fields() (see RecordFormat): one column per field, typed by the
+  *              field codec's Stored type. Loading matches each column of the file with
+  *              its field. A String column where a fixed-width one is expected, as in
+  *              snapshots from before timestamps were compact, is read through the
+  *              field's CSV codec, and optional fields whose columns are missing from an
+  *              older snapshot keep their defaults.
+  *****************************************************************************************/
+ template <typename Stored>
+ constexpr snapshot::ColumnType snapshotColumnType() {
+     if constexpr(is_same<Stored, int32_t>::value) return snapshot::Int32;
+     else if constexpr(is_same<Stored, int64_t>::value) return snapshot::Int64;
+     else if constexpr(is_same<Stored, double>::value) return snapshot::Float64;
+     else if constexpr(is_same<Stored, uint8_t>::value) return snapshot::Bool8;
+     else return snapshot::String;
+ }
+ 
+ template <typename Record>
+ struct RecordColumns {
+     // Where a field is read from: nowhere (default), its typed column, or text.
+     enum Source : uint8_t { Missing, Typed, Text };
+ 
+     // Adds table with one column per field; rowAt(i) returns the i-th record by reference.
+     template <typename RowAt>
+     static void write(SnapshotWriter& writer, snapshot::TableId table, size_t rows, const RowAt& rowAt) {
+         writer.beginTable(table, rows);
+         forEachField<Record>([&](const auto& f, size_t) {
+             typedef typename decay_t<decltype(f)>::CodecType Codec;
+             typedef typename Codec::Stored Stored;
+             auto member = f.member;
+             auto get = [&rowAt, member](size_t i) { return Codec::store(rowAt(i).*member); };
+             if constexpr(is_same<Stored, string_view>::value) {
+                 writer.addStringColumn(get);
+             } else {
+                 writer.addFixedColumn<Stored>(snapshotColumnType<Stored>(), get);
+             }
+             return true;
+         });
+     }
+ 
+     // Checks the columns of table against the fields and fills sources (one per field).
+     // False if a required field has no readable column.
+     static bool match(const SnapshotReader& reader, snapshot::TableId table, vector<Source>& sources) {
+         sources.assign(fieldCount<Record>(), Missing);
+         if(reader.rowCount(table) == 0 && reader.columnCount(table) == 0) {
+             return true;
+         }
+         return forEachField<Record>([&](const auto& f, size_t index) {
+             snapshot::ColumnType type = snapshotColumnType<typename decay_t<decltype(f)>::CodecType::Stored>();
+             if(index >= reader.columnCount(table)) {
+                 return f.optional;
+             }
+             if(reader.columnFits(table, index, type)) {
+                 sources[index] = Typed;
+             } else if(reader.columnFits(table, index, snapshot::String)) {
+                 sources[index] = Text;
+             } else {
+                 return false;
+             }
+             return true;
+         });
+     }
+ 
+     static Record read(const SnapshotReader& reader, snapshot::TableId table, const vector<Source>& sources, size_t row) {
+         Record record;
+         forEachField<Record>([&](const auto& f, size_t index) {
+             typedef typename decay_t<decltype(f)>::CodecType Codec;
+             typedef typename Codec::Stored Stored;
+             if(sources[index] == Typed) {
+                 if constexpr(is_same<Stored, string_view>::value) {
+                     Codec::load(reader.stringAt(table, index, row), record.*f.member);
+                 } else {
+                     Codec::load(reader.fixedColumn<Stored>(table, index)[row], record.*f.member);
+                 }
+             } else if(sources[index] == Text) {
+                 Codec::fromCsv(reader.stringAt(table, index, row), record.*f.member);
+             }
+             return true;
+         });
+         return record;
+     }
+ };
+ 
+ /*****************************************************************************************
+  * Class: Journal
+  * Description: Append-only write-ahead log of every mutation made to the system.
+  *              Records are buffered and written out with a single write + fsync per
+  *              group commit, so a crash loses at most the open group. Appends are
+  *              thread-safe and never wait for a commit's fsync. On startup the
+  *              journal is replayed on top of the last snapshot; a checkpoint writes a
+  *              new snapshot and truncates it. A background checkpoint instead rotates it:
+  *              the records so far are retired to <journal>.old, which is deleted once the
+  *              new snapshot is in place and otherwise replayed first.
+  *
+  *              Record layout (one per line): <fnv1a hex>|<op>|<payload>
+  *****************************************************************************************/
+ class Journal {
+ public:
+     // Journaled operation codes.
+     enum Op : char {
+         AddCar = 'C',
+         RemoveCar = 'X',
+         AddCustomer = 'U',
+         RentCar = 'R',
+         ReturnCar = 'T',
+         AddPayment = 'P',
+         PickUp = 'S',    // Payload: the rental ID.
+         Archive = 'A'   // Payload: the new segments' manifest lines, ';'-separated.
+     };
+ 
+ private:
+     string path;
+     FILE* file;
+     string pending;
+     size_t pendingRecords;
+     size_t groupCommitSize;
+     mutex bufferMutex;   // guards pending and pendingRecords
+     mutex fileMutex;     // serialises writes to file; held across the fsync
+ 
+ public:
+     Journal() : file(nullptr), pendingRecords(0), groupCommitSize(64) {}
+     ~Journal() { close(); }
+ 
+     // Opens (or creates) the journal for appending.
+     void open(const string& journalPath) {
+         close();
+         path = journalPath;
+         file = fopen(path.c_str(), "ab");
+     }
+ 
+     void close() {
+         if(file) {
+             commit();
+             fclose(file);
+             file = nullptr;
+         }
+     }
+ 
+     // Number of records appended per automatic group commit.
+     void setGroupCommitSize(size_t records) { groupCommitSize = max<size_t>(1, records); }
+ 
+     // Buffers one record; the group is committed once it reaches groupCommitSize.
+     void append(Op op, const string& payload) {
+         string body;
+         body.reserve(payload.size() + 2);
+         body += static_cast<char>(op);
+         body += '|';
+         body += payload;
+         char hash[16];
+         snprintf(hash, sizeof(hash), "%08x|", fnv1a(body));
+         bool full;
+         {
+             lock_guard<mutex> lock(bufferMutex);
+             pending += hash;
+             pending += body;
+             pending += '\n';
+             full = ++pendingRecords >= groupCommitSize;
+         }
+         if(full) {
+             commit();
+         }
+     }
+ 
+     // Writes everything appended so far in one call and makes it durable. Records
+     // appended by other threads while the fsync runs go into the next group.
+     void commit() {
+         lock_guard<mutex> fileLock(fileMutex);
+         commitLocked();
+     }
+ 
+ private:
+     void commitLocked() {
+         string group;
+         {
+             lock_guard<mutex> lock(bufferMutex);
+             group.swap(pending);
+             pendingRecords = 0;
+         }
+         if(group.empty() || !file) {
+             return;
+         }
+         fwrite(group.data(), 1, group.size(), file);
+         syncFileToDisk(file);
+     }
+ 
+ public:
+     static string retiredPath(const string& journalPath) { return journalPath + ".old"; }
+ 
+     // Moves every record so far to the end of the retired journal (which exists only
+     // while a background checkpoint is pending or after one failed) and starts an empty
+     // journal, so replaying the retired journal and then this one keeps the order.
+     bool rotate() {
+         lock_guard<mutex> fileLock(fileMutex);
+         commitLocked();
+         if(!file) {
+             return false;
+         }
+         fclose(file);
+         string retired = retiredPath(path);
+         bool ok = false;
+         if(FILE* out = fopen(retired.c_str(), "ab")) {
+             ifstream in(path, ios::binary);
+             string records((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+             ok = fwrite(records.data(), 1, records.size(), out) == records.size();
+             syncFileToDisk(out);
+             ok = !ferror(out) && ok;
+             ok = fclose(out) == 0 && ok;
+             syncDirectoryOf(retired);
+         }
+         // If the copy failed the records stay here as well; replaying them twice is harmless.
+         file = fopen(path.c_str(), ok ? "wb" : "ab");
+         if(file) {
+             syncFileToDisk(file);
+         }
+         return ok;
+     }
+ 
+     // Deletes the retired journal once a checkpoint covers its records.
+     void discardRetired() {
+         remove(retiredPath(path).c_str());
+         syncDirectoryOf(path);
+     }
+     
+     // Drops all journaled records, retired ones included; called once a checkpoint has
+     // made them redundant.
+     void truncate() {
+         lock_guard<mutex> fileLock(fileMutex);
+         {
+             lock_guard<mutex> lock(bufferMutex);
+             pending.clear();
+             pendingRecords = 0;
+         }
+         if(file) {
+             fclose(file);
+         }
+         file = fopen(path.c_str(), "wb");
+         if(file) {
+             syncFileToDisk(file);
+         }
+         remove(retiredPath(path).c_str());
+     }
+ 
+     // Feeds every intact record of the journal at journalPath to apply, in order.
+     // Replay stops at the first torn or corrupted record. Returns the records applied.
+     static size_t replay(const string& journalPath, const function<void(Op, const string&)>& apply) {
+         ifstream in(journalPath, ios::binary);
+         string line;
+         size_t applied = 0;
+         while(getline(in, line)) {
+             if(in.eof() || line.size() < 11 || line[8] != '|' || line[10] != '|') {
+                 break;  // Unterminated or malformed tail from an interrupted write.
+             }
+             string body = line.substr(9);
+             if(strtoul(line.substr(0, 8).c_str(), nullptr, 16) != fnv1a(body)) {
+                 break;
+             }
+             apply(static_cast<Op>(body[0]), body.substr(2));
+             applied++;
+         }
+         return applied;
+     }
+ };
+ 
+ /*****************************************************************************************
+  * Class: RentalArchive
+  * Description: Cold storage for history. Closed rentals whose balance is settled, with
+  *              their payments, move out of the live tables into segment files once they
+  *              are older than the archive age, so loading and memory track the active
+  *              set. Each segment holds rentals that closed in one calendar month (a month
+  *              may gain further segments later) and is never modified once written. The
+  *              manifest (archive.txt) lists the segments with their ID ranges and totals;
+  *              segments themselves are read only when a lookup or report reaches them.
+  *
+  *              Segment layout: magic, then every field as a base-128 varint: the plate
+  *              and payment-method string tables, then the rentals and the payments in ID
+  *              order, with IDs and times stored as zigzag deltas from the previous row
+  *              and amounts in whole cents where that is exact; a 4-byte fnv1a of all of
+  *              it closes the file. A typical row takes a quarter of its CSV size.
+  *****************************************************************************************/
+ class RentalArchive {
+ public:
+     struct Segment {
+         string file;            // Name within the data directory.
+         int month;              // YYYYMM the rentals closed in.
+         int minRentalId;
+         int maxRentalId;
+         int maxPaymentId;       // 0 if the segment has no payments.
+         size_t rentals;
+         size_t payments;
+         double billed;
+         double paid;
+         
+         string toString() const {
+             return file + "," + to_string(month) + "," + to_string(minRentalId) + "," + to_string(maxRentalId) + "," +
+                    to_string(maxPaymentId) + "," + to_string(rentals) + "," + to_string(payments) + "," +
+                    formatCsvDouble(billed) + "," + formatCsvDouble(paid);
+         }
+         
+         static bool parse(string_view line, Segment& segment) {
+             segment.file = string(nextCsvField(line));
+             int rentalCount = 0, paymentCount = 0;
+             bool ok = !segment.file.empty() && parseCsvInt(nextCsvField(line), segment.month) &&
+                       parseCsvInt(nextCsvField(line), segment.minRentalId) && parseCsvInt(nextCsvField(line), segment.maxRentalId) &&
+                       parseCsvInt(nextCsvField(line), segment.maxPaymentId) && parseCsvInt(nextCsvField(line), rentalCount) &&
+                       parseCsvInt(nextCsvField(line), paymentCount) && parseCsvDouble(nextCsvField(line), segment.billed) &&
+                       parseCsvDouble(nextCsvField(line), segment.paid);
+             segment.rentals = rentalCount;
+             segment.payments = paymentCount;
+             return ok;
+         }
+     };
+ 
+ private:
+     static constexpr char Magic[8] = {'C', 'R', 'A', 'R', 'C', 'H', '0', '1'};
+     
+     string directory;
+     string manifestPath;
+     vector<Segment> segments;
+     int nextSequence;
+     // The most recently decoded segment, for runs of lookups that land in it.
+     mutable int cachedSegment;
+     mutable vector<Rental> cachedRentals;
+     mutable vector<Payment> cachedPayments;
+     
+     static void putVarint(string& out, uint64_t value) {
+         while(value >= 0x80) {
+             out += static_cast<char>(value | 0x80);
+             value >>= 7;
+         }
+         out += static_cast<char>(value);
+     }
+     
+     static void putSigned(string& out, int64_t value) {
+         putVarint(out, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+     }
+     
+     // Whole cents as an even varint when that round-trips exactly; otherwise an odd
+     // marker followed by the raw 8-byte double.
+     static void putAmount(string& out, double value) {
+         if(value > -1e15 && value < 1e15) {
+             int64_t cents = static_cast<int64_t>(value * 100 + (value < 0 ? -0.5 : 0.5));
+             if(cents / 100.0 == value) {
+                 putVarint(out, ((static_cast<uint64_t>(cents) << 1) ^ static_cast<uint64_t>(cents >> 63)) << 1);
+                 return;
+             }
+         }
+         putVarint(out, 1);
+         char bytes[sizeof(double)];
+         memcpy(bytes, &value, sizeof(bytes));
+         out.append(bytes, sizeof(bytes));
+     }
+     
+     static void putString(string& out, const string& value) {
+         putVarint(out, value.size());
+         out += value;
+     }
+     
+     // The readers consume from the front of in and return false if it runs out.
+     static bool getVarint(string_view& in, uint64_t& value) {
+         value = 0;
+         for (int shift = 0; shift < 64 && !in.empty(); shift += 7) {
+             uint8_t byte = static_cast<uint8_t>(in.front());
+             in.remove_prefix(1);
+             value |= uint64_t(byte & 0x7F) << shift;
+             if(!(byte & 0x80)) {
+                 return true;
+             }
+         }
+         return false;
+     }
+     
+     static bool getSigned(string_view& in, int64_t& value) {
+         uint64_t raw;
+         if(!getVarint(in, raw)) {
+             return false;
+         }
+         value = static_cast<int64_t>(raw >> 1) ^ -static_cast<int64_t>(raw & 1);
+         return true;
+     }
+     
+     static bool getAmount(string_view& in, double& value) {
+         uint64_t raw;
+         if(!getVarint(in, raw)) {
+             return false;
+         }
+         if(raw & 1) {
+             if(in.size() < sizeof(double)) {
+                 return false;
+             }
+             memcpy(&value, in.data(), sizeof(double));
+             in.remove_prefix(sizeof(double));
+             return true;
+         }
+         raw >>= 1;
+         value = (static_cast<int64_t>(raw >> 1) ^ -static_cast<int64_t>(raw & 1)) / 100.0;
+         return true;
+     }
+     
+     static bool getStrings(string_view& in, vector<string>& values) {
+         uint64_t count, length;
+         if(!getVarint(in, count) || count > in.size()) {
+             return false;
+         }
+         values.resize(count);
+         for (string& value : values) {
+             if(!getVarint(in, length) || length > in.size()) {
+                 return false;
+             }
+             value.assign(in.data(), length);
+             in.remove_prefix(length);
+         }
+         return true;
+     }
+     
+     bool saveManifest() const {
+         string text;
+         for (const Segment& segment : segments) {
+             text += segment.toString() + "\n";
+         }
+         return writeFileAtomically(manifestPath, [&text](FILE* file) {
+             return fwrite(text.data(), 1, text.size(), file) == text.size();
+         });
+     }
+ 
+ public:
+     // The archive kept in dataDirectory (see CarRentalSystem).
+     explicit RentalArchive(const string& dataDirectory)
+         : directory(dataDirectory), manifestPath(dataDirectory + "archive.txt"), nextSequence(1), cachedSegment(-1) {}
+     
+     // Reads the manifest; no manifest yet is an empty archive.
+     void load() {
+         segments.clear();
+         cachedSegment = -1;
+         nextSequence = 1;
+         ifstream in(manifestPath);
+         string line;
+         while(getline(in, line)) {
+             Segment segment;
+             if(!line.empty() && line.back() == '\r') {
+                 line.pop_back();
+             }
+             if(!line.empty() && Segment::parse(line, segment)) {
+                 add(segment);
+             }
+         }
+     }
+     
+     const vector<Segment>& list() const { return segments; }
+     
+     bool contains(const string& file) const {
+         for (const Segment& segment : segments) {
+             if(segment.file == file) return true;
+         }
+         return false;
+     }
+     
+     // Registers a segment in memory only; commit() makes the manifest match.
+     void add(const Segment& segment) {
+         segments.push_back(segment);
+         // Segment names end in "-<sequence>.seg".
+         size_t dash = segment.file.rfind('-');
+         int sequence = 0;
+         if(dash != string::npos && parseCsvInt(string_view(segment.file).substr(dash + 1, segment.file.size() - dash - 5), sequence)) {
+             nextSequence = max(nextSequence, sequence + 1);
+         }
+     }
+     
+     bool commit() const { return saveManifest(); }
+     
+     int maxRentalId() const {
+         int id = 0;
+         for (const Segment& segment : segments) id = max(id, segment.maxRentalId);
+         return id;
+     }
+     
+     int maxPaymentId() const {
+         int id = 0;
+         for (const Segment& segment : segments) id = max(id, segment.maxPaymentId);
+         return id;
+     }
+     
+     // Encodes rentals (all closed, sorted by ID) and their payments (sorted by ID) as a
+     // new segment for month, writes it durably and describes it in segment. The segment
+     // is not part of the archive until add() and commit().
+     bool write(int month, const vector<Rental>& rentals, const vector<Payment>& payments, Segment& segment) {
+         char name[48];
+         snprintf(name, sizeof(name), "archive-%04d-%02d-%06d.seg", month / 100, month % 100, nextSequence++);
+         segment = Segment{name, month, rentals.front().getRentalId(), rentals.back().getRentalId(),
+                           payments.empty() ? 0 : payments.back().getPaymentId(), rentals.size(), payments.size(), 0.0, 0.0};
+         
+         string out(Magic, sizeof(Magic));
+         vector<string> plates, methods;
+         unordered_map<uint32_t, uint64_t> plateIndex, methodIndex;
+         for (const Rental& rental : rentals) {
+             if(plateIndex.emplace(rental.getCarId(), plates.size()).second) plates.push_back(rental.getCarLicense());
+         }
+         for (const Payment& payment : payments) {
+             if(methodIndex.emplace(payment.getMethodId(), methods.size()).second) methods.push_back(payment.getPaymentMethod());
+         }
+         putVarint(out, plates.size());
+         for (const string& plate : plates) putString(out, plate);
+         putVarint(out, methods.size());
+         for (const string& method : methods) putString(out, method);
+         
+         putVarint(out, rentals.size());
+         int64_t previousId = 0;
+         Timestamp previousStart = 0;
+         for (const Rental& rental : rentals) {
+             putSigned(out, rental.getRentalId() - previousId);
+             putSigned(out, rental.getCustomerId());
+             putVarint(out, plateIndex[rental.getCarId()]);
+             putSigned(out, rental.getRentalStart() - previousStart);
+             putSigned(out, rental.getRentalEnd() - rental.getRentalStart());
+             putAmount(out, rental.getTotalCost());
+             putSigned(out, rental.hasBooking() ? rental.getBookedFrom() - dayOfTimestamp(rental.getRentalStart()) : 0);
+             putSigned(out, rental.getBookedTo() - rental.getBookedFrom());
+             previousId = rental.getRentalId();
+             previousStart = rental.getRentalStart();
+             segment.billed += rental.getTotalCost();
+         }
+         
+         putVarint(out, payments.size());
+         previousId = 0;
+         int64_t previousRentalId = 0;
+         Timestamp previousDate = 0;
+         for (const Payment& payment : payments) {
+             putSigned(out, payment.getPaymentId() - previousId);
+             putSigned(out, payment.getRentalId() - previousRentalId);
+             putAmount(out, payment.getAmount());
+             putVarint(out, methodIndex[payment.getMethodId()]);
+             putSigned(out, payment.getPaymentDate() - previousDate);
+             previousId = payment.getPaymentId();
+             previousRentalId = payment.getRentalId();
+             previousDate = payment.getPaymentDate();
+             segment.paid += payment.getAmount();
+         }
+         uint32_t checksum = fnv1a(out);
+         out.append(reinterpret_cast<const char*>(&checksum), sizeof(checksum));
+         
+         return writeFileAtomically(directory + segment.file, [&out](FILE* file) {
+             return fwrite(out.data(), 1, out.size(), file) == out.size();
+         });
+     }
+     
+     // Decodes the segment stored in file; false if it is missing or damaged.
+     bool read(const string& file, vector<Rental>& rentals, vector<Payment>& payments) const {
+         rentals.clear();
+         payments.clear();
+         MappedFile mapped;
+         if(!mapped.open(directory + file) || mapped.size() < sizeof(Magic) + sizeof(uint32_t)) {
+             return false;
+         }
+         string_view in(mapped.data(), mapped.size() - sizeof(uint32_t));
+         uint32_t checksum;
+         memcpy(&checksum, mapped.data() + in.size(), sizeof(checksum));
+         if(memcmp(in.data(), Magic, sizeof(Magic)) != 0 || fnv1a(in) != checksum) {
+             return false;
+         }
+         in.remove_prefix(sizeof(Magic));
+         vector<string> plates, methods;
+         uint64_t count, index;
+         if(!getStrings(in, plates) || !getStrings(in, methods) || !getVarint(in, count) || count > in.size()) {
+             return false;
+         }
+         rentals.reserve(count);
+         int64_t id = 0;
+         Timestamp start = 0;
+         double amount;
+         for (uint64_t i = 0; i < count; i++) {
+             int64_t idDelta, customerId, startDelta, duration, fromOffset, booked;
+             if(!getSigned(in, idDelta) || !getSigned(in, customerId) || !getVarint(in, index) || index >= plates.size() ||
+                !getSigned(in, startDelta) || !getSigned(in, duration) || !getAmount(in, amount) ||
+                !getSigned(in, fromOffset) || !getSigned(in, booked)) {
+                 return false;
+             }
+             id += idDelta;
+             start += startDelta;
+             int from = booked > 0 ? dayOfTimestamp(start) + static_cast<int>(fromOffset) : 0;
+             rentals.emplace_back(static_cast<int>(id), static_cast<int>(customerId), plates[index], start, start + duration,
+                                  amount, from, booked > 0 ? from + static_cast<int>(booked) : 0);
+         }
+         if(!getVarint(in, count) || count > in.size()) {
+             return false;
+         }
+         payments.reserve(count);
+         int64_t rentalId = 0;
+         Timestamp date = 0;
+         id = 0;
+         for (uint64_t i = 0; i < count; i++) {
+             int64_t idDelta, rentalDelta, dateDelta;
+             if(!getSigned(in, idDelta) || !getSigned(in, rentalDelta) || !getAmount(in, amount) ||
+                !getVarint(in, index) || index >= methods.size() || !getSigned(in, dateDelta)) {
+                 return false;
+             }
+             id += idDelta;
+             rentalId += rentalDelta;
+             date += dateDelta;
+             payments.emplace_back(static_cast<int>(id), static_cast<int>(rentalId), amount, methods[index], date);
+         }
+         return in.empty();
+     }
+     
+     // Finds an archived rental by ID, with the total paid against it. Only segments whose
+     // ID range covers rentalId are decoded; the last one decoded is kept for next time.
+     bool findRental(int rentalId, Rental& rental, double& paid) const {
+         for (size_t s = 0; s < segments.size(); s++) {
+             const Segment& segment = segments[s];
+             if(rentalId < segment.minRentalId || rentalId > segment.maxRentalId) {
+                 continue;
+             }
+             if(cachedSegment != static_cast<int>(s)) {
+                 cachedSegment = -1;
+                 if(!read(segment.file, cachedRentals, cachedPayments)) {
+                     continue;
+                 }
+                 cachedSegment = static_cast<int>(s);
+             }
+             auto it = lower_bound(cachedRentals.begin(), cachedRentals.end(), rentalId,
+                                   [](const Rental& r, int id) { return r.getRentalId() < id; });
+             if(it != cachedRentals.end() && it->getRentalId() == rentalId) {
+                 rental = *it;
+                 paid = 0.0;
+                 for (const Payment& payment : cachedPayments) {
+                     if(payment.getRentalId() == rentalId) paid += payment.getAmount();
+                 }
+                 return true;
+             }
+         }
+         return false;
+     }
+     
+     // Decodes the segments one at a time, in the order they were archived, and passes
+     // each to visit.
+     void forEachSegment(const function<void(const vector<Rental>&, const vector<Payment>&)>& visit) const {
+         forEachSegment(segments, visit);
+     }
+     
+     // The same over a copy of list() taken earlier. Segment files are never rewritten or
+     // deleted, so this needs no lock.
+     void forEachSegment(const vector<Segment>& list, const function<void(const vector<Rental>&, const vector<Payment>&)>& visit) const {
+         vector<Rental> rentals;
+         vector<Payment> payments;
+         for (const Segment& segment : list) {
+             if(read(segment.file, rentals, payments)) {
+                 visit(rentals, payments);
+             }
+         }
+     }
+ };
+ 
+ /*****************************************************************************************
+  * Class: ReportSink
+  * Description: Where a report's rows go: the console, a text file or a CSV file. Rows are
+  *              formatted straight into a buffer that is written out in blocks of
+  *              FlushBytes, so a report of millions of rows takes a few hundred writes
+  *              instead of a flush per line, and memory stays flat however long it runs.
+  *              Text pads each field to its column's width (negative widths align left,
+  *              as in printf); CSV quotes the fields that need it. On an interactive
+  *              console the output pauses every PageRows rows. Once the user stops it or a
+  *              write fails, row() returns false and the producer should stop.
+  *****************************************************************************************/
+ class ReportSink {
+ public:
+     struct Column {
+         const char* name;
+         int width;
+     };
+     static const size_t PageRows = 40;
+     
+ private:
+     static const size_t FlushBytes = 1 << 20;
+     ofstream file;
+     ostream* out;
+     bool csv;
+     bool paged;
+     vector<Column> columns;
+     size_t column = 0;
+     size_t rowsOnPage = 0;
+     size_t rowCount = 0;
+     bool stopped = false;
+     bool failed = false;
+     string buffer;
+     
+     static bool interactive() {
+ #if defined(_WIN32)
+         return _isatty(_fileno(stdin)) && _isatty(_fileno(stdout));
+ #else
+         return isatty(fileno(stdin)) && isatty(fileno(stdout));
+ #endif
+     }
+     
+     void writeBuffer() {
+         if(!buffer.empty() && !failed) {
+             out->write(buffer.data(), buffer.size());
+             out->flush();
+             failed = !*out;
+         }
+         buffer.clear();
+     }
+     
+     void put(string_view value) {
+         if(csv) {
+             if(column != 0) buffer += ',';
+             if(value.find_first_of(",\"\n") == string_view::npos) {
+                 buffer.append(value);
+             } else {
+                 buffer += '"';
+                 for (char c : value) {
+                     if(c == '"') buffer += '"';
+                     buffer += c;
+                 }
+                 buffer += '"';
+             }
+         } else {
+             int width = column < columns.size() ? columns[column].width : 0;
+             size_t span = static_cast<size_t>(width < 0 ? -width : width);
+             size_t pad = span > value.size() ? span - value.size() : 0;
+             if(column != 0) buffer += "  ";
+             if(width > 0) buffer.append(pad, ' ');
+             buffer.append(value);
+             if(width < 0 && column + 1 < columns.size()) buffer.append(pad, ' ');
+         }
+         column++;
+     }
+     
+ public:
+     // The console, paged when both ends of it are a terminal.
+     ReportSink() : out(&cout), csv(false), paged(interactive()) {
+         buffer.reserve(FlushBytes + 4096);
+         if(paged) {
+             // The menu reads with >>, which leaves the end of the line behind.
+             cin.ignore(numeric_limits<streamsize>::max(), '\n');
+         }
+     }
+     
+     // A file: CSV when its name ends in ".csv", else text.
+     explicit ReportSink(const string& path) : file(path, ios::binary | ios::trunc), out(&file), paged(false) {
+         csv = path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+         buffer.reserve(FlushBytes + 4096);
+         failed = !file;
+     }
+     
+     ~ReportSink() { finish(); }
+     
+     ReportSink(const ReportSink&) = delete;
+     ReportSink& operator=(const ReportSink&) = delete;
+     
+     bool isOpen() const { return !failed; }
+     size_t rows() const { return rowCount; }
+     
+     // Starts a table: its title (text only) and a line of column headings.
+     void table(string_view title, vector<Column> heading) {
+         columns = move(heading);
+         if(!csv) {
+             buffer.append(title);
+             buffer += '\n';
+         }
+         for (const Column& entry : columns) {
+             put(entry.name);
+         }
+         buffer += '\n';
+         column = 0;
+     }
+     
+     // A line of text after a table, such as its totals; not part of CSV output.
+     void note(string_view text) {
+         if(!csv) {
+             buffer.append(text);
+             buffer += '\n';
+         }
+     }
+     
+     ReportSink& field(string_view value) {
+         put(value);
+         return *this;
+     }
+     
+     ReportSink& field(int64_t value) {
+         char text[24];
+         put(string_view(text, to_chars(text, text + sizeof(text), value).ptr - text));
+         return *this;
+     }
+     
+     // An amount of money, with two decimals.
+     ReportSink& amount(double value) {
+         char text[64];
+         put(string_view(text, to_chars(text, text + sizeof(text), value, chars_format::fixed, 2).ptr - text));
+         return *this;
+     }
+     
+     ReportSink& timestamp(Timestamp when) {
+         char text[24];
+         put(when == NoTimestamp ? string_view("N/A") : string_view(text, formatTimestamp(when, text) - text));
+         return *this;
+     }
+     
+     // Ends the row; false once the output has stopped.
+     bool row() {
+         buffer += '\n';
+         column = 0;
+         rowCount++;
+         if(buffer.size() >= FlushBytes) {
+             writeBuffer();
+         }
+         if(paged && ++rowsOnPage == PageRows && !failed) {
+             writeBuffer();
+             cout << "-- Enter for more, q to stop: " << flush;
+             string answer;
+             stopped = !getline(cin, answer) || (!answer.empty() && (answer[0] == 'q' || answer[0] == 'Q'));
+             rowsOnPage = 0;
+         }
+         return !stopped && !failed;
+     }
+     
+     // Writes what is buffered and closes a file; false if any write failed.
+     bool finish() {
+         writeBuffer();
+         if(file.is_open()) {
+             file.close();
+             failed = failed || file.fail();
+         }
+         return !failed;
+     }
+ };
+ 
+ /*****************************************************************************************
+  * Operation Results
+  * Description: Outcome of the core operations shared by the menu, batch mode and any
+  *              other front end.
+  *****************************************************************************************/
+ enum OpStatus {
+     OpOk,
+     OpDuplicateCar,
+     OpCarNotFound,
+     OpCustomerNotFound,
+     OpCarUnavailable,
+     OpRentalNotFound,
+     OpRentalClosed,
+     OpInvalidArgument,
+     OpNotAllowed
+ };
+ 
+ // Message shown by the interactive menu.
+ const char* opStatusMessage(OpStatus status) {
+     switch(status) {
+         case OpOk: return "Done.";
+         case OpDuplicateCar: return "A car with this license plate already exists!";
+         case OpCarNotFound: return "Car not found!";
+         case OpCustomerNotFound: return "Customer not found!";
+         case OpCarUnavailable: return "Car is not available for rent!";
+         case OpRentalNotFound: return "Rental record not found!";
+         case OpRentalClosed: return "This rental has already been closed!";
+         case OpInvalidArgument: return "Invalid input!";
+         case OpNotAllowed: return "Not allowed here!";
+     }
+     return "Unknown error!";
+ }
+ 
+ // Stable machine-readable code used by batch mode.
+ const char* opStatusCode(OpStatus status) {
+     switch(status) {
+         case OpOk: return "ok";
+         case OpDuplicateCar: return "duplicate-car";
+         case OpCarNotFound: return "car-not-found";
+         case OpCustomerNotFound: return "customer-not-found";
+         case OpCarUnavailable: return "car-unavailable";
+         case OpRentalNotFound: return "rental-not-found";
+         case OpRentalClosed: return "rental-closed";
+         case OpInvalidArgument: return "invalid-argument";
+         case OpNotAllowed: return "not-allowed";
+     }
+     return "unknown";
+ }
+ 
+ /*****************************************************************************************
+  * Class: CarRentalSystem
+  * Description: Orchestrates the entire rental system including data loading/saving,
+  *              car & customer management, rental processing, payment, and reporting.
+  *****************************************************************************************/
+ class CarRentalSystem {
+     // The benchmark harness drives the private lookup functions directly.
+     friend class RentalBenchmark;
+ private:
+     // Records keep their slot for life (see SlotTable), so the indexes below address
+     // them by slot; compactTables() reclaims tombstoned slots.
+     SlotTable<Car> cars;
+     SlotTable<Customer> customers;
+     SlotTable<Rental> rentals;
+     vector<Payment> payments;
+     
+     // The rentals as of one moment, for readers that run without locks: a snapshot of
+     // the active table and the archive segments beside it, pinned together so that
+     // archiving meanwhile neither hides a rental nor shows it twice.
+     struct RentalHistory {
+         SlotTable<Rental> rentals;
+         vector<RentalArchive::Segment> segments;
+     };
+     
+     // File names for storing persistent data.
+     const string carsDataFile;
+     const string customersDataFile;
+     const string rentalsDataFile;
+     const string paymentsDataFile;
+     const string journalDataFile;
+     const string snapshotDataFile;
+     const string reconciliationDataFile;
+     const string pricingDataFile;
+     const string statsDataFile;
+     
+     // Write-ahead journal of mutations made since the last checkpoint.
+     Journal journal;
+     
+     // Settled history moved out of rentals and payments (see archiveRentals()). Read
+     // under rentalsLock; changed only with every table lock held.
+     RentalArchive archive;
+     static const int DefaultArchiveDays = 90;
+     
+     // Longest rental the batch "rent <customer> <plate> <days>" form accepts.
+     static const int MaxRentDays = 3660;
+     
+     // Rate rules behind every quote and bill; read at load and fixed afterwards.
+     PricingEngine pricing;
+     
+     // Worker threads for bulk work such as loading; created on first use.
+     mutable unique_ptr<ThreadPool> workerPool;
+     mutable once_flag workerPoolCreated;
+     
+     // Concurrency control for the public operations, so several front ends (e.g. the
+     // server's workers) can share one system. Structural changes to a table take its
+     // lock exclusively; per-car state (availability, calendar) is guarded by a striped
+     // car lock, so bookings of different cars proceed in parallel. checkpointLock lets
+     // one checkpoint run at a time. Locks are always taken in this order:
+     //     checkpointLock -> carsLock -> customersLock -> car stripe -> rentalsLock -> paymentsLock
+     // The fleet's per-branch shard locks come last, taken inside BranchFleet.
+     static const size_t CarLockStripes = 256;
+     mutex checkpointLock;
+     mutable shared_mutex carsLock;
+     mutable shared_mutex customersLock;
+     mutable mutex carStripes[CarLockStripes];
+     mutable mutex rentalsLock;
+     mutable mutex paymentsLock;
+     
+     int nextCustomerId;
+     int nextRentalId;
+     int nextPaymentId;
+     
+     // True once the binary snapshot is the authoritative store (see convertStorage()).
+     bool usingBinarySnapshot;
+     
+     // Tables changed since they were last written, so a checkpoint can skip the rest.
+     // Set by the mutation primitives, some of which run under a car stripe only.
+     enum DirtyTable : uint32_t { CarsDirty = 1, CustomersDirty = 2, RentalsDirty = 4, PaymentsDirty = 8, AllDirty = 15 };
+     atomic<uint32_t> dirtyTables;
+     
+     // Background jobs (see startMaintenance()); stopped first on destruction.
+     MaintenanceScheduler maintenance;
+     
+     // Primary-key indexes to slots in the tables above, kept in step with every
+     // insert and erase so that lookups stay O(1) as the tables grow. Cars are
+     // indexed by the interned ID of their plate (-1: no such car).
+     vector<int> carIndexByPlate;
+     unordered_map<int, int> customerIndexById;
+     CustomerIndex customerIndex;   // License and text search; guarded by customersLock.
+     unordered_map<int, int> rentalIndexById;
+     
+     // Reservation calendar of each car, by slot in cars.
+     vector<ReservationCalendar> carCalendars;
+     
+     // Secondary indexes over cars for filtered fleet searches, one shard per branch, each
+     // with its own lock. Shards are added only with carsLock held exclusively.
+     BranchFleet fleet;
+     
+     // Running totals for systemStatus(), kept up to date by the mutation primitives and
+     // recomputed by rebuildIndexes(), so reporting them never scans the history. Each is
+     // guarded by the lock of the table it summarises; rentedCars changes under a car
+     // stripe and is therefore atomic.
+     struct PaymentTotal {
+         size_t count;
+         double amount;
+     };
+     double totalBilled;
+     double totalPaid;
+     size_t openRentals;
+     atomic<size_t> rentedCars;
+     vector<PaymentTotal> paymentTotalsByMethod;   // Indexed by interned method ID.
+     
+     // Payment ledger: amount paid so far against each rental, by rental ID (guarded by
+     // paymentsLock). A rental's balance is its total cost minus this.
+     unordered_map<int, double> paidByRental;
+     
+     // Finds the index of a car by its license plate.
+     int findCarIndex(const string &license) {
+         ProbeTimer timer(ProbeFindCar, Instrumentation::LookupSampleEvery);
+         uint32_t plateId;
+         return licensePlates.lookup(license, plateId) ? findCarIndex(plateId) : -1;
+     }
+     
+     // Finds the index of a car by the interned ID of its plate (e.g. Rental::getCarId()).
+     int findCarIndex(uint32_t plateId) {
+         return plateId < carIndexByPlate.size() ? carIndexByPlate[plateId] : -1;
+     }
+     
+     // Finds the index of a customer by ID.
+     int findCustomerIndex(int id) {
+         ProbeTimer timer(ProbeFindCustomer, Instrumentation::LookupSampleEvery);
+         auto it = customerIndexById.find(id);
+         return it == customerIndexById.end() ? -1 : it->second;
+     }
+     
+     // Finds the index of a rental by rental ID.
+     int findRentalIndex(int rentalId) {
+         ProbeTimer timer(ProbeFindRental, Instrumentation::LookupSampleEvery);
+         auto it = rentalIndexById.find(rentalId);
+         return it == rentalIndexById.end() ? -1 : it->second;
+     }
+     
+     void indexCar(size_t pos) {
+         uint32_t plateId = cars[pos].getPlateId();
+         if(plateId >= carIndexByPlate.size()) {
+             carIndexByPlate.resize(max<size_t>(plateId + 1, carIndexByPlate.size() * 2), -1);
+         }
+         carIndexByPlate[plateId] = static_cast<int>(pos);
+     }
+     
+     // Refiles every car in a fresh fleet index, with no free positions.
+     void rebuildFleet() {
+         fleet.clear();
+         for (size_t i = 0; i < cars.slotCount(); i++) {
+             if(cars.isLive(i)) {
+                 fleet.insert(i, cars[i]);
+             }
+         }
+     }
+     
+     // Points the primary-key indexes and the fleet index at the current slots, in one
+     // pass over each table.
+     void reindexTables() {
+         carIndexByPlate.clear();
+         customerIndexById.clear();
+         rentalIndexById.clear();
+         carIndexByPlate.reserve(licensePlates.size());
+         customerIndexById.reserve(customers.size());
+         rentalIndexById.reserve(rentals.size());
+         for (size_t i = 0; i < cars.slotCount(); i++) {
+             if(cars.isLive(i)) {
+                 indexCar(i);
+             }
+         }
+         rebuildFleet();
+         customerIndex.clear();
+         for (size_t i = 0; i < customers.slotCount(); i++) {
+             if(customers.isLive(i)) {
+                 customerIndexById[customers[i].getId()] = i;
+                 customerIndex.insert(i, customers[i]);
+             }
+         }
+         for (size_t i = 0; i < rentals.slotCount(); i++) {
+             if(rentals.isLive(i)) {
+                 rentalIndexById[rentals[i].getRentalId()] = i;
+             }
+         }
+     }
+     
+     // Rebuilds all indexes, calendars and running totals from the tables (used after a
+     // bulk load).
+     void rebuildIndexes() {
+         reindexTables();
+         carCalendars.assign(cars.slotCount(), ReservationCalendar());
+         for (const Rental& rental : rentals) {
+             if(rental.isOpen()) {
+                 bookOnCalendar(rental);
+             }
+         }
+         rebuildMetrics();
+     }
+     
+     // Recomputes the running totals from the tables (one pass after a bulk load).
+     void rebuildMetrics() {
+         totalBilled = 0.0;
+         openRentals = 0;
+         for (const Rental& rental : rentals) {
+             totalBilled += rental.getTotalCost();
+             openRentals += rental.isOpen();
+         }
+         totalPaid = 0.0;
+         paymentTotalsByMethod.clear();
+         paidByRental.clear();
+         for (const Payment& payment : payments) {
+             countPayment(payment);
+         }
+         size_t rented = 0;
+         for (const Car& car : cars) {
+             rented += !car.available();
+         }
+         rentedCars = rented;
+     }
+     
+     // Approximate bytes held by a hash index (bucket array plus one node per entry).
+     template <typename Map>
+     static size_t hashIndexBytes(const Map& index) {
+         return index.bucket_count() * sizeof(void*) +
+                index.size() * (sizeof(typename Map::value_type) + 2 * sizeof(void*));
+     }
+     
+     // Estimated memory use by part, for systemStatus(). Callers hold the table locks.
+     vector<pair<string, size_t>> memoryBreakdown() const {
+         size_t customerStrings = 0;
+         for (const Customer& customer : customers) {
+             customerStrings += customer.heapBytes();
+         }
+         return {
+             {"Cars", cars.memoryUsage()},
+             {"Customers", customers.memoryUsage() + customerStrings},
+             {"Rentals", rentals.memoryUsage()},
+             {"Payments", payments.capacity() * sizeof(Payment)},
+             {"Interned strings", licensePlates.memoryUsage() + carBrands.memoryUsage() +
+                                  carModels.memoryUsage() + paymentMethods.memoryUsage()},
+             {"Indexes", carIndexByPlate.capacity() * sizeof(int) + hashIndexBytes(customerIndexById) +
+                         hashIndexBytes(rentalIndexById) + hashIndexBytes(paidByRental)},
+             {"Customer search", customerIndex.memoryUsage()},
+         };
+     }
+     
+     // Resident set size of the process in bytes, or 0 where it cannot be read.
+     static size_t residentBytes() {
+ #if defined(__linux__)
+         FILE* statm = fopen("/proc/self/statm", "r");
+         unsigned long long pages = 0, resident = 0;
+         if(statm != nullptr) {
+             if(fscanf(statm, "%llu %llu", &pages, &resident) != 2) {
+                 resident = 0;
+             }
+             fclose(statm);
+         }
+         return static_cast<size_t>(resident) * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+ #else
+         return 0;
+ #endif
+     }
+     
+     void countPayment(const Payment& payment) {
+         totalPaid += payment.getAmount();
+         if(payment.getMethodId() >= paymentTotalsByMethod.size()) {
+             paymentTotalsByMethod.resize(payment.getMethodId() + 1, PaymentTotal{0, 0.0});
+         }
+         PaymentTotal& total = paymentTotalsByMethod[payment.getMethodId()];
+         total.count++;
+         total.amount += payment.getAmount();
+         paidByRental[payment.getRentalId()] += payment.getAmount();
+     }
+     
+     // Day range an open rental holds on its car's calendar. Rentals from before bookings
+     // had dates hold the car from their start day until they are returned.
+     static void bookedRange(const Rental& rental, int& from, int& to) {
+         if(rental.hasBooking()) {
+             from = rental.getBookedFrom();
+             to = rental.getBookedTo();
+         } else {
+             from = dayOfTimestamp(rental.getRentalStart());
+             to = ReservationCalendar::OpenEnded;
+         }
+     }
+     
+     void markDirty(uint32_t tables) { dirtyTables.fetch_or(tables, memory_order_relaxed); }
+     
+     // Changes a car's availability and keeps the availability bitmap in step.
+     void setCarAvailability(int carIndex, bool available) {
+         if(cars[carIndex].available() != available) {
+             if(available) rentedCars--; else rentedCars++;
+             markDirty(CarsDirty);
+         }
+         cars.modify(carIndex).setAvailability(available);
+         fleet.setAvailable(carIndex, available);
+     }
+     
+     // Transfers a car to another branch; needs the car's lock, and carsLock held
+     // exclusively if the branch has no shard yet (see BranchFleet::move()).
+     void moveCar(int carIndex, uint32_t branch) {
+         if(cars[carIndex].getBranchId() != branch) {
+             cars.modify(carIndex).setBranchId(branch);
+             fleet.move(carIndex, cars[carIndex]);
+             markDirty(CarsDirty);
+         }
+     }
+     
+     // Final charge for an open rental returned at returnTime: the days actually used,
+     // priced by the rate rules at the daily rate agreed when it was booked. Rentals from
+     // before bookings had dates use the car's current rate, or keep their cost if the car
+     // is gone.
+     double settledCost(const Rental& rental, Timestamp returnTime) {
+         int days = Rental::billableDays(rental.getRentalStart(), returnTime);
+         if(rental.hasBooking()) {
+             int from = rental.getBookedFrom(), to = rental.getBookedTo();
+             if(days == to - from) {
+                 return rental.getTotalCost();
+             }
+             return PricingEngine::roundToCents(rental.getTotalCost() / pricing.factor(from, to) * pricing.factor(from, from + days));
+         }
+         int carIndex = findCarIndex(rental.getCarId());
+         if(carIndex == -1) {
+             return rental.getTotalCost();
+         }
+         int from = dayOfTimestamp(rental.getRentalStart());
+         return pricing.price(cars[carIndex].getRentalPricePerDay(), from, from + days);
+     }
+     
+     void bookOnCalendar(const Rental& rental) {
+         int carIndex = findCarIndex(rental.getCarId());
+         if(carIndex != -1) {
+             int from, to;
+             bookedRange(rental, from, to);
+             carCalendars[carIndex].book(from, to, rental.getRentalId());
+         }
+     }
+     
+     // Callers hold rentalsLock; the pin is one reference per chunk of rentals.
+     RentalHistory pinRentals() const { return RentalHistory{rentals.snapshot(), archive.list()}; }
+     
+     ThreadPool& pool() const {
+         call_once(workerPoolCreated, [this] { workerPool.reset(new ThreadPool()); });
+         return *workerPool;
+     }
+     
+     mutex& carStripe(int carIndex) const { return carStripes[carIndex % CarLockStripes]; }
+     
+     // Queues parsing of every line-aligned chunk of a mapped table file on the pool.
+     // Each chunk parses into its own vector so no synchronisation is needed.
+     template <typename Record>
+     vector<future<vector<Record>>> parseTableAsync(const MappedFile& file) {
+         vector<future<vector<Record>>> parts;
+         for (string_view chunk : file.lineAlignedChunks(pool().size() * 4, 1 << 20)) {
+             parts.push_back(pool().submit([chunk]() mutable {
+                 vector<Record> records;
+                 while(!chunk.empty()) {
+                     size_t eol = chunk.find('\n');
+                     string_view line = chunk.substr(0, eol);
+                     chunk.remove_prefix(eol == string_view::npos ? chunk.size() : eol + 1);
+                     if(!line.empty() && line.back() == '\r') {
+                         line.remove_suffix(1);
+                     }
+                     Record record;
+                     if(!line.empty() && Record::parse(line, record)) {
+                         records.push_back(move(record));
+                     }
+                 }
+                 return records;
+             }));
+         }
+         return parts;
+     }
+     
+     static void appendRecord(vector<Payment>& table, Payment&& record) { table.push_back(move(record)); }
+     template <typename Record>
+     static void appendRecord(SlotTable<Record>& table, Record&& record) { table.insert(move(record)); }
+     
+     // Waits for the chunks queued by parseTableAsync and appends them in file order.
+     template <typename Record, typename Table>
+     static void collectTable(vector<future<vector<Record>>>& parts, Table& table) {
+         vector<vector<Record>> chunks;
+         size_t total = table.size();
+         for (auto& part : parts) {
+             chunks.push_back(part.get());
+             total += chunks.back().size();
+         }
+         table.reserve(total);
+         for (auto& chunk : chunks) {
+             for (Record& record : chunk) {
+                 appendRecord(table, move(record));
+             }
+         }
+     }
+     
+     /*************************************************************************************
+      * Mutation Primitives
+      * Description: The single place each change to the tables is made. Used both by the
+      *              interactive functions (which journal the change) and by journal replay.
+      *              Each primitive is idempotent so a journal that overlaps the snapshot
+      *              (a crash between checkpoint and truncation) replays safely.
+      *************************************************************************************/
+     bool applyAddCar(const Car& car) {
+         if(findCarIndex(car.getPlateId()) != -1) {
+             return false;
+         }
+         rentedCars += !car.available();
+         size_t slot = cars.insert(car);
+         indexCar(slot);
+         if(slot == carCalendars.size()) {
+             carCalendars.push_back(ReservationCalendar());
+         }
+         fleet.insert(slot, car);
+         markDirty(CarsDirty);
+         return true;
+     }
+     
+     bool applyRemoveCar(const string& license) {
+         int index = findCarIndex(license);
+         if(index == -1) {
+             return false;
+         }
+         carIndexByPlate[cars[index].getPlateId()] = -1;
+         rentedCars -= !cars[index].available();
+         fleet.erase(index);
+         carCalendars[index] = ReservationCalendar();
+         cars.erase(index);
+         markDirty(CarsDirty);
+         return true;
+     }
+     
+     bool applyAddCustomer(const Customer& customer) {
+         if(findCustomerIndex(customer.getId()) != -1) {
+             return false;
+         }
+         size_t slot = customers.insert(customer);
+         customerIndexById[customer.getId()] = slot;
+         customerIndex.insert(slot, customer);
+         markDirty(CustomersDirty);
+         nextCustomerId = max(nextCustomerId, customer.getId() + 1);
+         return true;
+     }
+     
+     bool applyRentCar(const Rental& rental) {
+         if(findRentalIndex(rental.getRentalId()) != -1) {
+             return false;
+         }
+         rentalIndexById[rental.getRentalId()] = rentals.insert(rental);
+         markDirty(RentalsDirty);
+         totalBilled += rental.getTotalCost();
+         openRentals += rental.isOpen();
+         nextRentalId = max(nextRentalId, rental.getRentalId() + 1);
+         bookOnCalendar(rental);
+         // A rental picked up when it was made takes the car off the lot (not available);
+         // a reservation does so at its pick-up (see applyPickUp()).
+         int carIndex = findCarIndex(rental.getCarId());
+         if(carIndex != -1 && rental.isPickedUp()) {
+             setCarAvailability(carIndex, false);
+         }
+         return true;
+     }
+     
+     // Hands over the car of an open reservation; false if it is closed or picked up already.
+     bool applyPickUp(int rentalId) {
+         int index = findRentalIndex(rentalId);
+         if(index == -1 || !rentals[index].isOpen() || rentals[index].isPickedUp()) {
+             return false;
+         }
+         rentals.modify(index).markPickedUp();
+         markDirty(RentalsDirty);
+         int carIndex = findCarIndex(rentals[index].getCarId());
+         if(carIndex != -1) {
+             setCarAvailability(carIndex, false);
+         }
+         return true;
+     }
+     
+     // Closes a rental (or cancels a reservation that has not started yet) at returnTime,
+     // charging finalCost, and frees whatever is left of its booking.
+     bool applyReturnCar(int rentalId, Timestamp returnTime, double finalCost) {
+         int index = findRentalIndex(rentalId);
+         if(index == -1 || !rentals[index].isOpen()) {
+             return false;
+         }
+         const Rental& open = rentals[index];
+         int carIndex = findCarIndex(open.getCarId());
+         if(carIndex != -1) {
+             int from, to;
+             bookedRange(open, from, to);
+             carCalendars[carIndex].release(from, rentalId);
+             // Cancelling a reservation that was never picked up leaves the car where it
+             // is; a one-way rental leaves it at its return branch.
+             if(open.isPickedUp()) {
+                 setCarAvailability(carIndex, true);
+                 if(open.isOneWay()) {
+                     moveCar(carIndex, open.getReturnBranchId());
+                 }
+             }
+         }
+         // Update the rental record with the return time and the final charge.
+         totalBilled += finalCost - open.getTotalCost();
+         rentals.modify(index).close(returnTime, finalCost);
+         openRentals--;
+         markDirty(RentalsDirty);
+         return true;
+     }
+     
+     bool applyPayment(const Payment& payment) {
+         // Payment IDs are handed out in increasing order, so anything below the
+         // next ID is already present.
+         if(payment.getPaymentId() < nextPaymentId) {
+             return false;
+         }
+         payments.push_back(payment);
+         nextPaymentId = payment.getPaymentId() + 1;
+         markDirty(PaymentsDirty);
+         countPayment(payment);
+         return true;
+     }
+     
+     // Moves archived rows out of the live tables: registers segments in the archive and
+     // drops the listed rentals (closed ones only) and payments, with their share of the
+     // running totals.
+     bool applyArchive(const vector<RentalArchive::Segment>& segments, const vector<int>& rentalIds, vector<int> paymentIds) {
+         bool added = false;
+         for (const RentalArchive::Segment& segment : segments) {
+             if(!archive.contains(segment.file)) {
+                 archive.add(segment);
+                 added = true;
+             }
+         }
+         if(added && !archive.commit()) {
+             return false;
+         }
+         for (int rentalId : rentalIds) {
+             int index = findRentalIndex(rentalId);
+             if(index == -1 || rentals[index].isOpen()) {
+                 continue;
+             }
+             totalBilled -= rentals[index].getTotalCost();
+             rentalIndexById.erase(rentalId);
+             paidByRental.erase(rentalId);
+             rentals.erase(index);
+             markDirty(RentalsDirty);
+         }
+         sort(paymentIds.begin(), paymentIds.end());
+         auto archived = [this, &paymentIds](const Payment& payment) {
+             if(!binary_search(paymentIds.begin(), paymentIds.end(), payment.getPaymentId())) {
+                 return false;
+             }
+             totalPaid -= payment.getAmount();
+             PaymentTotal& total = paymentTotalsByMethod[payment.getMethodId()];
+             total.count--;
+             total.amount -= payment.getAmount();
+             markDirty(PaymentsDirty);
+             return true;
+         };
+         payments.erase(remove_if(payments.begin(), payments.end(), archived), payments.end());
+         if(payments.size() < payments.capacity() / 2) {
+             payments.shrink_to_fit();
+         }
+         return true;
+     }
+     
+     // Applies one journal record to the in-memory tables.
+     void replayJournalRecord(Journal::Op op, const string& payload) {
+         switch(op) {
+             case Journal::AddCar:
+                 applyAddCar(Car::fromString(payload));
+                 break;
+             case Journal::RemoveCar:
+                 applyRemoveCar(payload);
+                 break;
+             case Journal::AddCustomer:
+                 applyAddCustomer(Customer::fromString(payload));
+                 break;
+             case Journal::RentCar:
+                 applyRentCar(Rental::fromString(payload));
+                 break;
+             case Journal::ReturnCar: {
+                 // <rentalId>,<returnTime>[,<finalCost>]; older journals did not record the
+                 // final cost, which was then always the booked cost.
+                 string_view fields(payload);
+                 int rentalId = 0;
+                 Timestamp returnTime = 0;
+                 double finalCost = 0.0;
+                 if(!parseCsvInt(nextCsvField(fields), rentalId) || !parseTimestamp(nextCsvField(fields), returnTime)) {
+                     break;
+                 }
+                 int index = findRentalIndex(rentalId);
+                 if(fields.empty() || !parseCsvDouble(fields, finalCost)) {
+                     finalCost = index == -1 ? 0.0 : rentals[index].getTotalCost();
+                 }
+                 applyReturnCar(rentalId, returnTime, finalCost);
+                 break;
+             }
+             case Journal::AddPayment:
+                 applyPayment(Payment::fromString(payload));
+                 break;
+             case Journal::PickUp: {
+                 int rentalId = 0;
+                 if(parseCsvInt(payload, rentalId)) {
+                     applyPickUp(rentalId);
+                 }
+                 break;
+             }
+             case Journal::Archive: {
+                 // The rows to drop are read back from the segments; a segment that cannot
+                 // be read leaves its rows in the live tables.
+                 vector<RentalArchive::Segment> segments;
+                 vector<int> rentalIds, paymentIds;
+                 vector<Rental> archivedRentals;
+                 vector<Payment> archivedPayments;
+                 string_view lines(payload);
+                 while(!lines.empty()) {
+                     size_t end = lines.find(';');
+                     string_view line = lines.substr(0, end);
+                     lines.remove_prefix(end == string_view::npos ? lines.size() : end + 1);
+                     RentalArchive::Segment segment;
+                     if(RentalArchive::Segment::parse(line, segment) && archive.read(segment.file, archivedRentals, archivedPayments)) {
+                         segments.push_back(segment);
+                         for (const Rental& rental : archivedRentals) rentalIds.push_back(rental.getRentalId());
+                         for (const Payment& payment : archivedPayments) paymentIds.push_back(payment.getPaymentId());
+                     }
+                 }
+                 applyArchive(segments, rentalIds, paymentIds);
+                 break;
+             }
+         }
+     }
+     
+     // True once a quarter of any table's slots are tombstones, or of the fleet index's
+     // positions are free (cars that left a branch for good on one-way rentals).
+     bool fragmented() const {
+         return cars.tombstones() * 4 > cars.slotCount() || customers.tombstones() * 4 > customers.slotCount() ||
+                rentals.tombstones() * 4 > rentals.slotCount() || fleet.freePositionCount() * 4 > fleet.positionCount();
+     }
+     
+     // Squeezes the tombstones out of the tables, then re-points the calendars and every
+     // index at the new slots in one pass; returns the number of slots reclaimed. Callers
+     // hold every table lock exclusively.
+     size_t compactTables() {
+         size_t reclaimed = cars.tombstones() + customers.tombstones() + rentals.tombstones();
+         if(reclaimed == 0) {
+             // One-way returns free fleet positions without tombstoning any slot.
+             if(fleet.freePositionCount() != 0) {
+                 rebuildFleet();
+             }
+             return 0;
+         }
+         vector<int> carMoves = cars.compact();
+         // Live cars only move down, so moving their calendars in slot order is safe.
+         for (size_t slot = 0; slot < carMoves.size(); slot++) {
+             if(carMoves[slot] != -1 && static_cast<size_t>(carMoves[slot]) != slot) {
+                 carCalendars[carMoves[slot]] = move(carCalendars[slot]);
+             }
+         }
+         carCalendars.resize(cars.slotCount());
+         carCalendars.shrink_to_fit();
+         customers.compact();
+         rentals.compact();
+         reindexTables();
+         return reclaimed;
+     }
+     
+     /*************************************************************************************
+      * Storage back ends used by loadData() / saveData().
+      *************************************************************************************/
+     // Loads the CSV files. Every line-aligned chunk of every table is fanned out to the
+     // worker pool at once, so the tables and the chunks within them load concurrently.
+     void loadCsvTables() {
+         // The mappings must outlive the parse tasks.
+         MappedFile carFile, custFile, rentFile, payFile;
+         carFile.open(carsDataFile);
+         custFile.open(customersDataFile);
+         rentFile.open(rentalsDataFile);
+         payFile.open(paymentsDataFile);
+         
+         auto carParts = parseTableAsync<Car>(carFile);
+         auto custParts = parseTableAsync<Customer>(custFile);
+         auto rentParts = parseTableAsync<Rental>(rentFile);
+         auto payParts = parseTableAsync<Payment>(payFile);
+         
+         collectTable(carParts, cars);
+         collectTable(custParts, customers);
+         collectTable(rentParts, rentals);
+         collectTable(payParts, payments);
+     }
+     
+     // The tables a checkpoint writes: the live ones, or copies taken for a background
+     // save. Tables a CSV checkpoint skips may be null.
+     struct TableSet {
+         const SlotTable<Car>* cars;
+         const SlotTable<Customer>* customers;
+         const SlotTable<Rental>* rentals;
+         const vector<Payment>* payments;
+     };
+     
+     // Writes one CSV table (see writeFileAtomically()), a megabyte per write call rather
+     // than flushing every line.
+     template <typename Table>
+     static bool writeCsvTable(const string& path, const Table& table) {
+         return writeFileAtomically(path, [&table](FILE* file) {
+             const size_t flushBytes = 1 << 20;
+             string buffer;
+             buffer.reserve(flushBytes + 4096);
+             for (const auto& record : table) {
+                 RecordFormat<decay_t<decltype(record)>>::appendCsv(record, buffer);
+                 buffer += '\n';
+                 if(buffer.size() >= flushBytes) {
+                     if(fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size()) {
+                         return false;
+                     }
+                     buffer.clear();
+                 }
+             }
+             return fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+         });
+     }
+     
+     // Writes the tables selected by dirty. Each file is replaced atomically; a crash
+     // between two of them is covered by the journal, which outlives them all.
+     bool saveCsvTables(const TableSet& tables, uint32_t dirty) {
+         return (!(dirty & CarsDirty) || writeCsvTable(carsDataFile, *tables.cars)) &&
+                (!(dirty & CustomersDirty) || writeCsvTable(customersDataFile, *tables.customers)) &&
+                (!(dirty & RentalsDirty) || writeCsvTable(rentalsDataFile, *tables.rentals)) &&
+                (!(dirty & PaymentsDirty) || writeCsvTable(paymentsDataFile, *tables.payments));
+     }
+     
+     // Materializes rows [0, rows) of a snapshot table on the worker pool in fixed-size
+     // chunks; makeRow(row) builds one record straight from the mapped columns.
+     template <typename Record, typename MakeRow>
+     vector<future<vector<Record>>> materializeAsync(size_t rows, MakeRow makeRow) {
+         const size_t chunkRows = 1 << 16;
+         vector<future<vector<Record>>> parts;
+         for (size_t begin = 0; begin < rows; begin += chunkRows) {
+             size_t end = min(rows, begin + chunkRows);
+             parts.push_back(pool().submit([begin, end, makeRow] {
+                 vector<Record> records;
+                 records.reserve(end - begin);
+                 for (size_t row = begin; row < end; row++) {
+                     records.push_back(makeRow(row));
+                 }
+                 return records;
+             }));
+         }
+         return parts;
+     }
+     
+     // Loads all four tables from the memory-mapped binary snapshot.
+     bool loadSnapshotTables(string& error) {
+         using namespace snapshot;
+         SnapshotReader reader;
+         if(!reader.open(snapshotDataFile, error)) {
+             return false;
+         }
+         // Older snapshots may lack trailing columns or hold times as text; see RecordColumns.
+         vector<RecordColumns<Car>::Source> carSources;
+         vector<RecordColumns<Customer>::Source> custSources;
+         vector<RecordColumns<Rental>::Source> rentSources;
+         vector<RecordColumns<Payment>::Source> paySources;
+         if(!RecordColumns<Car>::match(reader, CarsTable, carSources) ||
+            !RecordColumns<Customer>::match(reader, CustomersTable, custSources) ||
+            !RecordColumns<Rental>::match(reader, RentalsTable, rentSources) ||
+            !RecordColumns<Payment>::match(reader, PaymentsTable, paySources)) {
+             error = "unexpected column layout";
+             return false;
+         }
+         const SnapshotReader* r = &reader;
+         
+         auto carParts = materializeAsync<Car>(reader.rowCount(CarsTable), [r, carSources](size_t i) {
+             return RecordColumns<Car>::read(*r, CarsTable, carSources, i);
+         });
+         auto custParts = materializeAsync<Customer>(reader.rowCount(CustomersTable), [r, custSources](size_t i) {
+             return RecordColumns<Customer>::read(*r, CustomersTable, custSources, i);
+         });
+         auto rentParts = materializeAsync<Rental>(reader.rowCount(RentalsTable), [r, rentSources](size_t i) {
+             return RecordColumns<Rental>::read(*r, RentalsTable, rentSources, i);
+         });
+         auto payParts = materializeAsync<Payment>(reader.rowCount(PaymentsTable), [r, paySources](size_t i) {
+             return RecordColumns<Payment>::read(*r, PaymentsTable, paySources, i);
+         });
+         
+         collectTable(carParts, cars);
+         collectTable(custParts, customers);
+         collectTable(rentParts, rentals);
+         collectTable(payParts, payments);
+         return true;
+     }
+     
+     // Writes all four tables to the binary snapshot, one column per record field.
+     bool saveSnapshotTables(const TableSet& tables) {
+         using namespace snapshot;
+         SnapshotWriter writer;
+         
+         // Tombstoned slots are left out, so the tables are written dense.
+         const SlotTable<Car>& cars = *tables.cars;
+         const SlotTable<Customer>& customers = *tables.customers;
+         const SlotTable<Rental>& rentals = *tables.rentals;
+         const vector<Payment>& payments = *tables.payments;
+         const vector<uint32_t> carSlots = cars.liveSlots();
+         const vector<uint32_t> customerSlots = customers.liveSlots();
+         const vector<uint32_t> rentalSlots = rentals.liveSlots();
+         
+         RecordColumns<Car>::write(writer, CarsTable, carSlots.size(),
+                                   [&cars, &carSlots](size_t i) -> const Car& { return cars[carSlots[i]]; });
+         RecordColumns<Customer>::write(writer, CustomersTable, customerSlots.size(),
+                                        [&customers, &customerSlots](size_t i) -> const Customer& { return customers[customerSlots[i]]; });
+         RecordColumns<Rental>::write(writer, RentalsTable, rentalSlots.size(),
+                                      [&rentals, &rentalSlots](size_t i) -> const Rental& { return rentals[rentalSlots[i]]; });
+         RecordColumns<Payment>::write(writer, PaymentsTable, payments.size(),
+                                       [&payments](size_t i) -> const Payment& { return payments[i]; });
+         
+         return writer.writeTo(snapshotDataFile);
+     }
+     
+     // Common tail of every load: derives the next-id counters, indexes the tables and
+     // rolls forward any mutations journaled since the snapshot was taken.
+     void finishLoad() {
+         archive.load();
+         size_t rejectedRules = pricing.load(pricingDataFile);
+         if(rejectedRules != 0) {
+             cout << "Ignored " << rejectedRules << " unreadable line(s) in " << pricingDataFile << "." << endl;
+         }
+         nextRentalId = max(nextRentalId, archive.maxRentalId() + 1);
+         nextPaymentId = max(nextPaymentId, archive.maxPaymentId() + 1);
+         for (const Customer& cust : customers) {
+             nextCustomerId = max(nextCustomerId, cust.getId() + 1);
+         }
+         for (const Rental& rent : rentals) {
+             nextRentalId = max(nextRentalId, rent.getRentalId() + 1);
+         }
+         for (const Payment& pay : payments) {
+             nextPaymentId = max(nextPaymentId, pay.getPaymentId() + 1);
+         }
+         
+         rebuildIndexes();
+         
+         // A retired journal left by an unfinished background checkpoint comes first.
+         auto replay = [this](Journal::Op op, const string& payload) { replayJournalRecord(op, payload); };
+         Journal::replay(Journal::retiredPath(journalDataFile), replay);
+         Journal::replay(journalDataFile, replay);
+         journal.open(journalDataFile);
+     }
+     
+     // Splits a batch line into arguments on whitespace, honouring "double quotes".
+     static void splitBatchArgs(const string& line, vector<string>& args) {
+         args.clear();
+         size_t i = 0;
+         while(i < line.size()) {
+             while(i < line.size() && isspace(static_cast<unsigned char>(line[i]))) i++;
+             if(i >= line.size()) {
+                 break;
+             }
+             string arg;
+             if(line[i] == '"') {
+                 size_t close = line.find('"', i + 1);
+                 arg = line.substr(i + 1, close == string::npos ? string::npos : close - i - 1);
+                 i = close == string::npos ? line.size() : close + 1;
+             } else {
+                 size_t end = i;
+                 while(end < line.size() && !isspace(static_cast<unsigned char>(line[end]))) end++;
+                 arg = line.substr(i, end - i);
+                 i = end;
+             }
+             args.push_back(move(arg));
+         }
+     }
+     
+     // Parses the key=value filters of a batch search (args[first] onwards) into query.
+     static bool parseQueryArgs(const vector<string>& args, CarQuery& query, size_t first = 1) {
+         size_t page = 1;
+         for (size_t i = first; i < args.size(); i++) {
+             size_t eq = args[i].find('=');
+             string key = args[i].substr(0, eq);
+             string value = eq == string::npos ? "" : args[i].substr(eq + 1);
+             int number = 0;
+             bool ok = true;
+             if(key == "branch") query.branch = value;
+             else if(key == "brand") query.brand = value;
+             else if(key == "model") query.model = value;
+             else if(key == "minYear") ok = parseCsvInt(value, query.minYear);
+             else if(key == "maxYear") ok = parseCsvInt(value, query.maxYear);
+             else if(key == "minPrice") ok = parseCsvDouble(value, query.minPrice);
+             else if(key == "maxPrice") ok = parseCsvDouble(value, query.maxPrice);
+             else if(key == "available") query.availableOnly = value != "0";
+             else if(key == "page" || key == "size") {
+                 ok = parseCsvInt(value, number) && number > 0;
+                 (key == "page" ? page : query.limit) = number;
+             }
+             else ok = false;
+             if(!ok) {
+                 return false;
+             }
+         }
+         query.offset = (page - 1) * query.limit;
+         return true;
+     }
+     
+     // Parses report filters: from=YYYY-MM-DD to=YYYY-MM-DD brand=B customer=ID.
+     static bool parseReportFilter(const vector<string>& args, ReportFilter& filter, size_t first) {
+         for (size_t i = first; i < args.size(); i++) {
+             size_t eq = args[i].find('=');
+             string key = args[i].substr(0, eq);
+             string value = eq == string::npos ? "" : args[i].substr(eq + 1);
+             bool ok = true;
+             if(key == "from") ok = parseDate(value, filter.fromDay);
+             else if(key == "to") ok = parseDate(value, filter.toDay);
+             else if(key == "brand") filter.brand = value;
+             else if(key == "customer") ok = parseCsvInt(value, filter.customerId);
+             else ok = false;
+             if(!ok) {
+                 return false;
+             }
+         }
+         return true;
+     }
+     
+     // Checks a file a batch command is to write. Network clients (local false) may not
+     // name files at all, and "-", which the menu takes as the screen, is no file name.
+     static OpStatus checkOutputPath(const string& path, bool local) {
+         return !local ? OpNotAllowed : path == "-" ? OpInvalidArgument : OpOk;
+     }
+     
+     // Executes one parsed batch command; result receives any values to report. local is
+     // false for commands from network clients (see checkOutputPath()).
+     OpStatus runBatchCommand(const vector<string>& args, string& result, bool local) {
+         const string& command = args[0];
+         size_t argc = args.size() - 1;
+         int id = 0, number = 0;
+         double amount = 0.0;
+         if(command == "add-car" && (argc == 5 || argc == 6)) {
+             if(!parseCsvInt(args[4], number) || !parseCsvDouble(args[5], amount)) {
+                 return OpInvalidArgument;
+             }
+             return addCar(args[1], args[2], args[3], number, amount, argc == 6 ? args[6] : string());
+         }
+         if(command == "remove-car" && argc == 1) {
+             return removeCar(args[1]);
+         }
+         if(command == "add-customer" && argc == 3) {
+             result = to_string(addCustomer(args[1], args[2], args[3]));
+             return OpOk;
+         }
+         if(command == "rent" && argc >= 3 && argc <= 5) {
+             int fromDay = todayDayNumber(), toDay = 0;
+             if(!parseCsvInt(args[1], id)) {
+                 return OpInvalidArgument;
+             }
+             // <days> [branch] starts today; <from> <to> [branch] names both dates.
+             int startDay = 0;
+             bool byDays = argc == 3 || (argc == 4 && !parseDate(args[3], startDay));
+             if(byDays) {
+                 if(!parseCsvInt(args[3], number) || number <= 0 || number > MaxRentDays) {
+                     return OpInvalidArgument;
+                 }
+                 toDay = fromDay + number;
+             } else if(!parseDate(args[3], fromDay) || !parseDate(args[4], toDay)) {
+                 return OpInvalidArgument;
+             }
+             size_t branchArg = byDays ? 4 : 5;
+             int rentalId = 0;
+             OpStatus status = rentCar(id, args[2], fromDay, toDay, rentalId, amount, argc >= branchArg ? args[branchArg] : string());
+             if(status == OpOk) {
+                 result = to_string(rentalId) + " " + formatCsvDouble(amount);
+             }
+             return status;
+         }
+         if(command == "return" && argc == 1) {
+             if(!parseCsvInt(args[1], id)) {
+                 return OpInvalidArgument;
+             }
+             OpStatus status = returnCar(id, amount);
+             if(status == OpOk) {
+                 result = formatCsvDouble(amount);
+             }
+             return status;
+         }
+         if(command == "pay" && argc == 3) {
+             if(!parseCsvInt(args[1], id) || !parseCsvDouble(args[2], amount)) {
+                 return OpInvalidArgument;
+             }
+             int paymentId = 0;
+             OpStatus status = processPayment(id, amount, args[3], paymentId);
+             if(status == OpOk) {
+                 result = to_string(paymentId);
+             }
+             return status;
+         }
+         if(command == "search") {
+             CarQuery query;
+             if(!parseQueryArgs(args, query)) {
+                 return OpInvalidArgument;
+             }
+             bool more = false;
+             for (const Car& car : searchCars(query, more)) {
+                 if(!result.empty()) result += ' ';
+                 result += car.getLicensePlate();
+             }
+             return OpOk;
+         }
+         if(command == "quote" && argc >= 2) {
+             // quote <from> <days>[,<days>...] [filters]: the matching cars in fleet order,
+             // as "<count> <plate> <price>[,<price>...] ..." for the requested page.
+             QuoteRequest request;
+             int fromDay = 0;
+             if(!parseDate(args[1], fromDay)) {
+                 return OpInvalidArgument;
+             }
+             string_view lengths(args[2]);
+             while(!lengths.empty()) {
+                 if(!parseCsvInt(nextCsvField(lengths), number) || number <= 0 || number > MaxRentDays) {
+                     return OpInvalidArgument;
+                 }
+                 request.ranges.emplace_back(fromDay, fromDay + number);
+             }
+             if(request.ranges.empty() || !parseQueryArgs(args, request.cars, 3)) {
+                 return OpInvalidArgument;
+             }
+             QuoteGrid grid = move(quotePrices({request})[0]);
+             result = to_string(grid.plateIds.size());
+             size_t end = min(grid.plateIds.size(), request.cars.offset + request.cars.limit);
+             for (size_t car = request.cars.offset; car < end; car++) {
+                 result += ' ';
+                 result += grid.plate(car);
+                 for (size_t range = 0; range < grid.ranges.size(); range++) {
+                     result += range == 0 ? ' ' : ',';
+                     result += formatCsvDouble(grid.amount(car, range));
+                 }
+             }
+             return OpOk;
+         }
+         if(command == "find-customer" && (argc == 1 || argc == 2)) {
+             // find-customer <text> [limit]: IDs of the best matching customers, best first.
+             int limit = 10;
+             if(argc == 2 && (!parseCsvInt(args[2], limit) || limit <= 0)) {
+                 return OpInvalidArgument;
+             }
+             for (const auto& entry : searchCustomers(args[1], limit)) {
+                 if(!result.empty()) result += ' ';
+                 result += to_string(entry.first.getId());
+             }
+             return OpOk;
+         }
+         if(command == "fleet-stats") {
+             CarQuery query;
+             if(!parseQueryArgs(args, query)) {
+                 return OpInvalidArgument;
+             }
+             string cheapest;
+             FleetStats stats = fleetStatistics(query, cheapest);
+             result = to_string(stats.count) + " " + formatCsvDouble(stats.count ? stats.totalPrice / stats.count : 0.0);
+             if(!cheapest.empty()) {
+                 result += " " + cheapest + " " + formatCsvDouble(stats.cheapestPrice);
+             }
+             return OpOk;
+         }
+         if(command == "balance" && argc == 1) {
+             double billed = 0.0, paid = 0.0;
+             if(!parseCsvInt(args[1], id)) {
+                 return OpInvalidArgument;
+             }
+             OpStatus status = rentalBalance(id, billed, paid);
+             if(status == OpOk) {
+                 result = formatCsvDouble(billed) + " " + formatCsvDouble(paid) + " " + formatCsvDouble(billed - paid);
+             }
+             return status;
+         }
+         if(command == "reconcile" && argc <= 1) {
+             if(argc == 1 && checkOutputPath(args[1], local) != OpOk) {
+                 return checkOutputPath(args[1], local);
+             }
+             ReconciliationReport report = reconcilePayments();
+             if(argc == 1) {
+                 ofstream file(args[1]);
+                 if(!file) {
+                     return OpInvalidArgument;
+                 }
+                 writeReconciliation(report, file);
+             }
+             result = to_string(report.underpaid.size()) + " " + to_string(report.overpaid.size()) + " " +
+                      formatCsvDouble(report.totalBilled - report.totalPaid);
+             return OpOk;
+         }
+         if(command == "report" && argc >= 2) {
+             // report <kind> <file> [filters]: writes the report to file (CSV for *.csv).
+             ReportFilter filter;
+             size_t kind = find(ReportKindNames, ReportKindNames + ReportKindCount, args[1]) - ReportKindNames;
+             if(kind == ReportKindCount || !parseReportFilter(args, filter, 3)) {
+                 return OpInvalidArgument;
+             }
+             if(checkOutputPath(args[2], local) != OpOk) {
+                 return checkOutputPath(args[2], local);
+             }
+             ReportSink sink(args[2]);
+             size_t rows = sink.isOpen() ? generateReport(static_cast<ReportKind>(kind), filter, sink) : 0;
+             if(!sink.finish()) {
+                 return OpInvalidArgument;
+             }
+             result = to_string(rows);
+             return OpOk;
+         }
+         if(command == "save" && argc == 0) {
+             return saveData() ? OpOk : OpInvalidArgument;
+         }
+         if(command == "archive" && argc <= 1) {
+             int days = DefaultArchiveDays;
+             size_t archivedRentals = 0, archivedPayments = 0;
+             if((argc == 1 && (!parseCsvInt(args[1], days) || days < 0)) || !archiveRentals(days, archivedRentals, archivedPayments)) {
+                 return OpInvalidArgument;
+             }
+             result = to_string(archivedRentals) + " " + to_string(archivedPayments);
+             return OpOk;
+         }
+         if(command == "stats" && argc <= 1) {
+             if(argc == 1 && checkOutputPath(args[1], local) != OpOk) {
+                 return checkOutputPath(args[1], local);
+             }
+             return writeStats(argc == 1 ? args[1] : statsDataFile) ? OpOk : OpInvalidArgument;
+         }
+         if(command == "compact" && argc == 0) {
+             result = to_string(compact());
+             return OpOk;
+         }
+         return OpInvalidArgument;
+     }
+     
+ public:
+     // Constructor with initial ID settings. Data files live in dataDirectory (which, if
+     // given, must end with a path separator); by default the working directory.
+     explicit CarRentalSystem(const string& dataDirectory = "")
+         : carsDataFile(dataDirectory + "cars.txt"),
+           customersDataFile(dataDirectory + "customers.txt"),
+           rentalsDataFile(dataDirectory + "rentals.txt"),
+           paymentsDataFile(dataDirectory + "payments.txt"),
+           journalDataFile(dataDirectory + "journal.log"),
+           snapshotDataFile(dataDirectory + "rental.snap"),
+           reconciliationDataFile(dataDirectory + "reconciliation.txt"),
+           pricingDataFile(dataDirectory + "pricing.txt"),
+           statsDataFile(dataDirectory + "stats.json"),
+           archive(dataDirectory),
+           nextCustomerId(1), nextRentalId(1), nextPaymentId(1), usingBinarySnapshot(false),
+           dirtyTables(0),
+           totalBilled(0.0), totalPaid(0.0), openRentals(0), rentedCars(0) {
+         // Additional initialization if necessary.
+     }
+     
+     ~CarRentalSystem() { maintenance.stop(); }
+     
+     /*************************************************************************************
+      * loadData()
+      * Description: Loads persisted data for cars, customers, rentals, and payments, from
+      *              the binary snapshot if one exists and from the CSV files otherwise, then
+      *              replays the journal on top and picks up the reservations that are due.
+      *************************************************************************************/
+     void loadData() {
+         ProbeTimer timer(ProbeLoadData);
+         if(MappedFile().open(snapshotDataFile)) {
+             usingBinarySnapshot = true;
+             string error;
+             if(!loadSnapshotTables(error)) {
+                 cout << "Could not read " << snapshotDataFile << " (" << error << "), falling back to CSV files." << endl;
+                 loadCsvTables();
+                 markDirty(AllDirty);
+             }
+         } else {
+             loadCsvTables();
+         }
+         finishLoad();
+         pickUpStartedRentals();
+     }
+     
+     /*************************************************************************************
+      * saveData()
+      * Description: Checkpoint. Saves the current state of cars, customers, rentals, and
+      *              payments to the snapshot files, then truncates the journal. Only the
+      *              tables changed since the last checkpoint are written (in binary mode,
+      *              the snapshot is skipped if nothing changed).
+      *************************************************************************************/
+     bool saveData() {
+         ProbeTimer timer(ProbeSaveData);
+         lock_guard<mutex> checkpointGuard(checkpointLock);
+         // Quiesce every writer so the checkpoint and the journal truncation agree.
+         unique_lock<shared_mutex> carsGuard(carsLock);
+         unique_lock<shared_mutex> customersGuard(customersLock);
+         lock_guard<mutex> rentalsGuard(rentalsLock);
+         lock_guard<mutex> paymentsGuard(paymentsLock);
+         return checkpoint();
+     }
+     
+     /*************************************************************************************
+      * archiveRentals()
+      * Description: Moves closed rentals that ended more than days ago and whose balance
+      *              is settled, with their payments, into archive segments (see
+      *              RentalArchive), then checkpoints so the next start loads only the
+      *              active set. archivedRentals and archivedPayments receive the number of
+      *              rows moved. Returns false if a segment could not be written, in which
+      *              case nothing moves.
+      *************************************************************************************/
+     bool archiveRentals(int days, size_t& archivedRentals, size_t& archivedPayments) {
+         lock_guard<mutex> checkpointGuard(checkpointLock);
+         unique_lock<shared_mutex> carsGuard(carsLock);
+         unique_lock<shared_mutex> customersGuard(customersLock);
+         lock_guard<mutex> rentalsGuard(rentalsLock);
+         lock_guard<mutex> paymentsGuard(paymentsLock);
+         archivedRentals = archivedPayments = 0;
+         const double tolerance = 0.005;
+         Timestamp cutoff = currentTimestamp() - int64_t(days) * 86400;
+         
+         // Partition the candidates by the month they closed in (YYYYMM).
+         map<int, pair<vector<Rental>, vector<Payment>>> byMonth;
+         unordered_map<int, int> monthOfRental;
+         for (const Rental& rental : rentals) {
+             if(rental.isOpen() || rental.getRentalEnd() >= cutoff) {
+                 continue;
+             }
+             auto paid = paidByRental.find(rental.getRentalId());
+             double balance = rental.getTotalCost() - (paid == paidByRental.end() ? 0.0 : paid->second);
+             if(balance > tolerance || balance < -tolerance) {
+                 continue;
+             }
+             int y, m, d;
+             civilFromDays(dayOfTimestamp(rental.getRentalEnd()), y, m, d);
+             byMonth[y * 100 + m].first.push_back(rental);
+             monthOfRental[rental.getRentalId()] = y * 100 + m;
+         }
+         if(byMonth.empty()) {
+             return true;
+         }
+         for (const Payment& payment : payments) {
+             auto it = monthOfRental.find(payment.getRentalId());
+             if(it != monthOfRental.end()) {
+                 byMonth[it->second].second.push_back(payment);
+             }
+         }
+         
+         vector<RentalArchive::Segment> segments;
+         vector<int> rentalIds, paymentIds;
+         string record;
+         for (auto& month : byMonth) {
+             vector<Rental>& monthRentals = month.second.first;
+             const vector<Payment>& monthPayments = month.second.second;
+             sort(monthRentals.begin(), monthRentals.end(),
+                  [](const Rental& a, const Rental& b) { return a.getRentalId() < b.getRentalId(); });
+             RentalArchive::Segment segment;
+             if(!archive.write(month.first, monthRentals, monthPayments, segment)) {
+                 return false;
+             }
+             segments.push_back(segment);
+             record += (record.empty() ? "" : ";") + segment.toString();
+             for (const Rental& rental : monthRentals) rentalIds.push_back(rental.getRentalId());
+             for (const Payment& payment : monthPayments) paymentIds.push_back(payment.getPaymentId());
+         }
+         // Once this record is durable the move happens: replay finishes it after a crash.
+         journal.append(Journal::Archive, record);
+         journal.commit();
+         if(!applyArchive(segments, rentalIds, paymentIds)) {
+             return false;
+         }
+         archivedRentals = rentalIds.size();
+         archivedPayments = paymentIds.size();
+         return checkpoint();
+     }
+     
+     void archiveRentals() {
+         int days;
+         cout << "Archive settled rentals closed more than how many days ago? ";
+         cin >> days;
+         size_t archivedRentals = 0, archivedPayments = 0;
+         if(!cin || days < 0) {
+             cout << opStatusMessage(OpInvalidArgument) << endl;
+         } else if(archiveRentals(days, archivedRentals, archivedPayments)) {
+             cout << "Archived " << archivedRentals << " rental(s) and " << archivedPayments << " payment(s)." << endl;
+         } else {
+             cout << "Could not write the archive; nothing was moved." << endl;
+         }
+     }
+     
+ private:
+     // Writes the dirty tables in the current storage format; the snapshot holds every
+     // table, so in binary mode any change rewrites it whole.
+     bool writeTables(const TableSet& tables, uint32_t dirty) {
+         bool ok = usingBinarySnapshot ? saveSnapshotTables(tables) : saveCsvTables(tables, dirty);
+         if(!ok) {
+             cout << "Could not write " << (usingBinarySnapshot ? snapshotDataFile : string("the data files")) << "; journal kept." << endl;
+         }
+         return ok;
+     }
+     
+     // Writes the dirty tables and truncates the journal. Callers hold checkpointLock and
+     // every table lock.
+     bool checkpoint() {
+         // With every writer quiesced, this is also the cheapest moment to compact.
+         if(fragmented()) {
+             compactTables();
+         }
+         uint32_t dirty = dirtyTables.exchange(0);
+         if(dirty != 0 && !writeTables(TableSet{&cars, &customers, &rentals, &payments}, dirty)) {
+             markDirty(dirty);
+             return false;
+         }
+         journal.truncate();
+         return true;
+     }
+     
+     /*************************************************************************************
+      * autosave()
+      * Description: Background checkpoint. The table locks are held only while the dirty
+      *              tables are copied (customers and rentals are snapshotted, which copies
+      *              nothing up front) and the journal is rotated; the files are then written
+      *              from the copies with no lock held, so neither the menu nor the server
+      *              waits on the disk. Mutations made meanwhile go to the fresh journal and
+      *              are dirty again for the next round. The retired journal is deleted once
+      *              the files are in place; if they are not, it is kept (and replayed before
+      *              the journal on the next start).
+      *************************************************************************************/
+     bool autosave() {
+         ProbeTimer timer(ProbeAutosave);
+         lock_guard<mutex> checkpointGuard(checkpointLock);
+         SlotTable<Car> carsCopy;
+         SlotTable<Customer> customersCopy;
+         SlotTable<Rental> rentalsCopy;
+         vector<Payment> paymentsCopy;
+         uint32_t dirty;
+         {
+             unique_lock<shared_mutex> carsGuard(carsLock);
+             unique_lock<shared_mutex> customersGuard(customersLock);
+             lock_guard<mutex> rentalsGuard(rentalsLock);
+             lock_guard<mutex> paymentsGuard(paymentsLock);
+             dirty = dirtyTables.exchange(0);
+             if(dirty == 0) {
+                 return true;
+             }
+             if(fragmented()) {
+                 compactTables();
+             }
+             uint32_t copied = usingBinarySnapshot ? AllDirty : dirty;
+             if(copied & CarsDirty) carsCopy = cars;
+             if(copied & CustomersDirty) customersCopy = customers.snapshot();
+             if(copied & RentalsDirty) rentalsCopy = rentals.snapshot();
+             if(copied & PaymentsDirty) paymentsCopy = payments;
+             if(!journal.rotate()) {
+                 markDirty(dirty);
+                 return false;
+             }
+         }
+         if(!writeTables(TableSet{&carsCopy, &customersCopy, &rentalsCopy, &paymentsCopy}, dirty)) {
+             markDirty(dirty);
+             return false;
+         }
+         journal.discardRetired();
+         return true;
+     }
+     
+     // Rebuilds the primary-key, fleet and calendar indexes and the running totals from
+     // the tables, reclaiming tombstoned slots first.
+     string rebuildIndexesJob() {
+         unique_lock<shared_mutex> carsGuard(carsLock);
+         unique_lock<shared_mutex> customersGuard(customersLock);
+         lock_guard<mutex> rentalsGuard(rentalsLock);
+         lock_guard<mutex> paymentsGuard(paymentsLock);
+         size_t reclaimed = compactTables();
+         rebuildIndexes();
+         return "indexed " + to_string(cars.size()) + " cars, " + to_string(customers.size()) + " customers, " +
+                to_string(rentals.size()) + " rentals; reclaimed " + to_string(reclaimed) + " slot(s)";
+     }
+     
+     // Finds open rentals whose booked period has ended. The rentals lock is taken for
+     // one block of slots at a time, so rentals and returns carry on during the scan.
+     // Picks up every open reservation whose first day has come, unless its car is still
+     // out on an earlier rental (it is retried on the next pass). Each pick-up is
+     // journaled, so replay never has to consult the clock. The scan keeps handles to the
+     // rentals it finds, so a rental archived or compacted away before its pick-up is
+     // noticed rather than mistaken for whatever took its slot.
+     size_t pickUpStartedRentals() {
+         const size_t BlockSlots = 65536;
+         int today = todayDayNumber();
+         vector<pair<SlotTable<Rental>::Handle, uint32_t>> due;   // Rental and its car.
+         for (size_t first = 0;; first += BlockSlots) {
+             lock_guard<mutex> rentalsGuard(rentalsLock);
+             if(first >= rentals.slotCount()) {
+                 break;
+             }
+             for (size_t slot = first; slot < min(first + BlockSlots, rentals.slotCount()); slot++) {
+                 if(rentals.isLive(slot) && rentals[slot].isOpen() && !rentals[slot].isPickedUp() && rentals[slot].getBookedFrom() <= today) {
+                     due.push_back({rentals.handleOf(slot), rentals[slot].getCarId()});
+                 }
+             }
+         }
+         size_t pickedUp = 0;
+         shared_lock<shared_mutex> carsGuard(carsLock);
+         for (const auto& entry : due) {
+             int carIndex = findCarIndex(entry.second);
+             if(carIndex == -1) {
+                 continue;
+             }
+             lock_guard<mutex> carGuard(carStripe(carIndex));
+             lock_guard<mutex> rentalsGuard(rentalsLock);
+             int index = rentals.resolve(entry.first);
+             if(index == -1) {
+                 continue;
+             }
+             int rentalId = rentals[index].getRentalId();
+             if(!carCalendars[carIndex].bookedBefore(rentals[index].getBookedFrom()) && applyPickUp(rentalId)) {
+                 journal.append(Journal::PickUp, to_string(rentalId));
+                 pickedUp++;
+             }
+         }
+         return pickedUp;
+     }
+     
+     string overdueCheckJob(const atomic<bool>& cancelled) {
+         const size_t BlockSlots = 65536;
+         int today = todayDayNumber();
+         vector<int> overdue;
+         for (size_t first = 0;; first += BlockSlots) {
+             if(cancelled) {
+                 return "cancelled";
+             }
+             lock_guard<mutex> rentalsGuard(rentalsLock);
+             if(first >= rentals.slotCount()) {
+                 break;
+             }
+             for (size_t slot = first; slot < min(first + BlockSlots, rentals.slotCount()); slot++) {
+                 if(rentals.isLive(slot) && rentals[slot].isOpen() && rentals[slot].hasBooking() && rentals[slot].getBookedTo() <= today) {
+                     overdue.push_back(rentals[slot].getRentalId());
+                 }
+             }
+         }
+         string result = to_string(overdue.size()) + " overdue rental(s)";
+         for (size_t i = 0; i < overdue.size() && i < 10; i++) {
+             result += (i == 0 ? ": " : ", ") + to_string(overdue[i]);
+         }
+         return overdue.size() > 10 ? result + ", ..." : result;
+     }
+     
+ public:
+     static const int DefaultAutosaveSeconds = 300;
+     static const int OverdueCheckSeconds = 3600;
+     static const int PickUpCheckSeconds = 300;
+     
+     // Starts the periodic background jobs: autosave() every autosaveSeconds (0: never),
+     // pickUpStartedRentals() every five minutes and an overdue check every hour. They
+     // stop when the system is destroyed.
+     void startMaintenance(int autosaveSeconds) {
+         if(autosaveSeconds > 0) {
+             maintenance.schedule("autosave", PriorityHigh, autosaveSeconds, autosaveSeconds, [this](const atomic<bool>&) {
+                 return string(autosave() ? "checkpointed" : "write failed; journal kept");
+             });
+         }
+         maintenance.schedule("pick-up", PriorityNormal, PickUpCheckSeconds, PickUpCheckSeconds, [this](const atomic<bool>&) {
+             return to_string(pickUpStartedRentals()) + " reservation(s) picked up";
+         });
+         maintenance.schedule("overdue check", PriorityLow, 0, OverdueCheckSeconds, [this](const atomic<bool>& cancelled) {
+             return overdueCheckJob(cancelled);
+         });
+     }
+     
+     // Reclaims every tombstoned slot now rather than at the next fragmented checkpoint.
+     size_t compact() {
+         unique_lock<shared_mutex> carsGuard(carsLock);
+         unique_lock<shared_mutex> customersGuard(customersLock);
+         lock_guard<mutex> rentalsGuard(rentalsLock);
+         lock_guard<mutex> paymentsGuard(paymentsLock);
+         return compactTables();
+     }
+     
+     /*************************************************************************************
+      * convertStorage()
+      * Description: One-shot conversion between the CSV files and the binary snapshot.
+      *              Loads the source format (plus any journal), then checkpoints into the
+      *              target format. Once a snapshot exists it is the authoritative store;
+      *              exporting to CSV leaves it in place.
+      *************************************************************************************/
+     bool convertStorage(bool toBinary) {
+         if(toBinary) {
+             loadCsvTables();
+         } else {
+             string error;
+             if(!loadSnapshotTables(error)) {
+                 cout << "Could not read " << snapshotDataFile << ": " << error << endl;
+                 return false;
+             }
+         }
+         finishLoad();
+         if(toBinary) {
+             usingBinarySnapshot = true;
+             markDirty(AllDirty);
+             return saveData();
+         }
+         return saveCsvTables(TableSet{&cars, &customers, &rentals, &payments}, AllDirty);
+     }
+     
+     /*************************************************************************************
+      * Car Management Functions
+      *************************************************************************************/
+     // Adds a new car to the system at branch (DefaultBranch if empty).
+     OpStatus addCar(const string& license, const string& brand, const string& model, int year, double price,
+                     const string& branch = string()) {
+         Car newCar(license, brand, model, year, price, branch);
+         unique_lock<shared_mutex> carsGuard(carsLock);
+         if(!applyAddCar(newCar)) {
+             return OpDuplicateCar;
+         }
+         journal.append(Journal::AddCar, newCar.toString());
+         return OpOk;
+     }
+     
+     void addCar() {
+         string license, brand, model, branch;
+         int year;
+         double price;
+         
+         cout << "Enter License Plate: ";
+         cin >> license;
+         cout << "Enter Brand: ";
+         cin >> brand;
+         cout << "Enter Model: ";
+         cin >> model;
+         cout << "Enter Year: ";
+         cin >> year;
+         cout << "Enter Rental Price Per Day: ";
+         cin >> price;
+         cout << "Enter Branch: ";
+         cin >> branch;
+         
+         OpStatus status = addCar(license, brand, model, year, price, branch);
+         cout << (status == OpOk ? "Car added successfully!" : opStatusMessage(status)) << endl;
      }
      
      // Removes a car from the system.
+     OpStatus removeCar(const string& license) {
+         unique_lock<shared_mutex> carsGuard(carsLock);
+         if(!applyRemoveCar(license)) {
+             return OpCarNotFound;
+         }
+         journal.append(Journal::RemoveCar, license);
+         return OpOk;
+     }
+     
      void removeCar() {
          string license;
          cout << "Enter License Plate of the car to remove: ";
          cin >> license;
-         int index = findCarIndex(license);
-         if(index != -1) {
-             cars.erase(cars.begin() + index);
-             cout << "Car removed successfully!" << endl;
+         OpStatus status = removeCar(license);
+         cout << (status == OpOk ? "Car removed successfully!" : opStatusMessage(status)) << endl;
+     }
+     
+     // Writes all cars to sink as one table.
+     // Lists the fleet one block of cars at a time: each block is copied under the locks
+     // and written out after, so a listing paused on the console holds no lock. (The cars
+     // cannot be snapshotted: availability is written under the per-car locks alone.)
+     void listCars(ReportSink& sink) {
+         const size_t BlockSlots = 4096;
+         sink.table("-------- Car List --------", {{"License Plate", -13}, {"Brand", -12}, {"Model", -12}, {"Year", 4},
+                                                   {"Price/Day", 10}, {"Availability", -13}, {"Branch", -12}});
+         vector<Car> block;
+         for (size_t first = 0;; first += BlockSlots) {
+             block.clear();
+             {
+                 shared_lock<shared_mutex> carsGuard(carsLock);
+                 if(first >= cars.slotCount()) {
+                     break;
+                 }
+                 for (size_t i = first; i < min(cars.slotCount(), first + BlockSlots); i++) {
+                     if(cars.isLive(i)) {
+                         lock_guard<mutex> carGuard(carStripe(i));
+                         block.push_back(cars[i]);
+                     }
+                 }
+             }
+             for (const Car& car : block) {
+                 sink.field(car.getLicensePlate()).field(car.getBrand()).field(car.getModel()).field(int64_t(car.getYear()))
+                     .amount(car.getRentalPricePerDay()).field(car.available() ? "Available" : "Not Available").field(car.getBranch());
+                 if(!sink.row()) {
+                     return;
+                 }
+             }
+         }
+     }
+     
+     void listCars() {
+         ReportSink sink;
+         listCars(sink);
+     }
+     
+     // Runs a filtered fleet search (see BranchFleet::search()) and returns the page of cars.
+     vector<Car> searchCars(const CarQuery& query, bool& more) const {
+         shared_lock<shared_mutex> carsGuard(carsLock);
+         vector<Car> page;
+         for (int index : fleet.search(query, more, pool())) {
+             lock_guard<mutex> carGuard(carStripe(index));
+             page.push_back(cars[index]);
+         }
+         return page;
+     }
+     
+     void searchCars() {
+         CarQuery query;
+         string branch, brand, model;
+         int page;
+         cout << "Enter Branch (* for any): ";
+         cin >> branch;
+         cout << "Enter Brand (* for any): ";
+         cin >> brand;
+         cout << "Enter Model (* for any): ";
+         cin >> model;
+         cout << "Enter Minimum Year (0 for any): ";
+         cin >> query.minYear;
+         cout << "Enter Maximum Price Per Day (0 for any): ";
+         cin >> query.maxPrice;
+         cout << "Enter Page Number: ";
+         cin >> page;
+         query.branch = branch == "*" ? "" : branch;
+         query.brand = brand == "*" ? "" : brand;
+         query.model = model == "*" ? "" : model;
+         if(query.maxPrice <= 0) {
+             query.maxPrice = 1e300;
+         }
+         query.offset = (max(page, 1) - 1) * query.limit;
+         
+         bool more = false;
+         vector<Car> found = searchCars(query, more);
+         cout << "-------- Search Results (page " << max(page, 1) << ") --------" << endl;
+         for (const Car& car : found) {
+             cout << car.getLicensePlate() << "  " << car.getBrand() << " " << car.getModel() << " (" << car.getYear()
+                  << ")  $" << car.getRentalPricePerDay() << "/day  " << car.getBranch() << endl;
+         }
+         cout << (found.empty() ? "No matching cars." : more ? "More results on the next page." : "End of results.") << endl;
+     }
+     
+     // Aggregates over the cars matching query; cheapest receives the plate of the
+     // cheapest match (empty if none).
+     FleetStats fleetStatistics(const CarQuery& query, string& cheapest) const {
+         shared_lock<shared_mutex> carsGuard(carsLock);
+         FleetStats stats = fleet.statistics(query, pool());
+         cheapest = stats.cheapest == -1 ? "" : cars[stats.cheapest].getLicensePlate();
+         return stats;
+     }
+     
+     void fleetStatistics() {
+         for (int pass = 0; pass < 2; pass++) {
+             CarQuery query;
+             query.availableOnly = pass == 1;
+             string cheapest;
+             FleetStats stats = fleetStatistics(query, cheapest);
+             cout << (pass == 0 ? "-------- Whole Fleet --------" : "-------- Available Cars --------") << endl;
+             cout << "Cars: " << stats.count << endl;
+             if(stats.count == 0) {
+                 continue;
+             }
+             cout << "Average Price Per Day: $" << stats.totalPrice / stats.count << endl;
+             cout << "Cheapest: " << cheapest << " at $" << stats.cheapestPrice << "/day" << endl;
+             cout << "Cars by Year:" << endl;
+             for (const auto& entry : stats.carsByYear) {
+                 cout << "  " << entry.first << ": " << entry.second << endl;
+             }
+         }
+     }
+     
+     // Answers a batch of quotes under one read lock: for each request, the daily rate of
+     // every matching car times the pricing factor of each of its ranges (see
+     // PricingEngine). These are the amounts rentCar() would bill.
+     vector<QuoteGrid> quotePrices(const vector<QuoteRequest>& requests) const {
+         vector<QuoteGrid> grids(requests.size());
+         vector<double> factors;
+         vector<int> slots;
+         shared_lock<shared_mutex> carsGuard(carsLock);
+         for (size_t i = 0; i < requests.size(); i++) {
+             QuoteGrid& grid = grids[i];
+             grid.ranges = requests[i].ranges;
+             factors.clear();
+             for (const auto& range : grid.ranges) {
+                 factors.push_back(pricing.factor(range.first, range.second));
+             }
+             fleet.quote(requests[i].cars, factors, slots, grid.amounts, pool());
+             grid.plateIds.reserve(slots.size());
+             for (int slot : slots) {
+                 grid.plateIds.push_back(cars[slot].getPlateId());
+             }
+         }
+         return grids;
+     }
+     
+     void quotePrices() {
+         QuoteRequest request;
+         string brand, fromText, line;
+         int fromDay;
+         cout << "Enter Brand (* for any): ";
+         cin >> brand;
+         cout << "Enter Start Date (YYYY-MM-DD or today): ";
+         cin >> fromText;
+         cout << "Enter Rental Lengths in Days (e.g. 1 3 7): ";
+         cin.ignore();
+         getline(cin, line);
+         request.cars.brand = brand == "*" ? "" : brand;
+         if(!parseDate(fromText, fromDay)) {
+             cout << opStatusMessage(OpInvalidArgument) << endl;
+             return;
+         }
+         istringstream lengths(line);
+         int days;
+         while(lengths >> days) {
+             if(days <= 0 || days > MaxRentDays) {
+                 cout << opStatusMessage(OpInvalidArgument) << endl;
+                 return;
+             }
+             request.ranges.emplace_back(fromDay, fromDay + days);
+         }
+         if(request.ranges.empty()) {
+             cout << opStatusMessage(OpInvalidArgument) << endl;
+             return;
+         }
+         
+         auto started = chrono::steady_clock::now();
+         QuoteGrid grid = move(quotePrices({request})[0]);
+         double elapsedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - started).count();
+         pricing.describe(cout);
+         cout << "-------- Quotes from " << formatDate(fromDay) << " (days:";
+         for (const auto& range : grid.ranges) {
+             cout << " " << range.second - range.first;
+         }
+         cout << ") --------" << endl;
+         const size_t shown = 20;
+         for (size_t car = 0; car < grid.plateIds.size() && car < shown; car++) {
+             cout << grid.plate(car);
+             for (size_t range = 0; range < grid.ranges.size(); range++) {
+                 cout << "  $" << grid.amount(car, range);
+             }
+             cout << endl;
+         }
+         if(grid.plateIds.size() > shown) {
+             cout << "... and " << grid.plateIds.size() - shown << " more cars." << endl;
+         }
+         cout << "Quoted " << grid.plateIds.size() << " cars x " << grid.ranges.size() << " lengths in " << elapsedMs << " ms." << endl;
+     }
+     
+     /*************************************************************************************
+      * Customer Management Functions
+      *************************************************************************************/
+     // Adds a new customer and returns the ID assigned to them.
+     int addCustomer(const string& name, const string& driverLicense, const string& contactInfo) {
+         unique_lock<shared_mutex> customersGuard(customersLock);
+         Customer newCustomer(nextCustomerId, name, driverLicense, contactInfo);
+         applyAddCustomer(newCustomer);
+         journal.append(Journal::AddCustomer, newCustomer.toString());
+         return newCustomer.getId();
+     }
+     
+     void addCustomer() {
+         string name, driverLicense, contactInfo;
+         cout << "Enter Customer Name: ";
+         cin.ignore();
+         getline(cin, name);
+         cout << "Enter Driver License Number: ";
+         getline(cin, driverLicense);
+         cout << "Enter Contact Info: ";
+         getline(cin, contactInfo);
+         
+         addCustomer(name, driverLicense, contactInfo);
+         cout << "Customer added successfully!" << endl;
+     }
+     
+     // Writes a snapshot of all customers to sink as one table, so paging through it
+     // never holds up new ones.
+     void listCustomers(ReportSink& sink) {
+         SlotTable<Customer> view;
+         {
+             shared_lock<shared_mutex> customersGuard(customersLock);
+             view = customers.snapshot();
+         }
+         sink.table("-------- Customer List --------", {{"Customer ID", 11}, {"Name", -24}, {"Driver License", -16},
+                                                        {"Contact Info", -24}});
+         for (const Customer& customer : view) {
+             sink.field(int64_t(customer.getId())).field(customer.getName()).field(customer.getDriverLicense())
+                 .field(customer.getContactInfo());
+             if(!sink.row()) {
+                 break;
+             }
+         }
+     }
+     
+     void listCustomers() {
+         ReportSink sink;
+         listCustomers(sink);
+     }
+     
+     // IDs of the customers holding exactly this driver license, in slot order.
+     vector<int> findCustomersByLicense(const string& driverLicense) {
+         shared_lock<shared_mutex> customersGuard(customersLock);
+         vector<int> ids;
+         for (int slot : customerIndex.findLicense(driverLicense, customers)) {
+             ids.push_back(customers[slot].getId());
+         }
+         return ids;
+     }
+     
+     // Up to limit customers for text, best first: exact driver license matches (score
+     // 1), then customers whose name or contact info resembles text (see CustomerIndex).
+     vector<pair<Customer, double>> searchCustomers(const string& text, size_t limit) {
+         ProbeTimer timer(ProbeSearchCustomers);
+         shared_lock<shared_mutex> customersGuard(customersLock);
+         vector<pair<Customer, double>> found;
+         vector<int> licensed = customerIndex.findLicense(text, customers);
+         for (size_t i = 0; i < licensed.size() && found.size() < limit; i++) {
+             found.emplace_back(customers[licensed[i]], 1.0);
+         }
+         for (const CustomerMatch& match : customerIndex.search(text, limit, customers)) {
+             if(found.size() < limit && !binary_search(licensed.begin(), licensed.end(), match.slot)) {
+                 found.emplace_back(customers[match.slot], match.score);
+             }
+         }
+         return found;
+     }
+     
+     void searchCustomers() {
+         string text;
+         cout << "Enter name, driver license or contact info: ";
+         cin.ignore();
+         getline(cin, text);
+         auto start = chrono::steady_clock::now();
+         vector<pair<Customer, double>> found = searchCustomers(text, 10);
+         double elapsedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+         if(found.empty()) {
+             cout << "No matching customers." << endl;
+             return;
+         }
+         cout << "-------- Matching Customers --------" << endl;
+         for (const auto& entry : found) {
+             cout << "Match: " << static_cast<int>(entry.second * 100 + 0.5) << "%" << endl;
+             entry.first.display();
+             cout << "------------------------------------" << endl;
+         }
+         cout << found.size() << " customers shown in " << elapsedMs << " ms." << endl;
+     }
+     
+     /*************************************************************************************
+      * Rental Process Functions
+      *************************************************************************************/
+     // Books a car for the days [fromDay, toDay). A booking starting today is a rental
+     // and takes the car off the lot; a later start is a reservation held on the car's
+     // calendar. On success rentalId and cost describe the new rental.
+     // The check and the booking happen under the car's lock, so two concurrent requests
+     // can never both book the same days of one car. A returnBranch other than the car's
+     // own makes the rental one-way: the car is transferred there when it is returned.
+     OpStatus rentCar(int customerId, const string& license, int fromDay, int toDay, int& rentalId, double& cost,
+                      const string& returnBranch = string()) {
+         ProbeTimer timer(ProbeRentCar);
+         shared_lock<shared_mutex> carsGuard(carsLock);
+         {
+             shared_lock<shared_mutex> customersGuard(customersLock);
+             if(findCustomerIndex(customerId) == -1) {
+                 return OpCustomerNotFound;
+             }
+         }
+         int carIndex = findCarIndex(license);
+         if(carIndex == -1) {
+             return OpCarNotFound;
+         }
+         int today = todayDayNumber();
+         uint32_t returnBranchId = NoBranch;
+         if(fromDay < today || toDay <= fromDay || (!returnBranch.empty() && !findBranchId(returnBranch, returnBranchId))) {
+             return OpInvalidArgument;
+         }
+         lock_guard<mutex> carGuard(carStripe(carIndex));
+         if(returnBranchId == cars[carIndex].getBranchId()) {
+             returnBranchId = NoBranch;
+         }
+         if((fromDay == today && !cars[carIndex].available()) || carCalendars[carIndex].conflicts(fromDay, toDay)) {
+             return OpCarUnavailable;
+         }
+         
+         cost = pricing.price(cars[carIndex].getRentalPricePerDay(), fromDay, toDay);
+         Timestamp startTime = fromDay == today ? currentTimestamp() : int64_t(fromDay) * 86400;
+         lock_guard<mutex> rentalsGuard(rentalsLock);
+         // Until the car is returned, the rental has no end time ("N/A").
+         Rental newRental(nextRentalId, customerId, license, startTime, NoTimestamp, cost, fromDay, toDay, returnBranchId, fromDay == today);
+         applyRentCar(newRental);
+         journal.append(Journal::RentCar, newRental.toString());
+         rentalId = newRental.getRentalId();
+         return OpOk;
+     }
+     
+     void rentCar() {
+         int customerId = 0;
+         string customerText, license, fromText, toText, returnBranch;
+         int fromDay, toDay;
+         
+         // A number is taken as a customer ID, anything else as a driver license.
+         cout << "Enter Customer ID or Driver License: ";
+         cin >> customerText;
+         bool knownId;
+         {
+             shared_lock<shared_mutex> customersGuard(customersLock);
+             knownId = parseCsvInt(customerText, customerId) && findCustomerIndex(customerId) != -1;
+         }
+         if(!knownId) {
+             vector<int> ids = findCustomersByLicense(customerText);
+             if(ids.size() != 1) {
+                 cout << (ids.empty() ? opStatusMessage(OpCustomerNotFound) : "Several customers hold that license:") << endl;
+                 for (const auto& entry : searchCustomers(customerText, 5)) {
+                     cout << "  " << entry.first.getId() << "  " << entry.first.getName() << "  " << entry.first.getDriverLicense() << endl;
+                 }
+                 return;
+             }
+             customerId = ids[0];
+         }
+         
+         cout << "Enter Car License Plate: ";
+         cin >> license;
+         bool knownCar;
+         {
+             shared_lock<shared_mutex> carsGuard(carsLock);
+             knownCar = findCarIndex(license) != -1;
+         }
+         if(!knownCar) {
+             cout << opStatusMessage(OpCarNotFound) << endl;
+             return;
+         }
+         
+         cout << "Enter Start Date (YYYY-MM-DD or today): ";
+         cin >> fromText;
+         cout << "Enter End Date (YYYY-MM-DD, exclusive): ";
+         cin >> toText;
+         if(!parseDate(fromText, fromDay) || !parseDate(toText, toDay)) {
+             cout << opStatusMessage(OpInvalidArgument) << endl;
+             return;
+         }
+         cout << "Enter Return Branch (- for the car's own): ";
+         cin >> returnBranch;
+         if(returnBranch == "-") {
+             returnBranch.clear();
+         }
+         
+         int rentalId = 0;
+         double cost = 0.0;
+         OpStatus status = rentCar(customerId, license, fromDay, toDay, rentalId, cost, returnBranch);
+         if(status != OpOk) {
+             cout << opStatusMessage(status) << endl;
+             return;
+         }
+         cout << (fromDay == todayDayNumber() ? "Car rented successfully!" : "Car reserved successfully!") << endl;
+         cout << "Rental ID: " << rentalId << endl;
+         cout << "Total Cost: $" << cost << endl;
+     }
+     
+     // Returns copies of the cars that are free for the whole of [fromDay, toDay), taken
+     // under carsLock since background compaction may move the slots once it is released.
+     // The fleet is scanned in parallel chunks; each check is O(log n) in the car's bookings.
+     vector<Car> findAvailableCars(int fromDay, int toDay) {
+         shared_lock<shared_mutex> carsGuard(carsLock);
+         bool startsToday = fromDay <= todayDayNumber();
+         auto scan = [this, fromDay, toDay, startsToday](size_t begin, size_t end) {
+             vector<size_t> found;
+             for (size_t i = begin; i < end; i++) {
+                 if(!cars.isLive(i)) {
+                     continue;
+                 }
+                 lock_guard<mutex> carGuard(carStripe(i));
+                 if((!startsToday || cars[i].available()) &&
+                    (carCalendars[i].empty() || !carCalendars[i].conflicts(fromDay, toDay))) {
+                     found.push_back(i);
+                 }
+             }
+             return found;
+         };
+         const size_t chunkCars = 1 << 16;
+         vector<size_t> found;
+         if(cars.slotCount() <= chunkCars) {
+             found = scan(0, cars.slotCount());
+         } else {
+             vector<future<vector<size_t>>> parts;
+             for (size_t begin = 0; begin < cars.slotCount(); begin += chunkCars) {
+                 size_t end = min(cars.slotCount(), begin + chunkCars);
+                 parts.push_back(pool().submit([scan, begin, end] { return scan(begin, end); }));
+             }
+             for (auto& part : parts) {
+                 vector<size_t> chunk = part.get();
+                 found.insert(found.end(), chunk.begin(), chunk.end());
+             }
+         }
+         vector<Car> available;
+         available.reserve(found.size());
+         for (size_t index : found) {
+             available.push_back(cars[index]);
+         }
+         return available;
+     }
+     
+     void listAvailableCars() {
+         string fromText, toText;
+         int fromDay, toDay;
+         cout << "Enter Start Date (YYYY-MM-DD or today): ";
+         cin >> fromText;
+         cout << "Enter End Date (YYYY-MM-DD, exclusive): ";
+         cin >> toText;
+         if(!parseDate(fromText, fromDay) || !parseDate(toText, toDay) || toDay <= fromDay) {
+             cout << opStatusMessage(OpInvalidArgument) << endl;
+             return;
+         }
+         vector<Car> found = findAvailableCars(fromDay, toDay);
+         cout << "-------- Available " << formatDate(fromDay) << " to " << formatDate(toDay) << " --------" << endl;
+         for (const Car& car : found) {
+             cout << car.getLicensePlate() << "  " << car.getBrand() << " " << car.getModel() << " (" << car.getYear()
+                  << ")  $" << car.getRentalPricePerDay() << "/day" << endl;
+         }
+         cout << found.size() << " car(s) available." << endl;
+     }
+     
+     // Processes the return of a rented car.
+     OpStatus returnCar(int rentalId, double& finalCost) {
+         ProbeTimer timer(ProbeReturnCar);
+         // A one-way return moves the car to another shard of the fleet, which locks only
+         // the two shards involved. Only a branch that has never held a car needs
+         // carsLock exclusively, to add its shard. A rental's return branch never
+         // changes, so it can be read ahead of taking carsLock.
+         uint32_t returnBranch = NoBranch;
+         {
+             lock_guard<mutex> rentalsGuard(rentalsLock);
+             int index = findRentalIndex(rentalId);
+             if(index != -1 && rentals[index].isOneWay()) returnBranch = rentals[index].getReturnBranchId();
+         }
+         shared_lock<shared_mutex> carsGuard(carsLock);
+         unique_lock<shared_mutex> carsMoveGuard(carsLock, defer_lock);
+         if(returnBranch != NoBranch && !fleet.hasShard(returnBranch)) {
+             carsGuard.unlock();
+             carsMoveGuard.lock();
+         }
+         uint32_t carId;
+         {
+             lock_guard<mutex> rentalsGuard(rentalsLock);
+             int index = findRentalIndex(rentalId);
+             if(index == -1) {
+                 Rental archived;
+                 double paid;
+                 return archive.findRental(rentalId, archived, paid) ? OpRentalClosed : OpRentalNotFound;
+             }
+             carId = rentals[index].getCarId();
+         }
+         // Take the car's lock before re-locking the rentals (lock order), then close.
+         int carIndex = findCarIndex(carId);
+         unique_lock<mutex> carGuard;
+         if(carIndex != -1) {
+             carGuard = unique_lock<mutex>(carStripe(carIndex));
+         }
+         lock_guard<mutex> rentalsGuard(rentalsLock);
+         int index = findRentalIndex(rentalId);
+         if(!rentals[index].isOpen()) {
+             return OpRentalClosed;
+         }
+         // Close the rental now and bill the days actually used.
+         Timestamp returnTime = currentTimestamp();
+         finalCost = settledCost(rentals[index], returnTime);
+         applyReturnCar(rentalId, returnTime, finalCost);
+         journal.append(Journal::ReturnCar, to_string(rentalId) + "," + formatTimestamp(returnTime) + "," + formatCsvDouble(finalCost));
+         return OpOk;
+     }
+     
+     void returnCar() {
+         int rentalId;
+         cout << "Enter Rental ID for return: ";
+         cin >> rentalId;
+         double finalCost = 0.0;
+         OpStatus status = returnCar(rentalId, finalCost);
+         cout << (status == OpOk ? "Car returned successfully!" : opStatusMessage(status)) << endl;
+         if(status == OpOk) {
+             cout << "Final Cost: $" << finalCost << endl;
+         }
+     }
+     
+     /*************************************************************************************
+      * Payment Functions
+      *************************************************************************************/
+     // Processes a payment for a rental. On success paymentId identifies the payment.
+     OpStatus processPayment(int rentalId, double amount, const string& method, int& paymentId) {
+         ProbeTimer timer(ProbeProcessPayment);
+         // The rental stays locked until the payment is in, so it cannot be archived
+         // in between.
+         lock_guard<mutex> rentalsGuard(rentalsLock);
+         if(findRentalIndex(rentalId) == -1) {
+             // Archived rentals were settled when archived and take no more payments.
+             Rental archived;
+             double paid;
+             return archive.findRental(rentalId, archived, paid) ? OpRentalClosed : OpRentalNotFound;
+         }
+         lock_guard<mutex> paymentsGuard(paymentsLock);
+         Payment newPayment(nextPaymentId, rentalId, amount, method, currentTimestamp());
+         applyPayment(newPayment);
+         journal.append(Journal::AddPayment, newPayment.toString());
+         paymentId = newPayment.getPaymentId();
+         return OpOk;
+     }
+     
+     void processPayment() {
+         int rentalId;
+         double amount;
+         string method;
+         cout << "Enter Rental ID for Payment: ";
+         cin >> rentalId;
+         double billed, paid;
+         if(rentalBalance(rentalId, billed, paid) != OpOk) {
+             cout << opStatusMessage(OpRentalNotFound) << endl;
+             return;
+         }
+         cout << "Enter Payment Amount: ";
+         cin >> amount;
+         cout << "Enter Payment Method (CreditCard/Cash): ";
+         cin >> method;
+         
+         int paymentId = 0;
+         OpStatus status = processPayment(rentalId, amount, method, paymentId);
+         if(status != OpOk) {
+             cout << opStatusMessage(status) << endl;
+             return;
+         }
+         cout << "Payment processed successfully!" << endl;
+         if(rentalBalance(rentalId, billed, paid) == OpOk) {
+             cout << "Remaining Balance: $" << billed - paid << endl;
+         }
+     }
+     
+     // Looks up what a rental has been billed and how much of it has been paid, falling
+     // back to the archive for rentals no longer in the live tables.
+     OpStatus rentalBalance(int rentalId, double& billed, double& paid) {
+         {
+             lock_guard<mutex> rentalsGuard(rentalsLock);
+             int index = findRentalIndex(rentalId);
+             if(index == -1) {
+                 Rental archived;
+                 if(!archive.findRental(rentalId, archived, paid)) {
+                     return OpRentalNotFound;
+                 }
+                 billed = archived.getTotalCost();
+                 return OpOk;
+             }
+             billed = rentals[index].getTotalCost();
+         }
+         lock_guard<mutex> paymentsGuard(paymentsLock);
+         auto it = paidByRental.find(rentalId);
+         paid = it == paidByRental.end() ? 0.0 : it->second;
+         return OpOk;
+     }
+     
+     /*************************************************************************************
+      * reconcilePayments()
+      * Description: Recomputes every rental's balance from the full payment history and
+      *              reports the rentals that are underpaid or overpaid (by more than half a
+      *              cent), the balance of every customer who owes or is owed money, and
+      *              payments that match no rental. Payments and then rentals are processed
+      *              in parallel chunks, accumulating into per-rental and per-customer totals
+      *              with atomic adds, so the pass scales with the number of cores. Archived
+      *              rentals were settled when they were archived and are not revisited.
+      *************************************************************************************/
+     ReconciliationReport reconcilePayments() {
+         ProbeTimer timer(ProbeReconcile);
+         shared_lock<shared_mutex> customersGuard(customersLock);
+         lock_guard<mutex> rentalsGuard(rentalsLock);
+         lock_guard<mutex> paymentsGuard(paymentsLock);
+         const double tolerance = 0.005;
+         const size_t chunkRows = 1 << 20;
+         ReconciliationReport report;
+         
+         // Pass 1: sum the payments of each rental (by slot in rentals).
+         vector<double> paid(rentals.slotCount(), 0.0);
+         vector<future<pair<size_t, double>>> orphanParts;
+         for (size_t begin = 0; begin < payments.size(); begin += chunkRows) {
+             size_t end = min(payments.size(), begin + chunkRows);
+             orphanParts.push_back(pool().submit([this, &paid, begin, end] {
+                 pair<size_t, double> orphans(0, 0.0);
+                 for (size_t i = begin; i < end; i++) {
+                     int index = findRentalIndex(payments[i].getRentalId());
+                     if(index == -1) {
+                         orphans.first++;
+                         orphans.second += payments[i].getAmount();
+                     } else {
+                         atomicAddDouble(&paid[index], payments[i].getAmount());
+                     }
+                 }
+                 return orphans;
+             }));
+         }
+         for (auto& part : orphanParts) {
+             pair<size_t, double> orphans = part.get();
+             report.orphanPayments += orphans.first;
+             report.orphanAmount += orphans.second;
+         }
+         
+         // Pass 2: classify each rental and add its balance to its customer.
+         vector<double> owedByCustomer(customers.slotCount(), 0.0);
+         struct ChunkResult {
+             vector<RentalBalance> underpaid, overpaid;
+             double billed = 0.0, paid = 0.0;
+         };
+         vector<future<ChunkResult>> rentalParts;
+         for (size_t begin = 0; begin < rentals.slotCount(); begin += chunkRows) {
+             size_t end = min(rentals.slotCount(), begin + chunkRows);
+             rentalParts.push_back(pool().submit([this, &paid, &owedByCustomer, begin, end, tolerance] {
+                 ChunkResult result;
+                 for (size_t i = begin; i < end; i++) {
+                     if(!rentals.isLive(i)) {
+                         continue;
+                     }
+                     const Rental& rental = rentals[i];
+                     double balance = rental.getTotalCost() - paid[i];
+                     result.billed += rental.getTotalCost();
+                     result.paid += paid[i];
+                     if(balance > tolerance || balance < -tolerance) {
+                         RentalBalance entry{rental.getRentalId(), rental.getCustomerId(), rental.getTotalCost(), paid[i]};
+                         (balance > 0 ? result.underpaid : result.overpaid).push_back(entry);
+                         int customer = findCustomerIndex(rental.getCustomerId());
+                         if(customer != -1) {
+                             atomicAddDouble(&owedByCustomer[customer], balance);
+                         }
+                     }
+                 }
+                 return result;
+             }));
+         }
+         for (auto& part : rentalParts) {
+             ChunkResult result = part.get();
+             report.underpaid.insert(report.underpaid.end(), result.underpaid.begin(), result.underpaid.end());
+             report.overpaid.insert(report.overpaid.end(), result.overpaid.begin(), result.overpaid.end());
+             report.totalBilled += result.billed;
+             report.totalPaid += result.paid;
+         }
+         report.totalPaid += report.orphanAmount;
+         for (size_t i = 0; i < customers.slotCount(); i++) {
+             if(owedByCustomer[i] > tolerance || owedByCustomer[i] < -tolerance) {
+                 report.customerBalances.emplace_back(customers[i].getId(), owedByCustomer[i]);
+             }
+         }
+         return report;
+     }
+     
+     // Writes the full reconciliation report as text.
+     static void writeReconciliation(const ReconciliationReport& report, ostream& out) {
+         out << fixed << setprecision(2);
+         out << "Total Billed: $" << report.totalBilled << endl;
+         out << "Total Paid: $" << report.totalPaid << endl;
+         out << "Underpaid Rentals: " << report.underpaid.size() << endl;
+         for (const RentalBalance& entry : report.underpaid) {
+             out << "  Rental " << entry.rentalId << " (customer " << entry.customerId << "): billed $"
+                 << entry.billed << ", paid $" << entry.paid << ", owes $" << entry.billed - entry.paid << endl;
+         }
+         out << "Overpaid Rentals: " << report.overpaid.size() << endl;
+         for (const RentalBalance& entry : report.overpaid) {
+             out << "  Rental " << entry.rentalId << " (customer " << entry.customerId << "): billed $"
+                 << entry.billed << ", paid $" << entry.paid << ", credit $" << entry.paid - entry.billed << endl;
+         }
+         out << "Customer Balances: " << report.customerBalances.size() << endl;
+         for (const auto& balance : report.customerBalances) {
+             out << "  Customer " << balance.first << ": " << (balance.second > 0 ? "owes $" : "credit $")
+                 << (balance.second > 0 ? balance.second : -balance.second) << endl;
+         }
+         out << "Unmatched Payments: " << report.orphanPayments << " ($" << report.orphanAmount << ")" << endl;
+         out.unsetf(ios::floatfield);
+         out << setprecision(6);
+     }
+     
+     // Runs the reconciliation, prints a summary and writes the full report to a file.
+     void reconcilePaymentsReport() {
+         ReconciliationReport report = reconcilePayments();
+         cout << "-------- Payment Reconciliation --------" << endl;
+         cout << fixed << setprecision(2);
+         cout << "Underpaid Rentals: " << report.underpaid.size() << endl;
+         cout << "Overpaid Rentals: " << report.overpaid.size() << endl;
+         cout << "Customers With a Balance: " << report.customerBalances.size() << endl;
+         cout << "Unmatched Payments: " << report.orphanPayments << endl;
+         cout << "Outstanding Balance: $" << report.totalBilled - report.totalPaid << endl;
+         cout.unsetf(ios::floatfield);
+         cout << setprecision(6);
+         ofstream file(reconciliationDataFile);
+         if(file) {
+             writeReconciliation(report, file);
+             cout << "Full report written to " << reconciliationDataFile << endl;
          } else {
-             cout << "Car not found!" << endl;
+             cout << "Error writing " << reconciliationDataFile << endl;
          }
      }
      
-     // Lists all cars in the system.
-     void listCars() {
-         cout << "-------- Car List --------" << endl;
-         for (size_t i = 0; i < cars.size(); i++) {
-             cout << "Car " << i+1 << ":" << endl;
-             cars[i].display();
-             cout << "--------------------------" << endl;
+     /*************************************************************************************
+      * Report Generation Functions
+      *************************************************************************************/
+     // Adds the rows of table that pass filter to report, in parallel chunks. Cars and
+     // customers are spread over many cells, updated with atomic adds; each chunk keeps
+     // its own months, which are few and would be contended, and they are merged after.
+     // selectedPlates marks the plates of the filter's brand (empty: any brand).
+     template <typename Table, typename IsRow>
+     void addRevenue(const Table& table, size_t slotCount, IsRow isRow, const ReportFilter& filter,
+                     const vector<char>& selectedPlates, RevenueReport& report) {
+         const size_t chunkRows = 1 << 20;
+         vector<future<map<int, RevenueCell>>> parts;
+         for (size_t begin = 0; begin < slotCount; begin += chunkRows) {
+             size_t end = min(slotCount, begin + chunkRows);
+             parts.push_back(pool().submit([&, begin, end] {
+                 map<int, RevenueCell> months;
+                 int lastDay = numeric_limits<int>::min();
+                 RevenueCell* month = nullptr;
+                 for (size_t i = begin; i < end; i++) {
+                     if(!isRow(i)) {
+                         continue;
+                     }
+                     const Rental& rental = table[i];
+                     int day = dayOfTimestamp(rental.getRentalStart());
+                     uint32_t plate = rental.getCarId();
+                     if(day < filter.fromDay || day >= filter.toDay ||
+                        (filter.customerId != 0 && rental.getCustomerId() != filter.customerId) ||
+                        (!filter.brand.empty() && (plate >= selectedPlates.size() || !selectedPlates[plate]))) {
+                         continue;
+                     }
+                     if(day != lastDay) {
+                         int y, m, d;
+                         civilFromDays(day, y, m, d);
+                         month = &months[y * 12 + m - 1];
+                         lastDay = day;
+                     }
+                     double cost = rental.getTotalCost();
+                     month->rentals++;
+                     month->revenue += cost;
+                     if(plate < report.byCar.size()) {
+                         atomicAddCount(&report.byCar[plate].rentals, 1);
+                         atomicAddDouble(&report.byCar[plate].revenue, cost);
+                     }
+                     size_t customer = static_cast<size_t>(rental.getCustomerId());
+                     if(customer < report.byCustomer.size()) {
+                         atomicAddCount(&report.byCustomer[customer].rentals, 1);
+                         atomicAddDouble(&report.byCustomer[customer].revenue, cost);
+                     }
+                 }
+                 return months;
+             }));
+         }
+         for (auto& part : parts) {
+             for (const auto& entry : part.get()) {
+                 RevenueCell& month = report.byMonth[entry.first];
+                 month.rentals += entry.second.rentals;
+                 month.revenue += entry.second.revenue;
+                 report.total.rentals += entry.second.rentals;
+                 report.total.revenue += entry.second.revenue;
+             }
          }
      }
      
      /*************************************************************************************
-      * Customer Management Functions
+      * revenueReport()
+      * Description: Rentals and revenue per car, customer, brand and month over every
+      *              rental that passes filter. Archived segments are decoded one at a time
+      *              and, like the active rentals, aggregated in parallel chunks, so memory
+      *              stays at one segment plus one cell per car and per customer. The work
+      *              runs on a pinned RentalHistory with no lock held, so bookings, returns
+      *              and archiving carry on meanwhile and the report is unaffected by them.
       *************************************************************************************/
-     // Adds a new customer.
-     void addCustomer() {
-         string name, driverLicense, contactInfo;
-         cout << "Enter Customer Name: ";
-         cin.ignore();
-         getline(cin, name);
-         cout << "Enter Driver License Number: ";
-         getline(cin, driverLicense);
-         cout << "Enter Contact Info: ";
-         getline(cin, contactInfo);
-         
-         Customer newCustomer(nextCustomerId++, name, driverLicense, contactInfo);
-         customers.push_back(newCustomer);
-         cout << "Customer added successfully!" << endl;
+     RevenueReport revenueReport(const ReportFilter& filter) {
+         ProbeTimer timer(ProbeReport);
+         RevenueReport report;
+         vector<char> selectedPlates;
+         vector<pair<uint32_t, uint32_t>> fleetBrands;   // (plate, brand) of every car
+         RentalHistory history;
+         {
+             shared_lock<shared_mutex> carsGuard(carsLock);
+             shared_lock<shared_mutex> customersGuard(customersLock);
+             fleetBrands.reserve(cars.size());
+             for (const Car& car : cars) {
+                 fleetBrands.emplace_back(car.getPlateId(), car.getBrandId());
+             }
+             report.byCustomer.resize(max(nextCustomerId, 0));
+             lock_guard<mutex> rentalsGuard(rentalsLock);
+             history = pinRentals();
+         }
+         if(!filter.brand.empty()) {
+             selectedPlates.assign(licensePlates.size(), 0);
+             for (const auto& car : fleetBrands) {
+                 selectedPlates[car.first] = carBrands.value(car.second) == filter.brand;
+             }
+         }
+         archive.forEachSegment(history.segments, [&](const vector<Rental>& archived, const vector<Payment>&) {
+             // Decoding interns the plates of cars that have since left the fleet.
+             report.byCar.resize(licensePlates.size());
+             addRevenue(archived, archived.size(), [](size_t) { return true; }, filter, selectedPlates, report);
+         });
+         const SlotTable<Rental>& active = history.rentals;
+         report.byCar.resize(licensePlates.size());
+         addRevenue(active, active.slotCount(), [&active](size_t i) { return active.isLive(i); }, filter, selectedPlates, report);
+         report.byBrand.resize(carBrands.size());
+         vector<char> inFleet(report.byCar.size(), 0);
+         for (const auto& car : fleetBrands) {
+             const RevenueCell& cell = report.byCar[car.first];
+             report.byBrand[car.second].rentals += cell.rentals;
+             report.byBrand[car.second].revenue += cell.revenue;
+             inFleet[car.first] = 1;
+         }
+         for (size_t plate = 0; plate < report.byCar.size(); plate++) {
+             if(!inFleet[plate]) {
+                 report.removedCars.rentals += report.byCar[plate].rentals;
+                 report.removedCars.revenue += report.byCar[plate].revenue;
+             }
+         }
+         return report;
      }
      
-     // Lists all customers.
-     void listCustomers() {
-         cout << "-------- Customer List --------" << endl;
-         for (size_t i = 0; i < customers.size(); i++) {
-             cout << "Customer " << i+1 << ":" << endl;
-             customers[i].display();
-             cout << "-------------------------------" << endl;
+     // Writes one revenue table of report to sink, largest revenue first (months in
+     // order), then the totals.
+     static void writeRevenue(ReportKind kind, const RevenueReport& report, ReportSink& sink) {
+         vector<pair<uint32_t, const RevenueCell*>> lines;
+         const vector<RevenueCell>& cells = kind == ReportCars ? report.byCar : kind == ReportCustomers ? report.byCustomer : report.byBrand;
+         if(kind == ReportMonths) {
+             for (const auto& entry : report.byMonth) {
+                 lines.emplace_back(entry.first, &entry.second);
+             }
+         } else {
+             for (size_t key = 0; key < cells.size(); key++) {
+                 if(cells[key].rentals != 0) {
+                     lines.emplace_back(static_cast<uint32_t>(key), &cells[key]);
+                 }
+             }
+             sort(lines.begin(), lines.end(), [](const pair<uint32_t, const RevenueCell*>& a, const pair<uint32_t, const RevenueCell*>& b) {
+                 return a.second->revenue != b.second->revenue ? a.second->revenue > b.second->revenue : a.first < b.first;
+             });
+         }
+         switch(kind) {
+             case ReportCars: sink.table("-------- Revenue by Car --------", {{"License Plate", -13}, {"Rentals", 10}, {"Revenue", 14}}); break;
+             case ReportCustomers: sink.table("-------- Revenue by Customer --------", {{"Customer ID", 11}, {"Rentals", 10}, {"Revenue", 14}}); break;
+             case ReportBrands: sink.table("-------- Revenue by Brand --------", {{"Brand", -16}, {"Rentals", 10}, {"Revenue", 14}}); break;
+             default: sink.table("-------- Revenue by Month --------", {{"Month", -7}, {"Rentals", 10}, {"Revenue", 14}}); break;
+         }
+         bool more = true;
+         for (size_t i = 0; i < lines.size() && more; i++) {
+             uint32_t key = lines[i].first;
+             if(kind == ReportCars) {
+                 sink.field(licensePlates.value(key));
+             } else if(kind == ReportCustomers) {
+                 sink.field(int64_t(key));
+             } else if(kind == ReportBrands) {
+                 sink.field(carBrands.value(key));
+             } else {
+                 char month[8];
+                 snprintf(month, sizeof(month), "%04d-%02d", static_cast<int>(key / 12) % 10000, static_cast<int>(key % 12) + 1);
+                 sink.field(month);
+             }
+             more = sink.field(int64_t(lines[i].second->rentals)).amount(lines[i].second->revenue).row();
+         }
+         if(more) {
+             char totals[128];
+             if(kind == ReportBrands && report.removedCars.rentals != 0) {
+                 snprintf(totals, sizeof(totals), "Cars no longer in the fleet: %llu rental(s), $%.2f",
+                          static_cast<unsigned long long>(report.removedCars.rentals), report.removedCars.revenue);
+                 sink.note(totals);
+             }
+             snprintf(totals, sizeof(totals), "Total: %llu rental(s), $%.2f", static_cast<unsigned long long>(report.total.rentals),
+                      report.total.revenue);
+             sink.note(totals);
          }
      }
      
      /*************************************************************************************
-      * Rental Process Functions
+      * generateReport()
+      * Description: Streams a report to sink and returns the number of rows written. The
+      *              rentals report passes every rental, archived history first, through
+      *              filter straight to the sink; the others aggregate with revenueReport().
+      *              Both read a pinned RentalHistory, so a report paused on the console
+      *              holds no lock.
       *************************************************************************************/
-     // Rents a car.
-     void rentCar() {
-         int customerId;
-         string license;
-         int rentalDays;
-         
-         cout << "Enter Customer ID: ";
-         cin >> customerId;
-         if(findCustomerIndex(customerId) == -1) {
-             cout << "Customer not found!" << endl;
-             return;
+     size_t generateReport(ReportKind kind, const ReportFilter& filter, ReportSink& sink) {
+         if(kind != ReportRentals) {
+             writeRevenue(kind, revenueReport(filter), sink);
+             return sink.rows();
          }
-         
-         cout << "Enter Car License Plate: ";
-         cin >> license;
-         int carIndex = findCarIndex(license);
-         if(carIndex == -1) {
-             cout << "Car not found!" << endl;
+         ProbeTimer timer(ProbeReport);
+         vector<char> selectedPlates;
+         RentalHistory history;
+         {
+             shared_lock<shared_mutex> carsGuard(carsLock);
+             if(!filter.brand.empty()) {
+                 selectedPlates.assign(licensePlates.size(), 0);
+                 for (const Car& car : cars) {
+                     selectedPlates[car.getPlateId()] = car.getBrand() == filter.brand;
+                 }
+             }
+             lock_guard<mutex> rentalsGuard(rentalsLock);
+             history = pinRentals();
+         }
+         sink.table("-------- Rental Report --------", {{"Rental ID", 9}, {"Customer ID", 11}, {"Car License", -11},
+                                                        {"Rental Start", -19}, {"Rental End", -19}, {"Total Cost", 12}});
+         bool more = true;
+         auto write = [&](const Rental& rental) {
+             int day = dayOfTimestamp(rental.getRentalStart());
+             uint32_t plate = rental.getCarId();
+             if(day < filter.fromDay || day >= filter.toDay ||
+                (filter.customerId != 0 && rental.getCustomerId() != filter.customerId) ||
+                (!filter.brand.empty() && (plate >= selectedPlates.size() || !selectedPlates[plate]))) {
+                 return;
+             }
+             more = sink.field(int64_t(rental.getRentalId())).field(int64_t(rental.getCustomerId())).field(rental.getCarLicense())
+                        .timestamp(rental.getRentalStart()).timestamp(rental.getRentalEnd()).amount(rental.getTotalCost()).row();
+         };
+         // Archived history first, decoding one segment at a time.
+         archive.forEachSegment(history.segments, [&](const vector<Rental>& archived, const vector<Payment>&) {
+             for (size_t i = 0; i < archived.size() && more; i++) {
+                 write(archived[i]);
+             }
+         });
+         const SlotTable<Rental>& active = history.rentals;
+         for (size_t i = 0; i < active.slotCount() && more; i++) {
+             if(active.isLive(i)) {
+                 write(active[i]);
+             }
+         }
+         return sink.rows();
+     }
+     
+     // Asks for a report, its filters and where to send it.
+     void generateReport() {
+         int kind = 0;
+         string from, to, brand, file;
+         ReportFilter filter;
+         cout << "Report (1 Rentals, 2 Revenue by Car, 3 Revenue by Customer, 4 Revenue by Brand, 5 Revenue by Month): ";
+         cin >> kind;
+         cout << "Rentals Starting From (YYYY-MM-DD, * for any): ";
+         cin >> from;
+         cout << "Starting Before (YYYY-MM-DD, * for any): ";
+         cin >> to;
+         cout << "Brand (* for any): ";
+         cin >> brand;
+         cout << "Customer ID (0 for any): ";
+         cin >> filter.customerId;
+         cout << "Output File (.csv for CSV, - for the screen): ";
+         cin >> file;
+         if(kind < 1 || kind > ReportKindCount || (from != "*" && !parseDate(from, filter.fromDay)) ||
+            (to != "*" && !parseDate(to, filter.toDay))) {
+             cout << opStatusMessage(OpInvalidArgument) << endl;
              return;
          }
+         filter.brand = brand == "*" ? "" : brand;
          
-         if(!cars[carIndex].available()) {
-             cout << "Car is not available for rent!" << endl;
+         auto start = chrono::steady_clock::now();
+         unique_ptr<ReportSink> sink(file == "-" ? new ReportSink() : new ReportSink(file));
+         size_t rows = sink->isOpen() ? generateReport(static_cast<ReportKind>(kind - 1), filter, *sink) : 0;
+         if(!sink->finish()) {
+             cout << "Error writing " << file << endl;
              return;
          }
-         
-         cout << "Enter Number of Rental Days: ";
-         cin >> rentalDays;
-         
-         double cost = cars[carIndex].getRentalPricePerDay() * rentalDays;
-         string startTime = getCurrentDateTime();
-         // Until the car is returned, set rental end as "N/A".
-         Rental newRental(nextRentalId++, customerId, license, startTime, "N/A", cost);
-         rentals.push_back(newRental);
-         // Mark the car as rented (not available).
-         cars[carIndex].setAvailability(false);
-         
-         cout << "Car rented successfully!" << endl;
-         cout << "Total Cost: $" << cost << endl;
+         double elapsedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+         cout << rows << " rows" << (file == "-" ? "" : " written to " + file) << " in " << elapsedMs << " ms." << endl;
      }
      
-     // Processes the return of a rented car.
-     void returnCar() {
-         int rentalId;
-         cout << "Enter Rental ID for return: ";
-         cin >> rentalId;
-         int index = findRentalIndex(rentalId);
-         if(index == -1) {
-             cout << "Rental record not found!" << endl;
-             return;
+     // Writes the system metrics to out. Callers hold every table lock.
+     void writeStatus(ostream& out) {
+         size_t rented = rentedCars;
+         out << "System Status:" << endl;
+         out << "Total Cars: " << cars.size() << endl;
+         out << "  Available: " << cars.size() - rented << endl;
+         out << "  Rented: " << rented << endl;
+         out << "  Utilisation: " << fixed << setprecision(1)
+             << (cars.empty() ? 0.0 : 100.0 * rented / cars.size()) << "%" << endl;
+         if(fleet.branchCount() > 1) {
+             // Counted on every shard at once.
+             map<string, pair<size_t, size_t>> byBranch;
+             for (const auto& entry : fleet.branchCounts(pool())) {
+                 if(entry.second.first != 0) byBranch[branchName(entry.first)] = entry.second;
+             }
+             out << "Branches:" << endl;
+             for (const auto& entry : byBranch) {
+                 out << "  " << entry.first << ": " << entry.second.first << " car(s), "
+                      << entry.second.second << " available" << endl;
+             }
          }
-         // Update the rental record with the current time as the return time.
-         rentals[index] = Rental(rentals[index].getRentalId(),
-                                 rentals[index].getCustomerId(),
-                                 rentals[index].getCarLicense(),
-                                 rentals[index].getRentalStart(),
-                                 getCurrentDateTime(),
-                                 rentals[index].getTotalCost());
-                                 
-         int carIndex = findCarIndex(rentals[index].getCarLicense());
-         if(carIndex != -1) {
-             cars[carIndex].setAvailability(true);
+         out << "Total Customers: " << customers.size() << endl;
+         out << "Total Rentals: " << rentals.size() << endl;
+         out << "  Open: " << openRentals << endl;
+         out << "  Closed: " << rentals.size() - openRentals << endl;
+         out << "Total Payments: " << payments.size() << endl;
+         out << setprecision(2);
+         out << "Total Billed: $" << totalBilled << endl;
+         out << "Total Paid: $" << totalPaid << endl;
+         out << "Outstanding Balance: $" << totalBilled - totalPaid << endl;
+         if(!archive.list().empty()) {
+             size_t archivedRentals = 0, archivedPayments = 0;
+             double archivedBilled = 0.0;
+             for (const RentalArchive::Segment& segment : archive.list()) {
+                 archivedRentals += segment.rentals;
+                 archivedPayments += segment.payments;
+                 archivedBilled += segment.billed;
+             }
+             out << "Archived Rentals: " << archivedRentals << " in " << archive.list().size() << " segment(s)" << endl;
+             out << "  Payments: " << archivedPayments << endl;
+             out << "  Billed (settled): $" << archivedBilled << endl;
          }
-         
-         cout << "Car returned successfully!" << endl;
+         if(!paymentTotalsByMethod.empty()) {
+             out << "Payments by Method:" << endl;
+             map<string, PaymentTotal> byMethod;
+             for (uint32_t id = 0; id < paymentTotalsByMethod.size(); id++) {
+                 if(paymentTotalsByMethod[id].count != 0) {
+                     byMethod[paymentMethods.value(id)] = paymentTotalsByMethod[id];
+                 }
+             }
+             for (const auto& entry : byMethod) {
+                 out << "  " << entry.first << ": " << entry.second.count
+                      << " payment(s), $" << entry.second.amount << endl;
+             }
+         }
+         out << "Memory Usage (estimated):" << endl;
+         size_t totalBytes = 0;
+         for (const auto& part : memoryBreakdown()) {
+             out << "  " << part.first << ": " << part.second / (1024.0 * 1024.0) << " MiB" << endl;
+             totalBytes += part.second;
+         }
+         out << "  Total: " << totalBytes / (1024.0 * 1024.0) << " MiB" << endl;
+         out << "  Tombstoned Slots: " << cars.tombstones() + customers.tombstones() + rentals.tombstones() << endl;
+         if(size_t resident = residentBytes()) {
+             out << "  Process Resident: " << resident / (1024.0 * 1024.0) << " MiB" << endl;
+         }
+     }
+     
+     // Displays system metrics. They are gathered under the table locks, which are
+     // released before anything is written to the console.
+     void systemStatus() {
+         ostringstream out;
+         {
+             shared_lock<shared_mutex> carsGuard(carsLock);
+             shared_lock<shared_mutex> customersGuard(customersLock);
+             lock_guard<mutex> rentalsGuard(rentalsLock);
+             lock_guard<mutex> paymentsGuard(paymentsLock);
+             writeStatus(out);
+         }
+         cout << out.str();
      }
      
      /*************************************************************************************
-      * Payment Functions
+      * Performance Statistics
       *************************************************************************************/
-     // Processes a payment for a rental.
-     void processPayment() {
-         int rentalId;
-         double amount;
-         string method;
-         cout << "Enter Rental ID for Payment: ";
-         cin >> rentalId;
-         int index = findRentalIndex(rentalId);
-         if(index == -1) {
-             cout << "Rental record not found!" << endl;
-             return;
+     // Writes the counters and latency percentiles of every probe to file as JSON.
+     static bool writeStats(const string& file) {
+         vector<Instrumentation::ProbeSummary> summaries = probes.summarize();
+         string json = "{\n  \"threads\": " + to_string(probes.threadCount()) + ",\n  \"probes\": [";
+         for (int probe = 0; probe < ProbeCount; probe++) {
+             const Instrumentation::ProbeSummary& summary = summaries[probe];
+             json += probe == 0 ? "\n" : ",\n";
+             json += "    {\"name\": \"" + string(ProbeNames[probe]) + "\", \"calls\": " + to_string(summary.calls) +
+                     ", \"timed\": " + to_string(summary.timed) + ", \"meanNs\": " + to_string(llround(summary.meanNanos())) +
+                     ", \"p50Ns\": " + to_string(summary.percentileNanos(0.50)) + ", \"p90Ns\": " + to_string(summary.percentileNanos(0.90)) +
+                     ", \"p99Ns\": " + to_string(summary.percentileNanos(0.99)) + ", \"maxNs\": " + to_string(summary.maxNanos) + "}";
          }
-         cout << "Enter Payment Amount: ";
-         cin >> amount;
-         cout << "Enter Payment Method (CreditCard/Cash): ";
-         cin >> method;
-         
-         Payment newPayment(nextPaymentId++, rentalId, amount, method, getCurrentDateTime());
-         payments.push_back(newPayment);
-         cout << "Payment processed successfully!" << endl;
+         json += "\n  ]\n}\n";
+         return writeFileAtomically(file, [&json](FILE* out) {
+             return fwrite(json.data(), 1, json.size(), out) == json.size();
+         });
+     }
+     
+     // Prints call counts and latency percentiles per operation, then writes stats.json.
+     void performanceStatistics() {
+         vector<Instrumentation::ProbeSummary> summaries = probes.summarize();
+         auto micros = [](double nanos) { return nanos / 1000.0; };
+         cout << "-------- Performance Statistics (microseconds) --------" << endl;
+         cout << fixed << setprecision(2);
+         for (int probe = 0; probe < ProbeCount; probe++) {
+             const Instrumentation::ProbeSummary& summary = summaries[probe];
+             if(summary.calls == 0) {
+                 continue;
+             }
+             cout << ProbeNames[probe] << ": " << summary.calls << " call(s)";
+             if(summary.timed != summary.calls) {
+                 cout << ", " << summary.timed << " timed";
+             }
+             cout << endl;
+             cout << "  mean " << micros(summary.meanNanos()) << "  p50 " << micros(summary.percentileNanos(0.50))
+                  << "  p90 " << micros(summary.percentileNanos(0.90)) << "  p99 " << micros(summary.percentileNanos(0.99))
+                  << "  max " << micros(summary.maxNanos) << endl;
+         }
+         cout.unsetf(ios::floatfield);
+         cout << setprecision(6);
+         cout << (writeStats(statsDataFile) ? "Written to " : "Could not write ") << statsDataFile << endl;
      }
      
      /*************************************************************************************
-      * Report Generation Functions
+      * Maintenance Jobs
       *************************************************************************************/
-     // Generates a simple report on all rentals.
-     void generateReport() {
-         cout << "-------- Rental Report --------" << endl;
-         for (size_t i = 0; i < rentals.size(); i++) {
-             rentals[i].display();
-             cout << "-------------------------------" << endl;
+     // Lists the scheduled jobs and the recent runs.
+     void listJobs() {
+         static const char* const priorities[] = {"low", "normal", "high"};
+         vector<JobInfo> jobs = maintenance.jobs();
+         cout << "-------- Maintenance Jobs --------" << endl;
+         if(jobs.empty()) {
+             cout << "No jobs." << endl;
+         }
+         cout << fixed << setprecision(2);
+         for (const JobInfo& job : jobs) {
+             cout << "#" << job.id << " " << job.name << " [" << priorities[job.priority] << "] ";
+             switch(job.state) {
+                 case JobWaiting:
+                     cout << "queued, next run in " << job.dueInSeconds << " s";
+                     break;
+                 case JobReady:
+                     cout << "queued, waiting for a worker";
+                     break;
+                 case JobRunning:
+                     cout << "running for " << job.elapsedSeconds << " s";
+                     break;
+                 case JobFinished:
+                 case JobCancelled:
+                     cout << (job.state == JobFinished ? "finished " : "cancelled ") << formatTimestamp(job.finishedAt);
+                     if(job.runs != 0 || job.state == JobFinished) {
+                         cout << " after " << job.elapsedSeconds << " s";
+                     }
+                     break;
+             }
+             if(job.intervalSeconds != 0) {
+                 cout << " (every " << job.intervalSeconds << " s, " << job.runs << " run(s))";
+             }
+             if(!job.result.empty()) {
+                 cout << ": " << job.result;
+             }
+             cout << endl;
          }
+         cout.unsetf(ios::floatfield);
+         cout << setprecision(6);
      }
      
-     // Displays system metrics.
-     void systemStatus() {
-         cout << "System Status:" << endl;
-         cout << "Total Cars: " << cars.size() << endl;
-         cout << "Total Customers: " << customers.size() << endl;
-         cout << "Total Rentals: " << rentals.size() << endl;
-         cout << "Total Payments: " << payments.size() << endl;
+     // Shows the jobs and queues one-shot jobs or cancels one.
+     void maintenanceJobs() {
+         listJobs();
+         cout << "1. Checkpoint Now" << endl;
+         cout << "2. Rebuild Indexes" << endl;
+         cout << "3. Archive Old Rentals (" << DefaultArchiveDays << " days)" << endl;
+         cout << "4. Check Overdue Rentals" << endl;
+         cout << "5. Cancel a Job" << endl;
+         cout << "0. Back" << endl;
+         cout << "Enter your choice: ";
+         int choice = 0;
+         cin >> choice;
+         int id = 0;
+         switch(choice) {
+             case 1:
+                 id = maintenance.schedule("checkpoint", PriorityHigh, 0, 0, [this](const atomic<bool>&) {
+                     return string(autosave() ? "checkpointed" : "write failed; journal kept");
+                 });
+                 break;
+             case 2:
+                 id = maintenance.schedule("rebuild indexes", PriorityNormal, 0, 0, [this](const atomic<bool>&) {
+                     return rebuildIndexesJob();
+                 });
+                 break;
+             case 3:
+                 id = maintenance.schedule("archive", PriorityNormal, 0, 0, [this](const atomic<bool>&) {
+                     size_t archivedRentals = 0, archivedPayments = 0;
+                     if(!archiveRentals(DefaultArchiveDays, archivedRentals, archivedPayments)) {
+                         return string("could not write the archive; nothing was moved");
+                     }
+                     return "archived " + to_string(archivedRentals) + " rental(s) and " + to_string(archivedPayments) + " payment(s)";
+                 });
+                 break;
+             case 4:
+                 id = maintenance.schedule("overdue check", PriorityLow, 0, 0, [this](const atomic<bool>& cancelled) {
+                     return overdueCheckJob(cancelled);
+                 });
+                 break;
+             case 5:
+                 cout << "Enter Job ID: ";
+                 cin >> id;
+                 cout << (maintenance.cancel(id) ? "Job cancelled." : "No such job is scheduled.") << endl;
+                 return;
+             default:
+                 return;
+         }
+         cout << "Queued as job #" << id << "." << endl;
+     }
+     
+     // Runs one batch command line and appends its result line to output. Blank lines and
+     // comments produce no output. Returns false if the command failed. Safe to call from
+     // several threads at once; the journal records are left for the caller to commit.
+     // local is false for network clients (see runBatchCommand()).
+     bool executeCommandLine(string line, string& output, bool local = true) {
+         if(!line.empty() && line.back() == '\r') {
+             line.pop_back();
+         }
+         vector<string> args;
+         splitBatchArgs(line, args);
+         if(args.empty() || args[0][0] == '#') {
+             return true;
+         }
+         string result;
+         OpStatus status = runBatchCommand(args, result, local);
+         if(status == OpOk) {
+             output += "ok";
+             if(!result.empty()) {
+                 output += ' ';
+                 output += result;
+             }
+         } else {
+             output += "err ";
+             output += opStatusCode(status);
+         }
+         output += '\n';
+         return status == OpOk;
+     }
+     
+     // Runs a block of newline-separated commands, commits their journal records and
+     // returns the result lines. Used by the server for each pipelined request block, so
+     // the commands may not write files.
+     string executeCommands(const string& block) {
+         string output;
+         size_t start = 0;
+         while(start < block.size()) {
+             size_t end = block.find('\n', start);
+             if(end == string::npos) {
+                 end = block.size();
+             }
+             executeCommandLine(block.substr(start, end - start), output, false);
+             start = end + 1;
+         }
+         journal.commit();
+         return output;
      }
      
      /*************************************************************************************
-      * Extra Processing (Dummy Function for Extended Code)
+      * runBatch()
+      * Description: Non-interactive mode. Reads one command per line and writes one result
+      *              line per command, using the same operations as the menu:
+      *
+      *                add-car <plate> <brand> <model> <year> <price>
+      *                        [branch]                                 -> ok
+      *                remove-car <plate>                               -> ok
+      *                add-customer <name> <license> <contact>          -> ok <customerId>
+      *                find-customer <text> [limit]                     -> ok <customerId> ...
+      *                rent <customerId> <plate> <days> [branch]        -> ok <rentalId> <cost>
+      *                rent <customerId> <plate> <from> <to> [branch]   -> ok <rentalId> <cost>
+      *                return <rentalId>                                -> ok <finalCost>
+      *                pay <rentalId> <amount> <method>                 -> ok <paymentId>
+      *                search [brand=B] [model=M] [minYear=Y] [maxYear=Y]
+      *                       [minPrice=P] [maxPrice=P] [available=0|1]
+      *                       [page=N] [size=N]                         -> ok <plate> ...
+      *                fleet-stats [search filters]                     -> ok <count> <avgPrice>
+      *                                                                    [<cheapestPlate> <price>]
+      *                quote <from> <days>[,<days>...] [search filters] -> ok <count>
+      *                                                                    [<plate> <price>[,<price>...] ...]
+      *                balance <rentalId>                               -> ok <billed> <paid> <owed>
+      *                reconcile [reportFile]                           -> ok <underpaid> <overpaid> <owed>
+      *                report rentals|cars|customers|brands|months <file>
+      *                       [from=D] [to=D] [brand=B] [customer=N]    -> ok <rows>
+      *                save                                             -> ok
+      *                archive [days]                                   -> ok <rentals> <payments>
+      *                stats [file]                                     -> ok
+      *                compact                                          -> ok <reclaimedSlots>
+      *
+      *              Arguments are separated by whitespace; use "double quotes" for values
+      *              containing spaces. Blank lines and lines starting with # are skipped.
+      *              Failures are reported as "err <code>". Output is buffered and written
+      *              in large blocks, and journal records are group-committed per block.
+      *              Returns the number of failed commands.
       *************************************************************************************/
-     // A dummy function to simulate extra processing.
-     void extraProcessing() {
-         cout << "Extra processing started." << endl;
-         for (int i = 0; i < 5; i++) {
-             cout << "Processing step " << i+1 << "..." << endl;
-             // Simulate a delay with a dummy loop.
-             for (int j = 0; j < 1000000; j++) {
-                 // Dummy work.
+     size_t runBatch(istream& in, ostream& out) {
+         const size_t flushBytes = 1 << 20;
+         string output;
+         output.reserve(flushBytes + 256);
+         string line;
+         size_t failures = 0;
+         journal.setGroupCommitSize(8192);
+         
+         while(getline(in, line)) {
+             if(!executeCommandLine(line, output)) {
+                 failures++;
+             }
+             if(output.size() >= flushBytes) {
+                 journal.commit();
+                 out.write(output.data(), output.size());
+                 output.clear();
              }
          }
-         cout << "Extra processing completed." << endl;
+         journal.commit();
+         out.write(output.data(), output.size());
+         out.flush();
+         return failures;
      }
      
      /*************************************************************************************
@@ -663,8 +7405,18 @@
              cout << "8. Process Payment" << endl;
              cout << "9. Generate Report" << endl;
              cout << "10. System Status" << endl;
-             cout << "11. Extra Processing" << endl;
+             cout << "11. Maintenance Jobs" << endl;
+             cout << "12. Find Available Cars" << endl;
+             cout << "13. Search Cars" << endl;
+             cout << "14. Reconcile Payments" << endl;
+             cout << "15. Fleet Statistics" << endl;
+             cout << "16. Archive Old Rentals" << endl;
+             cout << "17. Quote Prices" << endl;
+             cout << "18. Performance Statistics" << endl;
+             cout << "19. Search Customers" << endl;
              cout << "0. Exit" << endl;
+             // Waiting on the user closes the current group commit.
+             journal.commit();
              cout << "Enter your choice: ";
              cin >> choice;
              
@@ -700,7 +7452,31 @@
                      systemStatus();
                      break;
                  case 11:
-                     extraProcessing();
+                     maintenanceJobs();
+                     break;
+                 case 12:
+                     listAvailableCars();
+                     break;
+                 case 13:
+                     searchCars();
+                     break;
+                 case 14:
+                     reconcilePaymentsReport();
+                     break;
+                 case 15:
+                     fleetStatistics();
+                     break;
+                 case 16:
+                     archiveRentals();
+                     break;
+                 case 17:
+                     quotePrices();
+                     break;
+                 case 18:
+                     performanceStatistics();
+                     break;
+                 case 19:
+                     searchCustomers();
                      break;
                  case 0:
                      saveData();
@@ -712,14 +7488,583 @@
          } while(choice != 0);
      }
  };
+
+ #if !defined(_WIN32)
+ /*****************************************************************************************
+  * Class: RentalServer
+  * Description: Serves the batch command protocol (see runBatch()) to many clients over
+  *              TCP on 127.0.0.1. One reactor thread multiplexes the sockets with poll();
+  *              complete request lines are handed to a worker pool, which runs them against
+  *              the shared CarRentalSystem. Each client has at most one block in flight, so
+  *              its replies come back in request order; different clients run in parallel.
+  *              A "quit" line closes the connection. SIGINT/SIGTERM stop the server, which
+  *              then checkpoints the data.
+  *****************************************************************************************/
+ class RentalServer {
+ private:
+     struct Client {
+         int fd;
+         string input;
+         string output;
+         bool busy;
+         bool closing;
+     };
+     
+     struct Completion {
+         int clientId;
+         string output;
+         bool quit;
+     };
+     
+     // Input beyond this is left in the socket until the backlog drains (backpressure).
+     // A client that sends this much without a line break is dropped.
+     static const size_t MaxInputBytes = 4 << 20;
+     
+     CarRentalSystem& system;
+     int listenFd;
+     int wakePipe[2];
+     map<int, Client> clients;
+     int nextClientId;
+     size_t inFlight;   // Blocks handed to workers whose completions are not collected yet.
+     mutex completionsMutex;
+     vector<Completion> completions;
+     // Declared last so it is destroyed, joining its threads, before everything a task touches.
+     ThreadPool workers;
+     
+     static volatile sig_atomic_t stopRequested;
+     static int signalWakeFd;
+     
+     static void onSignal(int) {
+         stopRequested = 1;
+         if(signalWakeFd != -1) {
+             char byte = 0;
+             ssize_t ignored = write(signalWakeFd, &byte, 1);
+             (void)ignored;
+         }
+     }
+     
+     static void setNonBlocking(int fd) {
+         fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+     }
+     
+     void wake() {
+         char byte = 0;
+         ssize_t ignored = write(wakePipe[1], &byte, 1);
+         (void)ignored;
+     }
+     
+     // Hands the client's complete lines (up to a "quit" line, if any) to a worker.
+     void dispatch(int clientId, Client& client) {
+         if(client.busy) {
+             return;
+         }
+         size_t end = client.input.rfind('\n');
+         if(end == string::npos) {
+             return;
+         }
+         string block = client.input.substr(0, end + 1);
+         bool quit = false;
+         size_t start = 0;
+         while(start < block.size()) {
+             size_t lineEnd = block.find('\n', start);
+             string_view line(block.data() + start, lineEnd - start);
+             if(!line.empty() && line.back() == '\r') {
+                 line.remove_suffix(1);
+             }
+             if(line == "quit") {
+                 block.resize(start);
+                 quit = true;
+                 break;
+             }
+             start = lineEnd + 1;
+         }
+         client.input.erase(0, end + 1);
+         client.busy = true;
+         inFlight++;
+         workers.submit([this, clientId, block = move(block), quit] {
+             Completion done{clientId, system.executeCommands(block), quit};
+             {
+                 lock_guard<mutex> lock(completionsMutex);
+                 completions.push_back(move(done));
+             }
+             wake();
+         });
+     }
+     
+     void collectCompletions() {
+         vector<Completion> finished;
+         {
+             lock_guard<mutex> lock(completionsMutex);
+             finished.swap(completions);
+         }
+         for (Completion& done : finished) {
+             inFlight--;
+             auto it = clients.find(done.clientId);
+             if(it == clients.end()) {
+                 continue;
+             }
+             Client& client = it->second;
+             client.output += done.output;
+             client.busy = false;
+             if(done.quit) {
+                 // Nothing after "quit" is answered.
+                 client.input.clear();
+                 client.closing = true;
+             }
+             if(!stopRequested) {
+                 dispatch(it->first, client);
+             }
+         }
+     }
+     
+     // Returns false once the client should be dropped.
+     bool readFrom(Client& client) {
+         char buffer[65536];
+         for(;;) {
+             ssize_t got = read(client.fd, buffer, sizeof(buffer));
+             if(got > 0) {
+                 if(client.closing) {
+                     continue;
+                 }
+                 client.input.append(buffer, got);
+                 if(client.input.size() >= MaxInputBytes) {
+                     if(client.input.find('\n') == string::npos) {
+                         static const char tooLong[] = "err line-too-long\n";
+                         ssize_t ignored = write(client.fd, tooLong, sizeof(tooLong) - 1);
+                         (void)ignored;
+                         return false;
+                     }
+                     return true;
+                 }
+                 continue;
+             }
+             if(got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                 return true;
+             }
+             if(got < 0 && errno == EINTR) {
+                 continue;
+             }
+             // End of stream: answer what was sent (dispatch still runs), then close.
+             client.closing = true;
+             return true;
+         }
+     }
+     
+     bool writeTo(Client& client) {
+         size_t sent = 0;
+         while(sent < client.output.size()) {
+             ssize_t put = write(client.fd, client.output.data() + sent, client.output.size() - sent);
+             if(put < 0) {
+                 if(errno == EINTR) {
+                     continue;
+                 }
+                 if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                     break;
+                 }
+                 return false;
+             }
+             sent += put;
+         }
+         client.output.erase(0, sent);
+         return true;
+     }
+     
+ public:
+     RentalServer(CarRentalSystem& rentalSystem, size_t threadCount)
+         : system(rentalSystem), listenFd(-1), nextClientId(1), inFlight(0), workers(threadCount) {
+         wakePipe[0] = wakePipe[1] = -1;
+     }
+     
+     ~RentalServer() {
+         for (auto& entry : clients) {
+             ::close(entry.second.fd);
+         }
+         if(listenFd != -1) ::close(listenFd);
+         if(wakePipe[0] != -1) ::close(wakePipe[0]);
+         if(wakePipe[1] != -1) ::close(wakePipe[1]);
+         signalWakeFd = -1;
+     }
+     
+     bool listenOn(int port) {
+         listenFd = socket(AF_INET, SOCK_STREAM, 0);
+         if(listenFd == -1) {
+             return false;
+         }
+         int reuse = 1;
+         setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+         sockaddr_in address = {};
+         address.sin_family = AF_INET;
+         address.sin_port = htons(static_cast<uint16_t>(port));
+         address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+         if(bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            listen(listenFd, SOMAXCONN) != 0 || pipe(wakePipe) != 0) {
+             return false;
+         }
+         setNonBlocking(listenFd);
+         setNonBlocking(wakePipe[0]);
+         setNonBlocking(wakePipe[1]);
+         return true;
+     }
+     
+     // Runs the reactor until SIGINT/SIGTERM, then waits for in-flight requests.
+     void serve() {
+         stopRequested = 0;
+         signalWakeFd = wakePipe[1];
+         signal(SIGINT, onSignal);
+         signal(SIGTERM, onSignal);
+         signal(SIGPIPE, SIG_IGN);
+         
+         vector<pollfd> polled;
+         vector<int> polledIds;
+         while(!stopRequested) {
+             polled.clear();
+             polledIds.clear();
+             polled.push_back({listenFd, POLLIN, 0});
+             polled.push_back({wakePipe[0], POLLIN, 0});
+             for (auto& entry : clients) {
+                 Client& client = entry.second;
+                 short events = 0;
+                 if(!client.closing && client.input.size() < MaxInputBytes) events |= POLLIN;
+                 if(!client.output.empty()) events |= POLLOUT;
+                 polled.push_back({client.fd, events, 0});
+                 polledIds.push_back(entry.first);
+             }
+             if(poll(polled.data(), polled.size(), -1) < 0) {
+                 if(errno == EINTR) {
+                     continue;
+                 }
+                 break;
+             }
+             if(polled[1].revents & POLLIN) {
+                 char drain[256];
+                 while(read(wakePipe[0], drain, sizeof(drain)) > 0) {}
+                 collectCompletions();
+             }
+             if(polled[0].revents & POLLIN) {
+                 for(;;) {
+                     int fd = accept(listenFd, nullptr, nullptr);
+                     if(fd == -1) {
+                         break;
+                     }
+                     setNonBlocking(fd);
+                     int noDelay = 1;
+                     setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+                     clients[nextClientId++] = Client{fd, string(), string(), false, false};
+                 }
+             }
+             for (size_t i = 0; i < polledIds.size(); i++) {
+                 auto it = clients.find(polledIds[i]);
+                 if(it == clients.end()) {
+                     continue;
+                 }
+                 Client& client = it->second;
+                 short revents = polled[i + 2].revents;
+                 bool alive = true;
+                 if(revents & (POLLIN | POLLHUP)) {
+                     alive = readFrom(client);
+                     dispatch(it->first, client);
+                 }
+                 if(alive && !client.output.empty()) {
+                     alive = writeTo(client);
+                 }
+                 if((revents & POLLERR) || !alive ||
+                    (client.closing && !client.busy && client.output.empty())) {
+                     ::close(client.fd);
+                     clients.erase(it);
+                 }
+             }
+             // Replies that arrived via collectCompletions() are sent right away when possible.
+             for (auto it = clients.begin(); it != clients.end();) {
+                 Client& client = it->second;
+                 bool alive = client.output.empty() || writeTo(client);
+                 if(!alive || (client.closing && !client.busy && client.output.empty())) {
+                     ::close(client.fd);
+                     it = clients.erase(it);
+                 } else {
+                     ++it;
+                 }
+             }
+         }
+         // No new blocks are dispatched now; wait for the ones running, so the caller's
+         // final checkpoint sees their effects, and pass on their replies if possible.
+         while(inFlight > 0) {
+             pollfd woken = {wakePipe[0], POLLIN, 0};
+             if(poll(&woken, 1, -1) < 0 && errno != EINTR) {
+                 break;
+             }
+             char drain[256];
+             while(read(wakePipe[0], drain, sizeof(drain)) > 0) {}
+             collectCompletions();
+         }
+         for (auto& entry : clients) {
+             writeTo(entry.second);
+         }
+         signal(SIGINT, SIG_DFL);
+         signal(SIGTERM, SIG_DFL);
+     }
+ };
+ 
+ volatile sig_atomic_t RentalServer::stopRequested = 0;
+ int RentalServer::signalWakeFd = -1;
+ 
+ /*****************************************************************************************
+  * Class: LoadClient
+  * Description: A blocking connection to a RentalServer, used by the load generator.
+  *****************************************************************************************/
+ class LoadClient {
+ private:
+     int fd;
+     string pending;
+ 
+ public:
+     LoadClient() : fd(-1) {}
+     ~LoadClient() { if(fd != -1) ::close(fd); }
+     
+     bool connectTo(int port) {
+         fd = socket(AF_INET, SOCK_STREAM, 0);
+         sockaddr_in address = {};
+         address.sin_family = AF_INET;
+         address.sin_port = htons(static_cast<uint16_t>(port));
+         address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+         if(fd == -1 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+             return false;
+         }
+         int noDelay = 1;
+         setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+         return true;
+     }
+     
+     bool send(const string& request) {
+         size_t sent = 0;
+         while(sent < request.size()) {
+             ssize_t put = write(fd, request.data() + sent, request.size() - sent);
+             if(put <= 0) {
+                 return false;
+             }
+             sent += put;
+         }
+         return true;
+     }
+     
+     // Reads exactly count reply lines.
+     bool receive(size_t count, vector<string>& lines) {
+         lines.clear();
+         char buffer[65536];
+         while(lines.size() < count) {
+             size_t end = pending.find('\n');
+             if(end != string::npos) {
+                 lines.push_back(pending.substr(0, end));
+                 pending.erase(0, end + 1);
+                 continue;
+             }
+             ssize_t got = read(fd, buffer, sizeof(buffer));
+             if(got <= 0) {
+                 return false;
+             }
+             pending.append(buffer, got);
+         }
+         return true;
+     }
+ };
+ 
+ /*****************************************************************************************
+  * Function: runLoadGenerator
+  * Description: Client for --serve. Each thread opens its own connection, adds a customer
+  *              and a set of cars, then pipelines rent/return pairs and reports throughput.
+  *              Finally every thread tries to rent the same car at once to check that
+  *              exactly one request wins.
+  *****************************************************************************************/
+ int runLoadGenerator(int port, int threadCount, int operations) {
+     const int window = 64;
+     atomic<long long> completed(0), failed(0);
+     atomic<int> contendedWins(0), ready(0), attempted(0);
+     atomic<bool> setupFailed(false);
+     
+     // The shared car for the contention check; a duplicate from an earlier run is fine.
+     {
+         LoadClient admin;
+         vector<string> reply;
+         if(!admin.connectTo(port) || !admin.send("add-car LG-SHARED Load Gen 2024 10\n") ||
+            !admin.receive(1, reply)) {
+             cerr << "Cannot reach the server on port " << port << endl;
+             return 1;
+         }
+     }
+     
+     auto started = chrono::steady_clock::now();
+     vector<thread> threads;
+     for (int t = 0; t < threadCount; t++) {
+         threads.emplace_back([&, t] {
+             LoadClient client;
+             vector<string> reply;
+             string tag = "LG" + to_string(t) + "-" + to_string(chrono::steady_clock::now().time_since_epoch().count());
+             if(!client.connectTo(port) ||
+                !client.send("add-customer \"Load " + tag + "\" " + tag + " loadgen\n") ||
+                !client.receive(1, reply) || reply[0].compare(0, 3, "ok ") != 0) {
+                 setupFailed = true;
+                 ready++;
+                 attempted++;
+                 return;
+             }
+             string customerId = reply[0].substr(3);
+             string request;
+             for (int i = 0; i < window; i++) {
+                 request += "add-car " + tag + "-" + to_string(i) + " Load Gen 2024 " + to_string(20 + i) + "\n";
+             }
+             client.send(request);
+             client.receive(window, reply);
+             
+             long long target = max(1, operations / threadCount);
+             long long done = 0;
+             while(done < target) {
+                 // Rent a window of cars in one pipelined block, then return them all.
+                 request.clear();
+                 for (int i = 0; i < window; i++) {
+                     request += "rent " + customerId + " " + tag + "-" + to_string(i) + " 1\n";
+                 }
+                 if(!client.send(request) || !client.receive(window, reply)) {
+                     break;
+                 }
+                 request.clear();
+                 for (const string& line : reply) {
+                     if(line.compare(0, 3, "ok ") == 0) {
+                         request += "return " + line.substr(3, line.find(' ', 3) - 3) + "\n";
+                     } else {
+                         failed++;
+                     }
+                 }
+                 size_t returns = count(request.begin(), request.end(), '\n');
+                 if(!client.send(request) || !client.receive(returns, reply)) {
+                     break;
+                 }
+                 for (const string& line : reply) {
+                     if(line.compare(0, 2, "ok") != 0) failed++;
+                 }
+                 done += window + returns;
+             }
+             completed += done;
+             
+             // Contention check: wait for every thread, then all rent the same car.
+             ready++;
+             while(ready < threadCount) {
+                 this_thread::yield();
+             }
+             client.send("rent " + customerId + " LG-SHARED 1\n");
+             bool won = client.receive(1, reply) && reply[0].compare(0, 3, "ok ") == 0;
+             if(won) {
+                 contendedWins++;
+             }
+             // The winner holds the car until every attempt has been answered.
+             attempted++;
+             while(attempted < threadCount) {
+                 this_thread::yield();
+             }
+             if(won) {
+                 client.send("return " + reply[0].substr(3, reply[0].find(' ', 3) - 3) + "\n");
+                 client.receive(1, reply);
+             }
+             client.send("quit\n");
+         });
+     }
+     for (thread& worker : threads) {
+         worker.join();
+     }
+     double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+     
+     if(setupFailed) {
+         cerr << "Load generator setup failed." << endl;
+         return 1;
+     }
+     cout << "Threads          : " << threadCount << endl;
+     cout << "Operations       : " << completed.load() << " (" << failed.load() << " failed)" << endl;
+     cout << "Elapsed          : " << fixed << setprecision(3) << seconds << " s" << endl;
+     cout << "Throughput       : " << setprecision(0) << completed.load() / seconds << " ops/s" << endl;
+     cout << "Contended rents  : " << contendedWins.load() << " of " << threadCount
+          << (contendedWins == 1 ? " won (ok)" : contendedWins == 0 ? " won (car already rented)" : " won (DOUBLE BOOKING)") << endl;
+     return contendedWins == 1 && failed == 0 ? 0 : 2;
+ }
+ #endif
  
+ #ifndef CAR_RENTAL_NO_MAIN
  /*****************************************************************************************
   * Main Function
   * Description: Entry point. Loads data, starts the system, and exits gracefully.
   *****************************************************************************************/
- int main() {
+ int main(int argc, char* argv[]) {
      CarRentalSystem system;
+     // "--autosave <seconds>" may precede the mode (0 turns autosave off).
+     int autosaveSeconds = CarRentalSystem::DefaultAutosaveSeconds;
+     if(argc > 2 && string(argv[1]) == "--autosave") {
+         if(!parseCsvInt(argv[2], autosaveSeconds) || autosaveSeconds < 0) {
+             cerr << "Invalid argument." << endl;
+             return 1;
+         }
+         argv[2] = argv[0];
+         argv += 2;
+         argc -= 2;
+     }
+     if(argc > 1) {
+         string command = argv[1];
+         if(command == "--import-csv") {
+             return system.convertStorage(true) ? 0 : 1;
+         }
+         if(command == "--export-csv") {
+             return system.convertStorage(false) ? 0 : 1;
+         }
+         if(command == "--batch") {
+             ios::sync_with_stdio(false);
+             system.loadData();
+             if(argc > 2 && string(argv[2]) != "-") {
+                 ifstream commands(argv[2]);
+                 if(!commands) {
+                     cerr << "Cannot open " << argv[2] << endl;
+                     return 1;
+                 }
+                 return system.runBatch(commands, cout) == 0 ? 0 : 2;
+             }
+             return system.runBatch(cin, cout) == 0 ? 0 : 2;
+         }
+         if(command == "--serve" || command == "--loadgen") {
+ #if defined(_WIN32)
+             cerr << command << " is not supported on this platform." << endl;
+             return 1;
+ #else
+             int port = 7070, threadCount = static_cast<int>(thread::hardware_concurrency());
+             int operations = 200000;
+             if((argc > 2 && !parseCsvInt(argv[2], port)) ||
+                (argc > 3 && !parseCsvInt(argv[3], threadCount)) || threadCount < 1 ||
+                (argc > 4 && !parseCsvInt(argv[4], operations))) {
+                 cerr << "Invalid argument." << endl;
+                 return 1;
+             }
+             if(command == "--loadgen") {
+                 return runLoadGenerator(port, threadCount, operations);
+             }
+             system.loadData();
+             system.startMaintenance(autosaveSeconds);
+             RentalServer server(system, threadCount);
+             if(!server.listenOn(port)) {
+                 cerr << "Cannot listen on 127.0.0.1:" << port << endl;
+                 return 1;
+             }
+             cout << "Serving on 127.0.0.1:" << port << " with " << threadCount << " workers." << endl;
+             server.serve();
+             return system.saveData() ? 0 : 1;
+ #endif
+         }
+         cout << "Usage: " << argv[0] << " [--autosave seconds] [--import-csv | --export-csv | --batch [file] |" << endl;
+         cout << "        --serve [port [threads]] | --loadgen [port [threads [ops]]]]" << endl;
+         cout << "  --autosave    checkpoint in the background this often (default 300, 0 = off)" << endl;
+         cout << "  --import-csv  convert the CSV data files into the binary snapshot (rental.snap)" << endl;
+         cout << "  --export-csv  write the binary snapshot back out as CSV data files" << endl;
+         cout << "  --batch       run commands from file (or stdin), one per line" << endl;
+         cout << "  --serve       serve the batch commands over TCP on 127.0.0.1 (default port 7070)" << endl;
+         cout << "  --loadgen     drive a running server with rent/return traffic from several clients" << endl;
+         return 1;
+     }
      system.loadData();
+     system.startMaintenance(autosaveSeconds);
      system.run();
      return 0;
  }
+ #endif